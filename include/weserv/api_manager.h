@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <weserv/config.h>
 #include <weserv/env_interface.h>
@@ -70,6 +71,47 @@ class ApiManager {
                                          std::string *out_buf,
                                          const Config &config) = 0;
 
+    /**
+     * Process a source into multiple variants, for e.g. the widths of a
+     * `srcset`. Variants that load the same pages and don't need to be
+     * trimmed or gamma corrected share a single decode of the source, at the
+     * size needed by the largest of them.
+     * @param queries Query strings, one for each variant.
+     * @param source Source to read from.
+     * @param targets Targets to write to, one for each variant.
+     * @param config Optional API configuration.
+     * @return A Status object for each variant.
+     */
+    virtual std::vector<utils::Status>
+    process_batch(const std::vector<std::string> &queries,
+                  std::unique_ptr<io::SourceInterface> source,
+                  std::vector<std::unique_ptr<io::TargetInterface>> targets,
+                  const Config &config) = 0;
+
+    /**
+     * Process from a memory buffer into multiple memory buffers, see
+     * `process_batch`.
+     * @param queries Query strings, one for each variant.
+     * @param in_buf Input buffer.
+     * @param out_bufs Output buffers, one for each variant.
+     * @param config Optional API configuration.
+     * @return A Status object for each variant.
+     */
+    virtual std::vector<utils::Status>
+    process_buffer(const std::vector<std::string> &queries,
+                   const std::string &in_buf,
+                   std::vector<std::string> *out_bufs,
+                   const Config &config) = 0;
+
+    /**
+     * Normalize a query string, e.g. for use within cache keys. The result
+     * is stable, sorted and leaves out default values. Keys that are handled
+     * by the nginx module (such as `url` and `encoding`) are not included.
+     * @param query Query string.
+     * @return The canonical form of the query string.
+     */
+    virtual std::string canonical_query(const std::string &query) = 0;
+
  protected:
     ApiManager() = default;
 };
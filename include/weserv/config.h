@@ -16,7 +16,8 @@ struct Config {
           limit_output_pixels(71000000), max_pages(256), quality(80),
           avif_quality(80), jpeg_quality(80), tiff_quality(80),
           webp_quality(80), avif_effort(4), gif_effort(7), webp_effort(4),
-          zlib_level(6), fail_on_error(0) {}
+          zlib_level(6), fail_on_error(0), exif_thumbnail(0), cost_budget(0),
+          vips_concurrency(0), timings(0) {}
 
     /**
      * Enables or disables image savers to be used within the `&output=` query
@@ -133,6 +134,48 @@ struct Config {
      * weserv_fail_on_error off;
      */
     intptr_t fail_on_error;
+
+    /**
+     * Use the thumbnail embedded within the EXIF metadata of an image (e.g.
+     * the 160x120 thumbnail stored by most cameras) instead of decoding the
+     * image itself, if it covers the requested size and matches the aspect
+     * ratio and color space of the image. Note that these thumbnails are
+     * usually encoded at a lower quality.
+     * Defaults to `off`.
+     * weserv_exif_thumbnail off;
+     */
+    intptr_t exif_thumbnail;
+
+    /**
+     * The processing budget of a worker process, shared by all images that
+     * are processed concurrently. The cost of an image is estimated from its
+     * input and output dimensions and the output format, in pixels. Images
+     * that don't fit within the remaining budget are rejected, unless no
+     * other image is being processed.
+     * Defaults to `0`, which disables the budget.
+     * weserv_cost_budget 0;
+     */
+    uintptr_t cost_budget;
+
+    /**
+     * The maximum number of libvips worker threads used to process a single
+     * image. Within this limit, the number of threads is scaled with the
+     * dimensions of the output image, so that small thumbnails are processed
+     * single-threaded.
+     * Defaults to `0`, which leaves it up to libvips (i.e. the number of CPU
+     * cores or the `VIPS_CONCURRENCY` environment variable).
+     * @note Requires libvips >= 8.13, this is ignored otherwise.
+     * weserv_vips_concurrency 0;
+     */
+    intptr_t vips_concurrency;
+
+    /**
+     * Measure the wall-clock and CPU time of each stage of the pipeline and
+     * report them through `ApiEnvInterface::timings`.
+     * Defaults to `off`.
+     * weserv_timings off;
+     */
+    intptr_t timings;
 };
 
 }  // namespace weserv::api
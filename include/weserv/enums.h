@@ -13,7 +13,9 @@ enum class Output : uintptr_t {
     Tiff = 1U << 5,
     Gif = 1U << 6,
     Json = 1U << 7,
-    All = Jpeg | Png | Webp | Avif | Tiff | Gif | Json,  // 0xFE
+    Auto = 1U << 8,  // Negotiated, see `&accept=`
+    Blurhash = 1U << 9,
+    All = Jpeg | Png | Webp | Avif | Tiff | Gif | Json | Blurhash,  // 0x2FE
 };
 
 inline constexpr Output operator&(Output x, Output y) {
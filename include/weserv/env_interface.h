@@ -1,9 +1,63 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace weserv::api {
 
+/**
+ * The time spent within a single stage of the image pipeline.
+ */
+struct StageTiming {
+    /**
+     * Name of the stage, e.g. `load` or `save`.
+     */
+    std::string name;
+
+    /**
+     * Wall-clock time, in microseconds.
+     */
+    int64_t wall_time;
+
+    /**
+     * CPU time of the threads that worked on this stage, in microseconds.
+     */
+    int64_t cpu_time;
+};
+
+/**
+ * The statistics of a processed image.
+ */
+struct ProcessingStats {
+    /**
+     * Type of the source image, e.g. `jpeg` or `png`.
+     */
+    std::string input_type;
+
+    /**
+     * Type of the processed image, e.g. `webp` or `json`.
+     */
+    std::string output_type;
+
+    /**
+     * Wall-clock time spent on processing the image, in microseconds.
+     */
+    int64_t wall_time;
+
+    /**
+     * The highest number of bytes allocated by libvips so far, for the whole
+     * process.
+     */
+    int64_t memory_highwater;
+
+    /**
+     * The maximum number of libvips worker threads the image was allowed to
+     * use. libvips may use fewer, e.g. for an image of only a few tiles.
+     */
+    int concurrency;
+};
+
 /**
  * An interface for the API to access its environment.
  */
@@ -46,6 +100,22 @@ class ApiEnvInterface {
     }
 
     virtual void log(LogLevel level, const char *message) = 0;
+
+    /**
+     * Receives the per-stage timings of a processed image, if enabled within
+     * the configuration. This is invoked from within `ApiManager::process`,
+     * on the calling thread, just before it returns.
+     * @param stages The timings of each stage, in order.
+     */
+    virtual void timings(const std::vector<StageTiming> &stages) {}
+
+    /**
+     * Receives the statistics of each image that was processed successfully.
+     * This is invoked from within `ApiManager::process` (once for each
+     * variant of a batch), on the calling thread.
+     * @param stats The statistics of the processed image.
+     */
+    virtual void processed(const ProcessingStats &stats) {}
 };
 
 }  // namespace weserv::api
@@ -26,6 +26,18 @@ class SourceInterface {
      * @return Offset of the pointer or -1 on error.
      */
     virtual int64_t seek(int64_t offset, int whence) = 0;
+
+    /**
+     * Get the entire source if it's available within a single contiguous
+     * memory area, which allows it to be loaded without copying. The area
+     * must remain valid until processing has finished.
+     * @param length Output, the length of the memory area.
+     * @return Pointer to the memory area or nullptr if not available, in
+     *         which case the source is read().
+     */
+    virtual const void *memory(size_t *length) {
+        return nullptr;
+    }
 };
 
 }  // namespace weserv::api::io
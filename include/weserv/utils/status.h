@@ -27,6 +27,7 @@ class Status final {
         UnsupportedSaver = 5,
         LibvipsError = 6,
         Unknown = 7,
+        Overloaded = 8,
     };
 
     /**
@@ -2,6 +2,7 @@
 
 #include "exceptions/invalid.h"
 #include "exceptions/large.h"
+#include "exceptions/overloaded.h"
 #include "exceptions/unreadable.h"
 #include "exceptions/unsupported.h"
 
@@ -19,6 +20,7 @@
 #include "processors/mask.h"
 #include "processors/modulate.h"
 #include "processors/orientation.h"
+#include "processors/point.h"
 #include "processors/rotation.h"
 #include "processors/sharpen.h"
 #include "processors/stream.h"
@@ -26,17 +28,352 @@
 #include "processors/tint.h"
 #include "processors/trim.h"
 
+#include "utils/timer.h"
+
+#include <algorithm>
+#include <chrono>
 #include <exception>
+#include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <vips/vips8>
 
 namespace weserv::api {
 
+using enums::ImageType;
+using enums::Output;
 using io::Source;
 using io::Target;
 using utils::Status;
 using vips::VError;
+using vips::VImage;
+
+namespace {
+
+/**
+ * Reserves the estimated cost of an image from the processing budget, for as
+ * long as it's in scope.
+ */
+class CostReservation {
+ public:
+    CostReservation(std::atomic<uint64_t> &in_flight, uint64_t budget,
+                    uint64_t cost)
+        : in_flight_(in_flight), cost_(cost) {
+        uint64_t current = in_flight_.load();
+
+        do {
+            // An image is always admitted if nothing else is being processed,
+            // since it would never fit otherwise
+            if (budget > 0 && current > 0 && current + cost > budget) {
+                throw exceptions::OverloadedException(
+                    "Too many images are being processed at the moment. "
+                    "Please try again later.");
+            }
+        } while (!in_flight_.compare_exchange_weak(current, current + cost));
+    }
+
+    ~CostReservation() {
+        in_flight_ -= cost_;
+    }
+
+    CostReservation(const CostReservation &) = delete;
+
+    CostReservation &operator=(const CostReservation &) = delete;
+
+ private:
+    std::atomic<uint64_t> &in_flight_;
+    uint64_t cost_;
+};
+
+/**
+ * A step within the plan of a query, i.e. a single processor or one or more
+ * adjacent point operations that are applied through a single lookup table.
+ */
+struct Step {
+    std::vector<const processors::ImageProcessor *> processors;
+    std::string name;
+    bool point_operations;
+};
+
+/**
+ * Describe the steps of a phase, for debugging purposes.
+ * @param steps The steps.
+ * @return e.g. `thumbnail > brightness+contrast`.
+ */
+std::string describe(const std::vector<Step> &steps) {
+    if (steps.empty()) {
+        return "none";
+    }
+
+    std::string result;
+    for (const auto &step : steps) {
+        if (!result.empty()) {
+            result += " > ";
+        }
+        result += step.name;
+    }
+    return result;
+}
+
+/**
+ * The operations of the image processing phases 2 and 3 of a query.
+ */
+struct Plan {
+    std::vector<Step> resize;
+    std::vector<Step> adjust;
+
+    /**
+     * Describe the plan, for debugging purposes.
+     * @return e.g. `resize: thumbnail > crop, adjust: brightness+contrast`.
+     */
+    std::string to_string() const {
+        return "resize: " + describe(resize) + ", adjust: " + describe(adjust);
+    }
+};
+
+/**
+ * The image processors of a single query.
+ */
+class Pipeline {
+ public:
+    Pipeline(std::shared_ptr<parsers::Query> query_holder, const Config &config)
+        : query(std::move(query_holder)), stream(query, config),
+          trim(query, config), thumbnail(query, config),
+          orientation(query, config), alignment(query, config),
+          crop(query, config), embed(query, config), rotation(query, config),
+          brightness(query, config), modulate(query, config),
+          contrast(query, config), gamma(query, config),
+          sharpen(query, config), filter(query, config), blur(query, config),
+          tint(query, config), background(query, config),
+          mask(query, config), max_concurrency_(config.vips_concurrency) {}
+
+    /**
+     * Use any shrink-on-load features available in the file import library.
+     * @note Pre-resize extraction isn't possible after shrink-on-load.
+     * @param image The source image.
+     * @param source Source to read from.
+     * @return An image that may have shrunk.
+     */
+    VImage shrink_on_load(const VImage &image, const Source &source) const {
+        return precrop() ? image : thumbnail.shrink_on_load(image, source);
+    }
+
+    /**
+     * Whether the image, after shrink-on-load, can be shared with other
+     * queries. Trimming and gamma correction need the image as-is.
+     * @note Must be called before the image is trimmed.
+     */
+    bool shares_load() const {
+        return !precrop() && query->get<int>("trim", 0) == 0 &&
+               query->get<float>("gam", 0.0F) == 0.0F;
+    }
+
+    /**
+     * Plan the image processing phases 2 and 3. Processors that would return
+     * the image as is are left out and adjacent point operations (e.g.
+     * brightness, contrast and gamma) are fused into a single lookup table.
+     * Colour adjustments are always planned after the image is resized, so
+     * that they only apply to the pixels that remain.
+     * @note Must be called after the image is loaded.
+     * @return The plan of this query.
+     */
+    Plan plan() const {
+        Plan plan;
+
+        if (precrop()) {
+            add_step(&plan.resize, "orientation", orientation);
+            add_step(&plan.resize, "crop", crop);
+            add_step(&plan.resize, "thumbnail", thumbnail);
+            add_step(&plan.resize, "alignment", alignment);
+        } else {
+            add_step(&plan.resize, "thumbnail", thumbnail);
+            add_step(&plan.resize, "orientation", orientation);
+            add_step(&plan.resize, "alignment", alignment);
+            add_step(&plan.resize, "crop", crop);
+        }
+
+        add_step(&plan.adjust, "embed", embed);
+        add_step(&plan.adjust, "rotation", rotation);
+        add_step(&plan.adjust, "brightness", brightness);
+        add_step(&plan.adjust, "modulate", modulate);
+        add_step(&plan.adjust, "contrast", contrast);
+        add_step(&plan.adjust, "gamma", gamma);
+        add_step(&plan.adjust, "sharpen", sharpen);
+        add_step(&plan.adjust, "filter", filter);
+        add_step(&plan.adjust, "blur", blur);
+        add_step(&plan.adjust, "tint", tint);
+        add_step(&plan.adjust, "background", background);
+        add_step(&plan.adjust, "mask", mask);
+
+        return plan;
+    }
+
+    /**
+     * Run the steps of a plan.
+     * @param image The source image.
+     * @param steps The steps of a phase, see plan().
+     * @return The processed image.
+     */
+    static VImage run(const VImage &image, const std::vector<Step> &steps) {
+        auto output_image = image;
+        for (const auto &step : steps) {
+            output_image =
+                step.point_operations
+                    ? processors::apply_point_operations(output_image,
+                                                         step.processors)
+                    : step.processors[0]->process(output_image);
+        }
+        return output_image;
+    }
+
+    /**
+     * The maximum number of libvips worker threads to use for an image,
+     * scaled with its dimensions, see Config::vips_concurrency.
+     * @param image The image that is about to be saved.
+     * @return The number of threads.
+     */
+    int concurrency(const VImage &image) const {
+#if VIPS_VERSION_AT_LEAST(8, 13, 0)
+        if (max_concurrency_ <= 0) {
+            return vips_concurrency_get();
+        }
+
+        uint64_t pixels = static_cast<uint64_t>(image.width()) * image.height();
+        uint64_t threads = 1 + pixels / PIXELS_PER_THREAD;
+
+        return static_cast<int>(
+            std::min(threads, static_cast<uint64_t>(max_concurrency_)));
+#else
+        // The number of threads can't be limited per image, see
+        // limit_concurrency
+        (void)image;
+
+        return vips_concurrency_get();
+#endif
+    }
+
+    /**
+     * Hint the number of worker threads to libvips, if limited. Requires
+     * libvips >= 8.13, which reads the hint from the image.
+     * @param image The image that is about to be saved.
+     * @param concurrency The number of threads, see concurrency().
+     * @return The image to save.
+     */
+    VImage limit_concurrency(const VImage &image, int concurrency) const {
+#if VIPS_VERSION_AT_LEAST(8, 13, 0)
+        if (max_concurrency_ <= 0) {
+            return image;
+        }
+
+        // The thread pool of the saver reads this from the image. Copy to
+        // avoid modifying the metadata of an image shared by other variants
+        auto output_image = image.copy();
+        output_image.set(VIPS_META_CONCURRENCY, concurrency);
+        return output_image;
+#else
+        // libvips < 8.13 only has the process-wide vips_concurrency_set(),
+        // which would race between images processed concurrently. Leave it
+        // up to libvips instead.
+        (void)concurrency;
+
+        return image;
+#endif
+    }
+
+    /**
+     * The statistics of the processed image.
+     * @note Must be called after the image is saved, since saving resolves
+     *       the output type.
+     * @param start When the processing of the image started.
+     * @param concurrency The number of libvips worker threads used.
+     * @return The statistics of this query.
+     */
+    ProcessingStats stats(const std::chrono::steady_clock::time_point &start,
+                          int concurrency) const {
+        auto wall_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+        return {utils::image_type_id(
+                    query->get<ImageType>("type", ImageType::Unknown)),
+                utils::determine_image_extension(
+                    query->get<Output>("output", Output::Origin))
+                    .substr(1),
+                static_cast<int64_t>(wall_time),
+                static_cast<int64_t>(vips_tracked_get_mem_highwater()),
+                concurrency};
+    }
+
+    const std::shared_ptr<parsers::Query> query;
+
+    const processors::Stream stream;
+    const processors::Trim trim;
+    const processors::Thumbnail thumbnail;
+    const processors::Orientation orientation;
+    const processors::Alignment alignment;
+    const processors::Crop crop;
+    const processors::Embed embed;
+    const processors::Rotation rotation;
+    const processors::Brightness brightness;
+    const processors::Modulate modulate;
+    const processors::Contrast contrast;
+    const processors::Gamma gamma;
+    const processors::Sharpen sharpen;
+    const processors::Filter filter;
+    const processors::Blur blur;
+    const processors::Tint tint;
+    const processors::Background background;
+    const processors::Mask mask;
+
+ private:
+    /**
+     * The number of output pixels that justify an additional libvips worker
+     * thread.
+     */
+    static constexpr uint64_t PIXELS_PER_THREAD = 1000000;
+
+    /**
+     * See Config::vips_concurrency.
+     */
+    const intptr_t max_concurrency_;
+
+    static void add_step(std::vector<Step> *steps, const char *name,
+                         const processors::ImageProcessor &processor) {
+        if (processor.is_noop()) {
+            return;
+        }
+
+        bool point_operation = processor.is_point_operation();
+
+        // Fuse adjacent point operations. Operations that only depend on the
+        // luminance can't follow those that don't, since their lookup table
+        // is indexed by the greyscale image.
+        if (point_operation && !steps->empty() &&
+            steps->back().point_operations &&
+            (!processor.is_luminance_operation() ||
+             steps->back().processors[0]->is_luminance_operation())) {
+            steps->back().processors.push_back(&processor);
+            steps->back().name += '+';
+            steps->back().name += name;
+            return;
+        }
+
+        steps->push_back({{&processor}, name, point_operation});
+    }
+
+    /**
+     * Note: the disadvantage of pre-resize extraction behaviour is that none
+     * of the very fast shrink-on-load tricks are possible. This can make
+     * thumbnailing of large images extremely slow. So, turn it off by default.
+     */
+    bool precrop() const {
+        return query->get<bool>("precrop", false);
+    }
+};
+
+}  // namespace
 
 std::shared_ptr<ApiManager>
 ApiManagerFactory::create_api_manager(std::unique_ptr<ApiEnvInterface> env) {
@@ -120,6 +457,9 @@ Status ApiManagerImpl::exception_handler(const std::string &query) {
     } catch (const exceptions::UnsupportedSaverException &e) {
         return {Status::Code::UnsupportedSaver, e.what(),
                 Status::ErrorCause::Application};
+    } catch (const exceptions::OverloadedException &e) {
+        return {Status::Code::Overloaded, e.what(),
+                Status::ErrorCause::Application};
     } catch (const VError &e) {
         std::string error_str = e.what();
 
@@ -150,63 +490,194 @@ utils::Status ApiManagerImpl::process(const std::string &query,
                                       const Source &source,
                                       const Target &target,
                                       const Config &config) {
-    auto query_holder = std::make_shared<parsers::Query>(query);
-
-    // Note: the disadvantage of pre-resize extraction behaviour is that none
-    // of the very fast shrink-on-load tricks are possible. This can make
-    // thumbnailing of large images extremely slow. So, turn it off by default.
-    auto precrop = query_holder->get<bool>("precrop", false);
-
-    // Stream processor
-    auto stream = processors::Stream(query_holder, config);
-
-    // Image processors
-    auto trim = processors::Trim(query_holder, config);
-    auto thumbnail = processors::Thumbnail(query_holder, config);
-    auto orientation = processors::Orientation(query_holder, config);
-    auto alignment = processors::Alignment(query_holder, config);
-    auto crop = processors::Crop(query_holder, config);
-    auto embed = processors::Embed(query_holder, config);
-    auto rotation = processors::Rotation(query_holder, config);
-    auto brightness = processors::Brightness(query_holder, config);
-    auto modulate = processors::Modulate(query_holder, config);
-    auto contrast = processors::Contrast(query_holder, config);
-    auto gamma = processors::Gamma(query_holder, config);
-    auto sharpen = processors::Sharpen(query_holder, config);
-    auto filter = processors::Filter(query_holder, config);
-    auto blur = processors::Blur(query_holder, config);
-    auto tint = processors::Tint(query_holder, config);
-    auto background = processors::Background(query_holder, config);
-    auto mask = processors::Mask(query_holder, config);
+    auto start = std::chrono::steady_clock::now();
+
+    Pipeline pipeline(std::make_shared<parsers::Query>(query), config);
+
+    // Per-stage timings, if enabled. libvips evaluates the pipeline lazily,
+    // so each stage is evaluated into memory in that case, except for
+    // metadata output which never evaluates the image
+    utils::StageTimer timer(config.timings == 1);
+    bool metadata_only = pipeline.query->get<Output>(
+                             "output", Output::Origin) == Output::Json;
+    auto evaluate = [&](const VImage &in) {
+        return metadata_only ? in : timer.evaluate(in, config.process_timeout);
+    };
 
     // Create image from a source
-    auto image = stream.new_from_source(source);
+    timer.next("load");
+    auto image = pipeline.stream.new_from_source(source);
+
+    // Admit the image if its estimated cost fits within the remaining
+    // processing budget
+    CostReservation reservation(in_flight_cost_, config.cost_budget,
+                                pipeline.stream.estimate_cost(image));
+
+    // Trimming needs the decoded image, shrink-on-load is skipped for it
+    if (pipeline.query->get<int>("trim", 0) != 0) {
+        image = evaluate(image);
+    }
 
     // Image processing phase 1 (make sure trimming is done first)
-    image = image | trim;
+    timer.next("trim");
+    image = image | pipeline.trim;
+
+    // Decode the image, using shrink-on-load if possible
+    timer.next("decode");
+    image = pipeline.shrink_on_load(image, source);
+    image = evaluate(image);
 
     // Image processing phase 2 (size, crop, etc.)
-    if (precrop) {
-        image = image | orientation | crop | thumbnail | alignment;
-    } else {
-        // The very fast shrink-on-load tricks are possible
-        image = thumbnail.shrink_on_load(image, source);
-        image = image | thumbnail | orientation | alignment | crop;
-    }
+    timer.next("resize");
+    auto plan = pipeline.plan();
+    env_->log_debug("Plan: " + plan.to_string() + "\nQuery: " + query);
+
+    image = Pipeline::run(image, plan.resize);
+    image = evaluate(image);
 
     // Image processing phase 3 (adjustments, effects, etc.)
-    image = image | embed | rotation | brightness | modulate | contrast |
-            gamma | sharpen | filter | blur | tint | background | mask;
+    timer.next("adjust");
+    image = Pipeline::run(image, plan.adjust);
+    image = evaluate(image);
 
     // Write the image to a target
-    stream.write_to_target(image, target);
+    timer.next("save");
+    int concurrency = pipeline.concurrency(image);
+    image = pipeline.limit_concurrency(image, concurrency);
+    pipeline.stream.write_to_target(image, target);
+    timer.stop();
 
     // Clean up libvips' per-request data and threads
     clean_up();
 
+    if (config.timings == 1) {
+        env_->timings(timer.stages());
+    }
+
+    env_->processed(pipeline.stats(start, concurrency));
+
     return Status::OK;
 }
 
+std::vector<utils::Status>
+ApiManagerImpl::process_batch(const std::vector<std::string> &queries,
+                              const Source &source,
+                              const std::vector<Target> &targets,
+                              const Config &config) {
+    size_t n_variants = std::min(queries.size(), targets.size());
+
+    std::vector<Status> statuses(n_variants, Status::OK);
+    std::vector<std::unique_ptr<Pipeline>> pipelines(n_variants);
+    std::vector<VImage> images(n_variants);
+
+    // Only the header is read at this point, the pages and the shrink-on-load
+    // of each variant are resolved against it
+    for (size_t i = 0; i < n_variants; ++i) {
+        try {
+            pipelines[i] = std::make_unique<Pipeline>(
+                std::make_shared<parsers::Query>(queries[i]), config);
+            images[i] = pipelines[i]->stream.new_from_source(source);
+        } catch (...) {
+            statuses[i] = exception_handler(queries[i]);
+        }
+    }
+
+    // Variants that load the same pages share a single decode, at the size
+    // needed by the largest of them. The others shrink it further
+    std::vector<bool> shared(n_variants, false);
+    VImage shared_image;
+    size_t n_shared = 0;
+    int shared_pages = 0;
+    int shared_page = 0;
+
+    for (size_t i = 0; i < n_variants; ++i) {
+        if (!statuses[i].ok() || !pipelines[i]->shares_load()) {
+            continue;
+        }
+
+        int pages = pipelines[i]->query->get<int>("n", 1);
+        int page = pipelines[i]->query->get<int>("page", 0);
+        if (n_shared > 0 && (pages != shared_pages || page != shared_page)) {
+            continue;
+        }
+
+        try {
+            // Trimming isn't required, but still resolves the query
+            auto image = pipelines[i]->shrink_on_load(
+                images[i] | pipelines[i]->trim, source);
+            if (n_shared == 0 || image.width() > shared_image.width()) {
+                shared_image = image;
+            }
+        } catch (...) {
+            statuses[i] = exception_handler(queries[i]);
+            continue;
+        }
+
+        shared[i] = true;
+        shared_pages = pages;
+        shared_page = page;
+        ++n_shared;
+    }
+
+    if (n_shared > 1) {
+        try {
+            // Decode once, all variants are read from memory
+            shared_image = shared_image.copy_memory();
+        } catch (...) {
+            // Let the variants decode on their own instead
+            clean_up();
+            n_shared = 0;
+        }
+    }
+
+    for (size_t i = 0; i < n_variants; ++i) {
+        if (!statuses[i].ok()) {
+            continue;
+        }
+
+        try {
+            auto start = std::chrono::steady_clock::now();
+
+            const auto &pipeline = *pipelines[i];
+
+            CostReservation reservation(
+                in_flight_cost_, config.cost_budget,
+                pipeline.stream.estimate_cost(images[i]));
+
+            VImage image;
+            if (shared[i] && n_shared > 1) {
+                image = shared_image;
+            } else if (shared[i]) {
+                // Already trimmed, see above
+                image = pipeline.shrink_on_load(images[i], source);
+            } else {
+                image = pipeline.shrink_on_load(images[i] | pipeline.trim,
+                                                source);
+            }
+
+            auto plan = pipeline.plan();
+            env_->log_debug("Plan: " + plan.to_string() +
+                            "\nQuery: " + queries[i]);
+
+            image = Pipeline::run(Pipeline::run(image, plan.resize),
+                                  plan.adjust);
+
+            int concurrency = pipeline.concurrency(image);
+            pipeline.stream.write_to_target(
+                pipeline.limit_concurrency(image, concurrency), targets[i]);
+
+            env_->processed(pipeline.stats(start, concurrency));
+        } catch (...) {
+            statuses[i] = exception_handler(queries[i]);
+        }
+    }
+
+    // Clean up libvips' per-request data and threads
+    clean_up();
+
+    return statuses;
+}
+
 utils::Status
 ApiManagerImpl::process(const std::string &query,
                         std::unique_ptr<io::SourceInterface> source,
@@ -286,4 +757,71 @@ utils::Status ApiManagerImpl::process_buffer(const std::string &query,
     }
 }
 
+std::vector<utils::Status> ApiManagerImpl::process_batch(
+    const std::vector<std::string> &queries,
+    std::unique_ptr<io::SourceInterface> source,
+    std::vector<std::unique_ptr<io::TargetInterface>> targets,
+    const Config &config) {
+    std::vector<Target> batch_targets;
+    batch_targets.reserve(targets.size());
+    for (auto &target : targets) {
+        batch_targets.push_back(Target::new_to_pointer(std::move(target)));
+    }
+
+    try {
+        return process_batch(queries,
+                             Source::new_from_pointer(std::move(source)),
+                             batch_targets, config);
+    } catch (...) {
+        // LCOV_EXCL_START
+        Status status = exception_handler(queries.empty() ? "" : queries[0]);
+        return std::vector<Status>(queries.size(), status);
+        // LCOV_EXCL_STOP
+    }
+}
+
+std::vector<utils::Status>
+ApiManagerImpl::process_buffer(const std::vector<std::string> &queries,
+                               const std::string &in_buf,
+                               std::vector<std::string> *out_bufs,
+                               const Config &config) {
+    out_bufs->resize(queries.size());
+
+    std::vector<Target> targets;
+    targets.reserve(queries.size());
+    for (auto &out_buf : *out_bufs) {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+        targets.push_back(Target::new_to_memory());
+#else
+        targets.push_back(Target::new_to_memory(&out_buf));
+#endif
+    }
+
+    try {
+        std::vector<Status> statuses = process_batch(
+            queries, Source::new_from_buffer(in_buf), targets, config);
+
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+        for (size_t i = 0; i < statuses.size(); ++i) {
+            if (statuses[i].ok()) {
+                size_t length;
+                const void *out =
+                    vips_blob_get(targets[i].get_target()->blob, &length);
+                (*out_bufs)[i].assign(static_cast<const char *>(out), length);
+            }
+        }
+#endif
+        return statuses;
+    } catch (...) {
+        // LCOV_EXCL_START
+        Status status = exception_handler(queries.empty() ? "" : queries[0]);
+        return std::vector<Status>(queries.size(), status);
+        // LCOV_EXCL_STOP
+    }
+}
+
+std::string ApiManagerImpl::canonical_query(const std::string &query) {
+    return parsers::Query(query).canonical();
+}
+
 }  // namespace weserv::api
@@ -3,6 +3,10 @@
 #include "io/source.h"
 #include "io/target.h"
 
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
 #include <weserv/api_manager.h>
 
 namespace weserv::api {
@@ -36,6 +40,20 @@ class ApiManagerImpl : public ApiManager {
                                  std::string *out_buf,
                                  const Config &config) override;
 
+    std::vector<utils::Status>
+    process_batch(const std::vector<std::string> &queries,
+                  std::unique_ptr<io::SourceInterface> source,
+                  std::vector<std::unique_ptr<io::TargetInterface>> targets,
+                  const Config &config) override;
+
+    std::vector<utils::Status>
+    process_buffer(const std::vector<std::string> &queries,
+                   const std::string &in_buf,
+                   std::vector<std::string> *out_bufs,
+                   const Config &config) override;
+
+    std::string canonical_query(const std::string &query) override;
+
  private:
     /**
      * Clean up libvips' per-request data and threads.
@@ -60,6 +78,20 @@ class ApiManagerImpl : public ApiManager {
     utils::Status process(const std::string &query, const io::Source &source,
                           const io::Target &target, const Config &config);
 
+    /**
+     * Internal batch processor.
+     * @param queries Query strings, one for each variant.
+     * @param source Source to read from.
+     * @param targets Targets to write to, one for each variant.
+     * @param config API configuration.
+     * @return A Status object for each variant.
+     */
+    std::vector<utils::Status>
+    process_batch(const std::vector<std::string> &queries,
+                  const io::Source &source,
+                  const std::vector<io::Target> &targets,
+                  const Config &config);
+
     /**
      * Global environment across multiple services
      */
@@ -70,6 +102,11 @@ class ApiManagerImpl : public ApiManager {
      * g_log_set_handler().
      */
     unsigned int handler_id_ = 0;
+
+    /**
+     * The estimated cost of the images that are currently being processed.
+     */
+    std::atomic<uint64_t> in_flight_cost_{0};
 };
 
 }  // namespace weserv::api
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdexcept>
+
+namespace weserv::api::exceptions {
+
+/**
+ * Exception when the processing budget is exhausted.
+ */
+class OverloadedException : public std::runtime_error {
+ public:
+    explicit OverloadedException(const std::string &error)
+        : std::runtime_error(error) {}
+};
+
+}  // namespace weserv::api::exceptions
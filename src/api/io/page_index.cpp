@@ -0,0 +1,131 @@
+#include "page_index.h"
+
+#include "../utils/tiff.h"
+#include "source.h"
+
+#include <limits>
+
+namespace weserv::api::io {
+
+using vips::VImage;
+
+PageIndex::PageIndex(std::string loader, bool fail_on_error)
+    : loader_(std::move(loader)), fail_on_error_(fail_on_error),
+      uniform_(loader_.rfind("gifload", 0) == 0 ||
+               loader_.rfind("webpload", 0) == 0),
+      tiff_(loader_.rfind("tiffload", 0) == 0) {}
+
+int PageIndex::n_pages(const Source &source) {
+    if (n_pages_ == 0) {
+        // The number of pages is recorded while reading the first page
+        geometry(source, 0);
+    }
+
+    return n_pages_;
+}
+
+std::pair<int, int> PageIndex::geometry(const Source &source, int page) {
+    if (uniform_ && page > 0) {
+        return geometry(source, 0);
+    }
+
+    // Fall back to reading the page headers if the directories of a TIFF
+    // image can't be read
+    if (tiff_ && n_pages_ == 0) {
+        tiff_ = index_tiff(source);
+    }
+
+    if (static_cast<size_t>(page) >= pages_.size()) {
+        pages_.resize(page + 1, {0, 0});
+    }
+
+    if (pages_[page].first == 0) {
+        auto image =
+            source.load(loader_, VIPS_ACCESS_SEQUENTIAL, fail_on_error_,
+                        VImage::option()->set("page", page));
+
+        if (n_pages_ == 0) {
+            n_pages_ = image.get_typeof(VIPS_META_N_PAGES) != 0
+                           ? image.get_int(VIPS_META_N_PAGES)
+                           : 1;
+        }
+
+        pages_[page] = {image.width(), image.height()};
+    }
+
+    return pages_[page];
+}
+
+const std::vector<std::pair<int, int>> &
+PageIndex::subifds(const Source &source, int page) {
+    static const std::vector<std::pair<int, int>> none;
+
+    // The SubIFDs are recorded while indexing the directories
+    if (tiff_ && n_pages_ == 0) {
+        tiff_ = index_tiff(source);
+    }
+
+    return tiff_ && static_cast<size_t>(page) < subifds_.size()
+               ? subifds_[page]
+               : none;
+}
+
+bool PageIndex::index_tiff(const Source &source) {
+    std::vector<utils::TiffDirectory> directories;
+
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    // Seek to and read only the directories themselves, rather than mapping
+    // the whole source into memory
+    VipsSource *vips_source = source.get_source();
+    bool indexed = utils::read_tiff_directories(
+        [vips_source](uint64_t offset, uint8_t *data, size_t size) {
+            if (offset > static_cast<uint64_t>(
+                             std::numeric_limits<gint64>::max()) ||
+                vips_source_seek(vips_source, static_cast<gint64>(offset),
+                                 SEEK_SET) == -1) {
+                return false;
+            }
+
+            while (size > 0) {
+                gint64 bytes_read = vips_source_read(vips_source, data, size);
+                if (bytes_read <= 0) {
+                    return false;
+                }
+
+                data += bytes_read;
+                size -= static_cast<size_t>(bytes_read);
+            }
+
+            return true;
+        },
+        &directories);
+
+    // Leave the source at its start for the loader, any error while seeking
+    // or reading just means that the page headers are read instead
+    (void)vips_source_rewind(vips_source);
+    vips_error_clear();
+#else
+    bool indexed = utils::read_tiff_directories(
+        reinterpret_cast<const uint8_t *>(source.buffer().data()),
+        source.buffer().size(), &directories);
+#endif
+
+    if (!indexed) {
+        return false;
+    }
+
+    n_pages_ = static_cast<int>(directories.size());
+    pages_.clear();
+    subifds_.clear();
+    pages_.reserve(directories.size());
+    subifds_.reserve(directories.size());
+
+    for (auto &directory : directories) {
+        pages_.emplace_back(directory.width, directory.height);
+        subifds_.push_back(std::move(directory.subifds));
+    }
+
+    return true;
+}
+
+}  // namespace weserv::api::io
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <vips/vips8>
+
+namespace weserv::api::io {
+
+class Source;
+
+/**
+ * An index of the page geometries of a multi-page image. The header of each
+ * page is read at most once, on first use. Animated images (GIF and WebP)
+ * have the same geometry for each page, so only the header of the first page
+ * is read for them. The directories of TIFF images are read in a single pass,
+ * without going through libtiff.
+ */
+class PageIndex {
+ public:
+    PageIndex(std::string loader, bool fail_on_error);
+
+    /**
+     * @return the image loader used to read the page headers.
+     */
+    const std::string &loader() const {
+        return loader_;
+    }
+
+    /**
+     * Get the number of pages within the image.
+     * @param source Source to read from.
+     * @return The number of pages.
+     */
+    int n_pages(const Source &source);
+
+    /**
+     * Get the dimensions of a page.
+     * @param source Source to read from.
+     * @param page The page, numbered from zero.
+     * @return The (width, height) of the page as pair.
+     */
+    std::pair<int, int> geometry(const Source &source, int page);
+
+    /**
+     * Get the dimensions of the SubIFDs of a page, e.g. the levels of a
+     * SubIFD-based TIFF pyramid.
+     * @param source Source to read from.
+     * @param page The page, numbered from zero.
+     * @return The (width, height) of each SubIFD, empty if the page has none
+     *         or if this isn't a TIFF image.
+     */
+    const std::vector<std::pair<int, int>> &subifds(const Source &source,
+                                                    int page);
+
+ private:
+    std::string loader_;
+    bool fail_on_error_;
+
+    /**
+     * Whether all pages share the geometry of the first page.
+     */
+    bool uniform_;
+
+    /**
+     * Whether this is a TIFF image, whose directories can be read directly.
+     */
+    bool tiff_;
+
+    /**
+     * The number of pages, or 0 if not yet known.
+     */
+    int n_pages_ = 0;
+
+    /**
+     * The (width, height) of each page, or (0, 0) if not yet read.
+     */
+    std::vector<std::pair<int, int>> pages_;
+
+    /**
+     * The (width, height) of the SubIFDs of each page, TIFF only.
+     */
+    std::vector<std::vector<std::pair<int, int>>> subifds_;
+
+    /**
+     * Read the dimensions of all directories of a TIFF image in one go.
+     * @param source Source to read from.
+     * @return false if the directories could not be read, in which case the
+     *         page headers are read through libvips instead.
+     */
+    bool index_tiff(const Source &source);
+};
+
+}  // namespace weserv::api::io
@@ -55,6 +55,18 @@ static void weserv_source_init(WeservSource *source) {}
 /* private API */
 
 Source Source::new_from_pointer(std::unique_ptr<io::SourceInterface> source) {
+    size_t length;
+    const void *memory = source->memory(&length);
+    if (memory != nullptr) {
+        VipsSource *memory_source = vips_source_new_from_memory(memory, length);
+
+        if (memory_source == nullptr) {
+            throw vips::VError();
+        }
+
+        return Source(memory_source);
+    }
+
     WeservSource *weserv_source = WESERV_SOURCE(
         g_object_new(WESERV_TYPE_SOURCE, "source", source.get(), nullptr));
 
@@ -90,6 +102,14 @@ Source Source::new_from_buffer(const std::string &buffer) {
 #define SOURCE_BUFFER_SIZE 4096  // = (size_t) ngx_pagesize;
 
 Source Source::new_from_pointer(std::unique_ptr<io::SourceInterface> source) {
+    // Reference the source directly if it's held within a single memory area
+    size_t length;
+    const void *memory = source->memory(&length);
+    if (memory != nullptr) {
+        return Source(
+            std::string_view(reinterpret_cast<const char *>(memory), length));
+    }
+
     char temp_buffer[SOURCE_BUFFER_SIZE];
     std::string buffer;
     int64_t bytes_read;
@@ -117,8 +137,48 @@ Source Source::new_from_file(const std::string &filename) {
 }
 
 Source Source::new_from_buffer(const std::string &buffer) {
-    return Source(buffer);
+    return Source(std::string_view(buffer));
+}
+#endif
+
+PageIndex &Source::page_index(const std::string &loader,
+                              bool fail_on_error) const {
+    if (page_index_ == nullptr || page_index_->loader() != loader) {
+        page_index_ = std::make_shared<PageIndex>(loader, fail_on_error);
+    }
+
+    return *page_index_;
 }
+
+vips::VImage Source::load(const std::string &loader, VipsAccess access,
+                          bool fail_on_error, vips::VOption *options) const {
+    vips::VImage out_image;
+
+    if (options == nullptr) {
+        options = vips::VImage::option();
+    }
+
+    options = options->set("access", access)->set("fail", fail_on_error);
+
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    try {
+        vips::VImage::call(loader.c_str(),
+                           options->set("source", *this)
+                               ->set("out", &out_image));
+#else
+    // We don't take a copy of the data or free it
+    auto *blob = vips_blob_new(nullptr, buffer().data(), buffer().size());
+    options = options->set("buffer", blob)->set("out", &out_image);
+    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+    try {
+        vips::VImage::call(loader.c_str(), options);
 #endif
+    } catch (const vips::VError &err) {
+        throw exceptions::UnreadableImageException(err.what());
+    }
+
+    return out_image;
+}
 
 }  // namespace weserv::api::io
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "../utils/utility.h"
+#include "page_index.h"
 
 #include <memory>
 #include <string>
+#include <string_view>
 #include <utility>  // for move
 
 #include <weserv/io/source_interface.h>
@@ -50,6 +52,8 @@ class Source : public vips::VSource {
 class Source {
  public:
     explicit Source(std::string buffer) : buffer_(std::move(buffer)) {}
+
+    explicit Source(std::string_view memory) : memory_(memory) {}
 #endif
 
     /**
@@ -67,23 +71,60 @@ class Source {
     static Source new_from_file(const std::string &filename);
 
     /**
-     * Create a source attached to an area of memory.
-     * @param buffer Memory area to load.
+     * Create a source attached to an area of memory, without copying it.
+     * @param buffer Memory area to load, must outlive this source.
      * @return A new Source class.
      */
     static Source new_from_buffer(const std::string &buffer);
 
+    /**
+     * Get the page index of the multi-page image held by this source, which
+     * is built on first use. A new index is built if a different loader is
+     * given.
+     * @param loader Image loader.
+     * @param fail_on_error Whether to fail on load errors.
+     * @return The page index of this source.
+     */
+    PageIndex &page_index(const std::string &loader, bool fail_on_error) const;
+
+    /**
+     * Load a formatted image from this source.
+     * @note This behaves exactly as `VImage::new_from_source`, but the loader
+     *       can be specified instead of being found automatically.
+     *       It will throw a `UnreadableImageException` if an error occurs
+     *       during loading.
+     * @param loader Image loader.
+     * @param access Access pattern of the load operation.
+     * @param fail_on_error Whether to fail on load errors.
+     * @param options Any other options to pass on to the load operation.
+     * @return A new `VImage`.
+     */
+    vips::VImage load(const std::string &loader, VipsAccess access,
+                      bool fail_on_error,
+                      vips::VOption *options = nullptr) const;
+
 #ifndef WESERV_ENABLE_TRUE_STREAMING
     /**
-     * @return the buffer held by this source.
+     * @return the buffer held (or the memory area referenced) by this source.
      */
-    const std::string &buffer() const {
-        return buffer_;
+    std::string_view buffer() const {
+        return memory_.data() != nullptr ? memory_ : std::string_view(buffer_);
     }
 
  private:
     std::string buffer_;
+
+    /**
+     * Memory area that is not owned by this source.
+     */
+    std::string_view memory_;
 #endif
+
+ private:
+    /**
+     * Page geometries of this source, indexed on first use.
+     */
+    mutable std::shared_ptr<PageIndex> page_index_;
 };
 
 }  // namespace weserv::api::io
@@ -50,6 +50,12 @@ class Color {
      */
     std::string to_string() const;
 
+    /**
+     * Color to hexadecimal string.
+     * @return The color in AARRGGBB notation.
+     */
+    std::string to_hex() const;
+
  private:
     int alpha_{0};
     int red_{0};
@@ -3,6 +3,8 @@
 #include "numeric.h"
 
 #include <cmath>
+#include <locale>
+#include <sstream>
 
 namespace weserv::api::parsers {
 
@@ -16,6 +18,17 @@ int Coordinate::to_pixels(int base) const {
     return std::get<int>(value_);
 }
 
+std::string Coordinate::to_string() const {
+    if (const auto *relative_coord = std::get_if<float>(&value_)) {
+        std::ostringstream ss;
+        ss.imbue(std::locale::classic());
+        ss << *relative_coord * 100.0F << '%';
+        return ss.str();
+    }
+
+    return std::to_string(std::get<int>(value_));
+}
+
 template <>
 Coordinate parse(const std::string &value) {
     if (value.empty()) {
@@ -2,6 +2,7 @@
 
 #include "base.h"
 
+#include <string>
 #include <variant>
 
 namespace weserv::api::parsers {
@@ -26,6 +27,12 @@ class Coordinate {
      */
     int to_pixels(int base) const;
 
+    /**
+     * Coordinate to string.
+     * @return The coordinate in pixels, or as a percentage if it's relative.
+     */
+    std::string to_string() const;
+
  private:
     std::variant<int, float> value_{-1};
 };
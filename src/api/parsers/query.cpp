@@ -4,6 +4,11 @@
 #include "enumeration.h"
 #include "numeric.h"
 
+#include <iomanip>
+#include <limits>
+#include <locale>
+#include <sstream>
+
 #include <weserv/enums.h>
 
 namespace weserv::api::parsers {
@@ -22,6 +27,8 @@ const size_t MAX_VECTOR_SIZE = 10000;
 
 // Note: We check crazy numbers within `numeric.h`
 
+// Note: Keys must also be listed within `QUERY_KEYS`, see `query.h`
+
 // clang-format off
 const TypeMap &type_map = {
     {"w",       typeid(Coordinate)},
@@ -65,6 +72,7 @@ const TypeMap &type_map = {
     {"q",       typeid(int)},
     {"l",       typeid(int)},
     {"output",  typeid(Output)},
+    {"accept",  typeid(std::vector<Output>)},
     {"il",      typeid(bool)},
     {"ll",      typeid(bool)},              // TODO(kleisauke): Documentation needed.
     {"af",      typeid(bool)},
@@ -92,6 +100,36 @@ const SynonymMap &synonym_map = {
     {"lossless", "ll"},
 };
 
+// Values that are equivalent to omitting the key. These are left out of the
+// canonical form, e.g. `&fit=inside&w=300` is the same as `&w=300`.
+const DefaultMap &default_map = {
+    {"fit",     static_cast<int>(Canvas::Max)},
+    {"we",      false},
+    {"precrop", false},
+    {"a",       static_cast<int>(Position::Center)},
+    {"fpx",     0.5F},
+    {"fpy",     0.5F},
+    {"mask",    static_cast<int>(MaskType::None)},
+    {"mtrim",   false},
+    {"ro",      0},
+    {"flip",    false},
+    {"flop",    false},
+    {"bri",     0},
+    {"mod",     1.0F},
+    {"sat",     1.0F},
+    {"hue",     0},
+    {"con",     0},
+    {"filt",    static_cast<int>(FilterType::None)},
+    {"output",  static_cast<int>(Output::Origin)},
+    {"il",      false},
+    {"ll",      false},
+    {"af",      false},
+    {"page",    0},
+    {"n",       1},
+    {"loop",    -1},
+    {"fsol",    true},
+};
+
 const NginxKeySet &nginx_keys = {
     "url",
     "default",
@@ -99,6 +137,7 @@ const NginxKeySet &nginx_keys = {
     "filename",
     "encoding",
     "maxage",
+    "srcset",
 };
 // clang-format on
 
@@ -144,23 +183,23 @@ void Query::add_value(const std::string &key, const std::string &value,
     if (type == typeid(bool)) {
         // Only emplace `false` if it's explicitly specified because we
         // interpret empty strings (for e.g. `&we`) as `true`
-        query_map_.emplace(key, value != "false" && value != "0");
+        emplace(key, value != "false" && value != "0");
     } else if (type == typeid(int)) {
         try {
-            query_map_.emplace(key, parse<int>(value));
+            emplace(key, parse<int>(value));
         } catch (...) {
             // -1 by default
-            query_map_.emplace(key, -1);
+            emplace(key, -1);
         }
     } else if (type == typeid(float)) {
         try {
-            query_map_.emplace(key, parse<float>(value));
+            emplace(key, parse<float>(value));
         } catch (...) {
             // -1.0 by default
-            query_map_.emplace(key, -1.0F);
+            emplace(key, -1.0F);
         }
     } else if (type == typeid(Coordinate)) {
-        query_map_.emplace(key, parse<Coordinate>(value));
+        emplace(key, parse<Coordinate>(value));
     } else if (type == typeid(Position)) {
         auto position = parse<Position>(value);
 
@@ -181,62 +220,70 @@ void Query::add_value(const std::string &key, const std::string &value,
                 }
             }
 
-            query_map_.emplace("fpx", focal[0]);
-            query_map_.emplace("fpy", focal[1]);
+            emplace("fpx", focal[0]);
+            emplace("fpy", focal[1]);
         }
 
-        query_map_.emplace(key, static_cast<int>(position));
+        emplace(key, static_cast<int>(position));
     } else if (type == typeid(FilterType)) {
-        query_map_.emplace(key, static_cast<int>(parse<FilterType>(value)));
+        emplace(key, static_cast<int>(parse<FilterType>(value)));
     } else if (type == typeid(MaskType)) {
-        query_map_.emplace(key, static_cast<int>(parse<MaskType>(value)));
+        emplace(key, static_cast<int>(parse<MaskType>(value)));
     } else if (type == typeid(Output)) {
-        query_map_.emplace(key, static_cast<int>(parse<Output>(value)));
+        emplace(key, static_cast<int>(parse<Output>(value)));
     } else if (type == typeid(Canvas)) {
         // Deprecated without enlargement parameters
         if (value == "fit" || value == "squaredown") {
-            query_map_.emplace("we", true);
+            emplace("we", true);
         }
 
-        query_map_.emplace(key, static_cast<int>(parse<Canvas>(value)));
+        emplace(key, static_cast<int>(parse<Canvas>(value)));
     } else if (type == typeid(Color)) {
-        query_map_.emplace(key, parse<Color>(value));
+        emplace(key, parse<Color>(value));
+    } else if (key == "accept") {  // type == typeid(std::vector<Output>)
+        // The formats accepted by the client, combined into a bitmask
+        auto accepted = Output::Origin;
+        for (auto output : tokenize<Output>(value, ",", 8)) {
+            accepted |= output;
+        }
+        emplace(key, static_cast<int>(accepted));
     } else if (key == "delay") {  // type == typeid(std::vector<int>)
         auto delays = tokenize<int>(value, ",", MAX_VECTOR_SIZE);
-        query_map_.emplace(key, delays);
+        emplace(key, delays);
     } else if (key == "sharp") {  // type == typeid(std::vector<float>)
         auto params = tokenize<float>(value, ",", 3);
 
         if (params.size() == 1) {
             // Assume sigma if only 1 value is given (e.g. &sharp=5)
-            query_map_.emplace(key, params[0]);
+            emplace(key, params[0]);
         } else {
             // Flat, jagged, sigma
-            std::vector<std::string> keys = {"sharpf", "sharpj", "sharp"};
+            std::array<std::string_view, 3> keys = {"sharpf", "sharpj",
+                                                    "sharp"};
 
             for (size_t i = 0; i != params.size(); ++i) {
-                query_map_.emplace(keys[i], params[i]);
+                emplace(keys[i], params[i]);
             }
         }
     } else if (key == "mod") {  // type == typeid(std::vector<float>)
         auto params = tokenize<float>(value, ",", 3);
 
         // Brightness, saturation, hue
-        std::vector<std::string> keys = {/*"bri"*/key, "sat", "hue"};
+        std::array<std::string_view, 3> keys = {/*"bri"*/key, "sat", "hue"};
 
         for (size_t i = 0; i != params.size(); ++i) {
             /*keys[i] == "hue"*/ i == 2  // Hue needs to be cast to an integer
-                ? query_map_.emplace(keys[i], static_cast<int>(params[i]))
-                : query_map_.emplace(keys[i], params[i]);
+                ? emplace(keys[i], static_cast<int>(params[i]))
+                : emplace(keys[i], params[i]);
         }
     } else if (key == "crop") {  // Deprecated
         auto coordinates = tokenize<int>(value, ",", 4);
 
         if (coordinates.size() == 4) {
-            query_map_.emplace("cw", Coordinate{coordinates[0]});
-            query_map_.emplace("ch", Coordinate{coordinates[1]});
-            query_map_.emplace("cx", Coordinate{coordinates[2]});
-            query_map_.emplace("cy", Coordinate{coordinates[3]});
+            emplace("cw", Coordinate{coordinates[0]});
+            emplace("ch", Coordinate{coordinates[1]});
+            emplace("cx", Coordinate{coordinates[2]});
+            emplace("cy", Coordinate{coordinates[3]});
         }
     }
 }
@@ -291,4 +338,92 @@ Query::Query(const std::string &value) {
     }
 }
 
+namespace {
+
+std::string to_string(bool value) {
+    return value ? "true" : "false";
+}
+
+std::string to_string(int value) {
+    return std::to_string(value);
+}
+
+std::string to_string(float value) {
+    std::ostringstream ss;
+    ss.imbue(std::locale::classic());
+    ss << value;
+
+    // Fall back to the maximum precision if the value doesn't round-trip
+    if (std::stof(ss.str()) != value) {
+        ss.str("");
+        ss << std::setprecision(std::numeric_limits<float>::max_digits10)
+           << value;
+    }
+
+    return ss.str();
+}
+
+std::string to_string(const Color &value) {
+    return value.to_hex();
+}
+
+std::string to_string(const Coordinate &value) {
+    return value.to_string();
+}
+
+template <typename T>
+std::string to_string(const std::vector<T> &values) {
+    std::string result;
+    for (const auto &value : values) {
+        if (!result.empty()) {
+            result += ',';
+        }
+        result += to_string(value);
+    }
+    return result;
+}
+
+}  // namespace
+
+std::string Query::canonical() const {
+    std::string result;
+
+    // QUERY_KEYS is sorted, so the slots are visited in a stable order
+    for (size_t i = 0; i != values_.size(); ++i) {
+        if (!values_[i]) {
+            continue;
+        }
+
+        const auto &key = QUERY_KEYS[i];
+        const auto &value = *values_[i];
+
+        auto default_it = default_map.find(std::string(key));
+        if (default_it != default_map.end()) {
+            bool is_default = std::visit(
+                [&value](const auto &default_val) {
+                    using T = std::decay_t<decltype(default_val)>;
+                    const auto *val = std::get_if<T>(&value);
+                    return val != nullptr && *val == default_val;
+                },
+                default_it->second);
+
+            // Skip values that are equivalent to omitting the key
+            if (is_default) {
+                continue;
+            }
+        }
+
+        if (!result.empty()) {
+            result += '&';
+        }
+
+        result += key;
+        result += '=';
+        result += std::visit([](const auto &val) { return to_string(val); },
+                             value);
+    }
+
+    return result;
+}
+
 }  // namespace weserv::api::parsers
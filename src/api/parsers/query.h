@@ -3,8 +3,13 @@
 #include "color.h"
 #include "coordinate.h"
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <typeindex>
 #include <unordered_map>
@@ -16,8 +21,104 @@ namespace weserv::api::parsers {
 
 using TypeMap = std::unordered_map<std::string, std::type_index>;
 using SynonymMap = std::unordered_map<std::string, std::string>;
+using DefaultMap =
+    std::unordered_map<std::string, std::variant<bool, int, float>>;
 using NginxKeySet = std::unordered_set<std::string>;
 
+/**
+ * All keys that can be stored within a query, i.e. the keys of `type_map`
+ * and the intermediate state that is written by the processors. Sorted, so
+ * that the canonical form can be serialized without sorting.
+ */
+// clang-format off
+constexpr std::array<std::string_view, 55> QUERY_KEYS = {
+    "a",     "accept", "af",     "angle",
+    "bg",    "blur",   "bri",
+    "cbg",   "ch",     "con",    "crop",   "cw",   "cx",   "cy",
+    "delay", "dpr",
+    "filt",  "fit",    "flip",   "flop",   "fpx",  "fpy",  "fsol",
+    "gam",
+    "h",     "hue",
+    "il",    "input_height",     "input_width",
+    "l",     "ll",     "loop",
+    "mask",  "mbg",    "mod",    "mtrim",
+    "n",
+    "output",
+    "page",  "page_height",      "precrop",
+    "q",
+    "rbg",   "ro",
+    "sat",   "sharp",  "sharpf", "sharpj", "start", "stop",
+    "tint",  "trim",   "type",
+    "w",     "we",
+};
+// clang-format on
+
+/**
+ * Index returned by query_key_index() for unknown keys.
+ */
+constexpr size_t QUERY_KEY_NOT_FOUND = QUERY_KEYS.size();
+
+/**
+ * Number of buckets of the perfect hash.
+ */
+constexpr size_t QUERY_KEY_BUCKETS = 128;
+
+/**
+ * FNV-1a hash, seeded such that it's collision-free for QUERY_KEYS.
+ * @param key The key.
+ * @return The bucket of the key, in the range [0, QUERY_KEY_BUCKETS).
+ */
+constexpr size_t query_key_hash(std::string_view key) {
+    uint32_t hash = 73140;
+    for (char c : key) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619U;
+    }
+
+    // The upper 7 bits are distributed best
+    return hash >> 25;
+}
+
+constexpr std::array<uint8_t, QUERY_KEY_BUCKETS> make_query_key_table() {
+    std::array<uint8_t, QUERY_KEY_BUCKETS> table{};
+    for (auto &bucket : table) {
+        bucket = static_cast<uint8_t>(QUERY_KEY_NOT_FOUND);
+    }
+    for (size_t i = 0; i < QUERY_KEYS.size(); ++i) {
+        table[query_key_hash(QUERY_KEYS[i])] = static_cast<uint8_t>(i);
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, QUERY_KEY_BUCKETS> QUERY_KEY_TABLE =
+    make_query_key_table();
+
+/**
+ * Get the slot of a key within the query.
+ * @param key The key.
+ * @return The index of the key within QUERY_KEYS, or QUERY_KEY_NOT_FOUND if
+ *         the key is unknown.
+ */
+constexpr size_t query_key_index(std::string_view key) {
+    size_t index = QUERY_KEY_TABLE[query_key_hash(key)];
+    return index != QUERY_KEY_NOT_FOUND && QUERY_KEYS[index] == key
+               ? index
+               : QUERY_KEY_NOT_FOUND;
+}
+
+constexpr bool is_valid_query_key_table() {
+    for (size_t i = 0; i < QUERY_KEYS.size(); ++i) {
+        if (query_key_index(QUERY_KEYS[i]) != i ||
+            (i > 0 && !(QUERY_KEYS[i - 1] < QUERY_KEYS[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(is_valid_query_key_table(),
+              "QUERY_KEYS must be sorted and the hash must be collision-free, "
+              "try another seed");
+
 class Query {
  public:
     explicit Query(const std::string &value);
@@ -28,7 +129,7 @@ class Query {
      * This is the only function that can pass enums, the other functions do not
      * allow this.
      */
-    inline E get(const std::string &key, const E &default_val) const {
+    inline E get(std::string_view key, const E &default_val) const {
         // Get the value as an int and call get(), then convert it back to an
         // enum
         auto casted = static_cast<int>(default_val);
@@ -37,45 +138,88 @@ class Query {
 
     template <typename T,
               typename = typename std::enable_if<!std::is_enum<T>::value>::type>
-    const inline T &get(const std::string &key, const T &default_val) const {
-        auto it = query_map_.find(key);
-        return it != query_map_.end() ? std::get<T>(it->second) : default_val;
+    const inline T &get(std::string_view key, const T &default_val) const {
+        const auto *val = find(key);
+        return val != nullptr ? std::get<T>(*val) : default_val;
     }
 
     template <typename T,
               typename = typename std::enable_if<!std::is_enum<T>::value>::type>
-    const inline T &get(const std::string &key) const {
-        const auto &val = query_map_.at(key);
-        return std::get<T>(val);
+    const inline T &get(std::string_view key) const {
+        const auto *val = find(key);
+        if (val == nullptr) {
+            throw std::out_of_range("Query key not found");
+        }
+        return std::get<T>(*val);
     }
 
     template <typename T,
               typename = typename std::enable_if<!std::is_enum<T>::value>::type,
               typename Predicate>
-    const inline T &get_if(const std::string &key, Predicate predicate,
+    const inline T &get_if(std::string_view key, Predicate predicate,
                            const T &default_val) const {
-        auto it = query_map_.find(key);
-        if (it == query_map_.end()) {
+        const auto *val = find(key);
+        if (val == nullptr) {
             return default_val;
         }
-        const T &val = std::get<T>(it->second);
-        return predicate(val) ? val : default_val;
+        const T &value = std::get<T>(*val);
+        return predicate(value) ? value : default_val;
     }
 
-    inline bool exists(const std::string &key) {
-        return query_map_.find(key) != query_map_.end();
+    inline bool exists(std::string_view key) const {
+        return find(key) != nullptr;
     }
 
+    /**
+     * Note: only the keys listed within QUERY_KEYS can be updated.
+     */
     template <typename T,
               typename = typename std::enable_if<!std::is_enum<T>::value>::type>
-    inline void update(const std::string &key, const T &val) {
-        query_map_[key] = val;
+    inline void update(std::string_view key, const T &val) {
+        size_t index = query_key_index(key);
+        if (index == QUERY_KEY_NOT_FOUND) {
+            throw std::out_of_range("Unknown query key");
+        }
+        values_[index] = val;
     }
 
+    /**
+     * Serialize the parsed key-value pairs in a stable, sorted order.
+     * Synonyms are resolved, unknown keys are dropped and values are
+     * normalized (default values are left out), so equivalent query strings
+     * result in the same canonical form.
+     * @return The canonical form of this query.
+     */
+    std::string canonical() const;
+
  private:
     using QueryVariant = std::variant<bool, int, float, Color, Coordinate,
                                       std::vector<int>, std::vector<float>>;
-    std::unordered_map<std::string, QueryVariant> query_map_;
+
+    /**
+     * One slot for each key of QUERY_KEYS, empty if the key isn't set.
+     */
+    std::array<std::optional<QueryVariant>, QUERY_KEYS.size()> values_;
+
+    inline const QueryVariant *find(std::string_view key) const {
+        size_t index = query_key_index(key);
+        if (index == QUERY_KEY_NOT_FOUND || !values_[index]) {
+            return nullptr;
+        }
+        return &*values_[index];
+    }
+
+    /**
+     * Set a value, unless it has already been set. The first occurrence of a
+     * key within the query string takes precedence.
+     */
+    template <typename T>
+    inline void emplace(std::string_view key, const T &val) {
+        auto &slot = values_[query_key_index(key)];
+        if (!slot) {
+            slot = val;
+        }
+    }
 
     template <typename T>
     std::vector<T> tokenize(const std::string &data,
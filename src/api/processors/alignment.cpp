@@ -11,9 +11,13 @@ namespace weserv::api::processors {
 using enums::Canvas;
 using enums::Position;
 
+bool Alignment::is_noop() const {
+    return query_->get<Canvas>("fit", Canvas::Max) != Canvas::Crop;
+}
+
 VImage Alignment::process(const VImage &image) const {
     // Should we process the image?
-    if (query_->get<Canvas>("fit", Canvas::Max) != Canvas::Crop) {
+    if (is_noop()) {
         return image;
     }
 
@@ -48,9 +52,11 @@ VImage Alignment::process(const VImage &image) const {
     auto crop_width = std::min(image_width, width);
     auto crop_height = std::min(image_height, height);
 
-    // Skip smart crop for multi-page images
-    if (n_pages == 1 && (crop_position == Position::Entropy ||
-                         crop_position == Position::Attention)) {
+    // Skip smart crop for multi-page images or if only the metadata is
+    // requested, the dimensions of the output are the same anyway
+    if (n_pages == 1 && !metadata_only() &&
+        (crop_position == Position::Entropy ||
+         crop_position == Position::Attention)) {
         // Copy to memory evaluates the image, so set up the timeout handler,
         // if necessary.
         utils::setup_timeout_handler(image, config_.process_timeout);
@@ -6,6 +6,12 @@ namespace weserv::api::processors {
 
 using parsers::Color;
 
+bool Background::is_noop() const {
+    // The background is completely transparent, whether the image has an
+    // alpha channel is only known while processing
+    return query_->get<Color>("bg", Color::DEFAULT).is_transparent();
+}
+
 VImage Background::process(const VImage &image) const {
     auto bg = query_->get<Color>("bg", Color::DEFAULT);
 
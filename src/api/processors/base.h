@@ -3,10 +3,12 @@
 #include "../parsers/query.h"
 
 #include <memory>
+#include <string>
 #include <utility>
 
 #include <vips/vips8>
 #include <weserv/config.h>
+#include <weserv/enums.h>
 
 namespace weserv::api::processors {
 
@@ -24,7 +26,58 @@ class ImageProcessor {
         return processor.process(image);
     }
 
+    /**
+     * Whether the image is returned as is, which is determined by the query
+     * alone. Such processors are left out of the plan of a query.
+     * @note Must be called after the image is loaded, since loading resolves
+     *       parts of the query.
+     * @return true if this processor can be skipped.
+     */
+    virtual bool is_noop() const {
+        return false;
+    }
+
+    /**
+     * Whether this is a point operation, i.e. each output pixel only depends
+     * on the input pixel at the same position. Adjacent point operations are
+     * fused into a single lookup table, see point.h.
+     * @return true if this processor is a point operation.
+     */
+    virtual bool is_point_operation() const {
+        return false;
+    }
+
+    /**
+     * Whether this point operation only depends on the luminance of a pixel
+     * (e.g. duotone), rather than on each of its bands. Such operations are
+     * looked up by the greyscale image.
+     * @return true if this point operation only depends on the luminance.
+     */
+    virtual bool is_luminance_operation() const {
+        return false;
+    }
+
+    /**
+     * The parameters of this point operation, which identify the lookup
+     * tables that are composed of it.
+     * @return The parameters, e.g. `bri=10`.
+     */
+    virtual std::string point_parameters() const {
+        return "";
+    }
+
  protected:
+    /**
+     * Whether only the metadata of the image is requested (`&output=json`).
+     * The pixels of the image are never evaluated in that case, so there's
+     * no need to copy the image to memory for random access.
+     * @return true if only the metadata of the image is requested.
+     */
+    bool metadata_only() const {
+        return query_->get<enums::Output>("output", enums::Output::Origin) ==
+               enums::Output::Json;
+    }
+
     /**
      * Query holder.
      */
@@ -4,6 +4,10 @@
 
 namespace weserv::api::processors {
 
+bool Blur::is_noop() const {
+    return query_->get<float>("blur", 0.0F) == 0.0F;
+}
+
 VImage Blur::process(const VImage &image) const {
     // Sigma of gaussian
     auto sigma = query_->get<float>("blur", 0.0F);
@@ -1,9 +1,11 @@
 #include "brightness.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-VImage Brightness::process(const VImage &image) const {
-    auto bri = query_->get_if<int>(
+int Brightness::get_brightness() const {
+    return query_->get_if<int>(
         "bri",
         [](int b) {
             // Brightness needs to be in the range of
@@ -11,6 +13,18 @@ VImage Brightness::process(const VImage &image) const {
             return b >= -100 && b <= 100;
         },
         0);
+}
+
+bool Brightness::is_noop() const {
+    return get_brightness() == 0;
+}
+
+std::string Brightness::point_parameters() const {
+    return "bri=" + std::to_string(get_brightness());
+}
+
+VImage Brightness::process(const VImage &image) const {
+    auto bri = get_brightness();
 
     // Should we process the image?
     if (bri == 0) {
@@ -2,13 +2,30 @@
 
 #include "base.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-class Brightness : ImageProcessor {
+class Brightness : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+    bool is_noop() const override;
+
+    bool is_point_operation() const override {
+        return true;
+    }
+
+    std::string point_parameters() const override;
+
+ private:
+    /**
+     * Get the brightness from the query.
+     * @return The brightness, within the range of -100 - 100.
+     */
+    int get_brightness() const;
 };
 
 }  // namespace weserv::api::processors
@@ -1,6 +1,7 @@
 #include "contrast.h"
 
 #include <cmath>
+#include <string>
 
 namespace weserv::api::processors {
 
@@ -70,8 +71,8 @@ VImage Contrast::sigmoid(const VImage &image, const double contrast) const {
     return image.maplut(result);
 }
 
-VImage Contrast::process(const VImage &image) const {
-    auto con = query_->get_if<int>(
+int Contrast::get_contrast() const {
+    return query_->get_if<int>(
         "con",
         [](int c) {
             // Contrast needs to be in the range of
@@ -79,6 +80,18 @@ VImage Contrast::process(const VImage &image) const {
             return c >= -100 && c <= 100;
         },
         0);
+}
+
+bool Contrast::is_noop() const {
+    return get_contrast() == 0;
+}
+
+std::string Contrast::point_parameters() const {
+    return "con=" + std::to_string(get_contrast());
+}
+
+VImage Contrast::process(const VImage &image) const {
+    auto con = get_contrast();
 
     // Should we process the image?
     if (con == 0) {
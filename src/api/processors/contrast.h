@@ -2,15 +2,31 @@
 
 #include "base.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-class Contrast : ImageProcessor {
+class Contrast : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
 
+    bool is_noop() const override;
+
+    bool is_point_operation() const override {
+        return true;
+    }
+
+    std::string point_parameters() const override;
+
  private:
+    /**
+     * Get the contrast from the query.
+     * @return The contrast, within the range of -100 - 100.
+     */
+    int get_contrast() const;
+
     /**
      * magick's sigmoidal non-linearity contrast control equivalent in libvips.
      *
@@ -6,10 +6,14 @@ namespace weserv::api::processors {
 
 using parsers::Coordinate;
 
+bool Crop::is_noop() const {
+    return !query_->exists("cx") && !query_->exists("cy") &&
+           !query_->exists("cw") && !query_->exists("ch");
+}
+
 VImage Crop::process(const VImage &image) const {
     // Should we process the image?
-    if (!query_->exists("cx") && !query_->exists("cy") &&
-        !query_->exists("cw") && !query_->exists("ch")) {
+    if (is_noop()) {
         return image;
     }
 
@@ -53,6 +57,11 @@ VImage Crop::process(const VImage &image) const {
         // Update the page height
         query_->update("page_height", crop_h);
 
+        if (metadata_only()) {
+            return utils::crop_multi_page(image, crop_x, crop_y, crop_w,
+                                          crop_h, n_pages, image_height);
+        }
+
         // Copy to memory evaluates the image, so set up the timeout handler,
         // if necessary.
         utils::setup_timeout_handler(image, config_.process_timeout);
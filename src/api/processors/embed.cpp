@@ -84,9 +84,13 @@ VImage Embed::embed_multi_page(const VImage &image, int left, int top,
     // LCOV_EXCL_STOP
 }
 
+bool Embed::is_noop() const {
+    return query_->get<Canvas>("fit", Canvas::Max) != Canvas::Embed;
+}
+
 VImage Embed::process(const VImage &image) const {
     // Should we process the image?
-    if (query_->get<Canvas>("fit", Canvas::Max) != Canvas::Embed) {
+    if (is_noop()) {
         return image;
     }
 
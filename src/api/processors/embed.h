@@ -4,12 +4,14 @@
 
 namespace weserv::api::processors {
 
-class Embed : ImageProcessor {
+class Embed : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
 
+    bool is_noop() const override;
+
  private:
     /**
      * Split into frames, embed each frame, reassemble, and update page height.
@@ -3,6 +3,7 @@
 #include "../enums.h"
 
 #include <array>
+#include <string>
 #include <vector>
 
 namespace weserv::api::processors {
@@ -10,6 +11,34 @@ namespace weserv::api::processors {
 using enums::FilterType;
 using parsers::Color;
 
+bool Filter::is_noop() const {
+    return query_->get<FilterType>("filt", FilterType::None) ==
+           FilterType::None;
+}
+
+bool Filter::is_point_operation() const {
+    auto filter_type = query_->get<FilterType>("filt", FilterType::None);
+    return filter_type == FilterType::Negate ||
+           filter_type == FilterType::Duotone;
+}
+
+bool Filter::is_luminance_operation() const {
+    return query_->get<FilterType>("filt", FilterType::None) ==
+           FilterType::Duotone;
+}
+
+std::string Filter::point_parameters() const {
+    if (query_->get<FilterType>("filt", FilterType::None) ==
+        FilterType::Negate) {
+        return "filt=negate";
+    }
+
+    return "filt=duotone&start=" +
+           query_->get<Color>("start", Color(255, 200, 54, 88)).to_hex() +
+           "&stop=" +
+           query_->get<Color>("stop", Color(255, 216, 231, 79)).to_hex();
+}
+
 VImage Filter::process(const VImage &image) const {
     auto filter_type = query_->get<FilterType>("filt", FilterType::None);
 
@@ -2,13 +2,26 @@
 
 #include "base.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-class Filter : ImageProcessor {
+class Filter : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+    bool is_noop() const override;
+
+    /**
+     * Only the negate and duotone filters are point operations.
+     */
+    bool is_point_operation() const override;
+
+    bool is_luminance_operation() const override;
+
+    std::string point_parameters() const override;
 };
 
 }  // namespace weserv::api::processors
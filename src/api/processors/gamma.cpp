@@ -1,21 +1,37 @@
 #include "gamma.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-VImage Gamma::process(const VImage &image) const {
+float Gamma::get_gamma() const {
     auto gamma = query_->get<float>("gam", 0.0F);
 
-    // Should we process the image?
-    if (gamma == 0.0F) {
-        return image;
-    }
-
     // Gamma needs to be in the range of 1.0 - 3.0
-    if (gamma < 1.0 || gamma > 3.0) {
+    if (gamma != 0.0F && (gamma < 1.0 || gamma > 3.0)) {
         // Set gamma to the default correction (sRGB)
         gamma = 2.2;
     }
 
+    return gamma;
+}
+
+bool Gamma::is_noop() const {
+    return get_gamma() == 0.0F;
+}
+
+std::string Gamma::point_parameters() const {
+    return "gam=" + std::to_string(get_gamma());
+}
+
+VImage Gamma::process(const VImage &image) const {
+    auto gamma = get_gamma();
+
+    // Should we process the image?
+    if (gamma == 0.0F) {
+        return image;
+    }
+
     // Edit the gamma
     if (image.has_alpha()) {
         // Separate alpha channel
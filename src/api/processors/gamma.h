@@ -2,13 +2,30 @@
 
 #include "base.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-class Gamma : ImageProcessor {
+class Gamma : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+    bool is_noop() const override;
+
+    bool is_point_operation() const override {
+        return true;
+    }
+
+    std::string point_parameters() const override;
+
+ private:
+    /**
+     * Get the gamma from the query.
+     * @return The gamma, within the range of 1.0 - 3.0 or 0.0 if unset.
+     */
+    float get_gamma() const;
 };
 
 }  // namespace weserv::api::processors
@@ -4,9 +4,8 @@
 
 #include <algorithm>
 #include <cmath>
-#include <iomanip>
+#include <cstdint>
 #include <limits>
-#include <ostream>
 #include <stdexcept>
 #include <tuple>
 
@@ -15,10 +14,162 @@ namespace weserv::api::processors {
 using enums::MaskType;
 using parsers::Color;
 
-std::string Mask::svg_path_by_type(const int width, const int height,
-                                   const MaskType &mask,
-                                   int *out_x_min, int *out_y_min,
-                                   int *out_width, int *out_height) const {
+namespace {
+
+/**
+ * Anti-aliased coverage rasterizer of closed paths. Each line accumulates the
+ * signed area it covers within the pixels it crosses, the running sum of these
+ * areas along a row yields the exact coverage of each pixel. See also:
+ * https://medium.com/@raphlinus/inside-the-fastest-font-renderer-in-the-world-75ae5270c445
+ */
+class Rasterizer {
+ public:
+    Rasterizer(int width, int height)
+        : width_(width), height_(height),
+          // Lines may accumulate up to 2 pixels past the right edge
+          stride_(static_cast<size_t>(width) + 2),
+          accumulation_(stride_ * height, 0.0F) {}
+
+    /**
+     * Draw a closed path.
+     * @param path The vertices of the path, in pixels.
+     */
+    void draw_path(const std::vector<Mask::PathCoordinate> &path) {
+        for (size_t i = 0; i != path.size(); ++i) {
+            draw_line(path[i], path[(i + 1) % path.size()]);
+        }
+    }
+
+    /**
+     * Get the coverage of each pixel.
+     * @param invert Whether everything but the path should be covered.
+     * @return The coverage of each pixel as an 8-bit mask.
+     */
+    VImage coverage(bool invert) const {
+        std::vector<uint8_t> mask(static_cast<size_t>(width_) * height_);
+
+        for (int y = 0; y != height_; ++y) {
+            const float *line = accumulation_.data() + y * stride_;
+            uint8_t *out = mask.data() + static_cast<size_t>(y) * width_;
+
+            float area = 0.0F;
+            for (int x = 0; x != width_; ++x) {
+                area += line[x];
+
+                // Non-zero winding, the coverage is in the range of 0 - 1
+                auto value = static_cast<uint8_t>(
+                    std::lround(std::min(std::abs(area), 1.0F) * 255.0F));
+                out[x] = invert ? 255 - value : value;
+            }
+        }
+
+        // Copy to memory, since the mask goes out of scope
+        return VImage::new_from_memory(mask.data(), mask.size(), width_,
+                                       height_, 1, VIPS_FORMAT_UCHAR)
+            .copy_memory();
+    }
+
+ private:
+    void draw_line(Mask::PathCoordinate p0, Mask::PathCoordinate p1) {
+        if (p0.y == p1.y) {
+            return;
+        }
+
+        float direction = 1.0F;
+        if (p0.y > p1.y) {
+            direction = -1.0F;
+            std::swap(p0, p1);
+        }
+
+        float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+        float x = p0.x;
+        if (p0.y < 0.0F) {
+            x -= p0.y * dxdy;
+        }
+
+        auto y_start = std::max(static_cast<int>(std::floor(p0.y)), 0);
+        auto y_end = std::min(static_cast<int>(std::ceil(p1.y)), height_);
+        auto max_x = static_cast<float>(width_);
+
+        for (int y = y_start; y < y_end; ++y) {
+            float *line = accumulation_.data() + y * stride_;
+
+            float dy = std::min(static_cast<float>(y + 1), p1.y) -
+                       std::max(static_cast<float>(y), p0.y);
+            float x_next = x + dxdy * dy;
+            float d = dy * direction;
+
+            // Parts outside the image are accumulated at its edges
+            float x0 = std::clamp(std::min(x, x_next), 0.0F, max_x);
+            float x1 = std::clamp(std::max(x, x_next), 0.0F, max_x);
+
+            float x0_floor = std::floor(x0);
+            float x1_ceil = std::ceil(x1);
+            auto x0i = static_cast<int>(x0_floor);
+            auto x1i = static_cast<int>(x1_ceil);
+
+            if (x1i <= x0i + 1) {
+                // The line is within a single pixel
+                float x_mid = 0.5F * (x0 + x1) - x0_floor;
+                line[x0i] += d - d * x_mid;
+                line[x0i + 1] += d * x_mid;
+            } else {
+                float s = 1.0F / (x1 - x0);
+                float x0_fract = x0 - x0_floor;
+                float a0 = 0.5F * s * (1.0F - x0_fract) * (1.0F - x0_fract);
+                float x1_fract = x1 - x1_ceil + 1.0F;
+                float am = 0.5F * s * x1_fract * x1_fract;
+
+                line[x0i] += d * a0;
+                if (x1i == x0i + 2) {
+                    line[x0i + 1] += d * (1.0F - a0 - am);
+                } else {
+                    float a1 = s * (1.5F - x0_fract);
+                    line[x0i + 1] += d * (a1 - a0);
+                    for (int xi = x0i + 2; xi < x1i - 1; ++xi) {
+                        line[xi] += d * s;
+                    }
+                    float a2 = a1 + static_cast<float>(x1i - x0i - 3) * s;
+                    line[x1i - 1] += d * (1.0F - a2 - am);
+                }
+                line[x1i] += d * am;
+            }
+
+            x = x_next;
+        }
+    }
+
+    int width_;
+    int height_;
+    size_t stride_;
+    std::vector<float> accumulation_;
+};
+
+/**
+ * Rasterize the mask of a single page and replicate it for all pages.
+ * @param path The mask path, in pixels.
+ * @param width Image width.
+ * @param page_height Page height.
+ * @param n_pages Number of pages.
+ * @param invert Whether everything but the path should be covered.
+ * @return The 8-bit mask.
+ */
+VImage rasterize(const std::vector<Mask::PathCoordinate> &path, int width,
+                 int page_height, int n_pages, bool invert) {
+    Rasterizer rasterizer(width, page_height);
+    rasterizer.draw_path(path);
+
+    auto mask = rasterizer.coverage(invert);
+
+    return n_pages > 1 ? mask.replicate(1, n_pages) : mask;
+}
+
+}  // namespace
+
+std::vector<Mask::PathCoordinate>
+Mask::path_by_type(const int width, const int height, const MaskType &mask,
+                   int *out_x_min, int *out_y_min, int *out_width,
+                   int *out_height) const {
     int min = std::min(width, height);
     float outer_radius = static_cast<float>(min) / 2.0;
     float mid_x = static_cast<float>(width) / 2.0;
@@ -34,7 +185,9 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         std::tie(mask_transl, scale) = translation_and_scaling(
             width, height, *out_x_min, *out_y_min, out_width, out_height);
 
-        return transformed_path_string(coordinates, mask_transl, scale);
+        transform_path(&coordinates, mask_transl, scale);
+
+        return coordinates;
     }
 
     if (mask == MaskType::Ellipse) {
@@ -43,7 +196,7 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         *out_width = width;
         *out_height = height;
 
-        return svg_ellipse_path(mid_x, mid_y, mid_x, mid_y);
+        return ellipse_path(mid_x, mid_y, mid_x, mid_y);
     }
 
     if (mask == MaskType::Circle) {
@@ -52,7 +205,7 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         *out_width = min;
         *out_height = min;
 
-        return svg_circle_path(mid_x, mid_y, outer_radius);
+        return ellipse_path(mid_x, mid_y, outer_radius, outer_radius);
     }
 
     // 'inner' radius of the polygon/star
@@ -145,32 +298,32 @@ std::string Mask::svg_path_by_type(const int width, const int height,
     std::tie(mask_transl, scale) = translation_and_scaling(
         width, height, *out_x_min, *out_y_min, out_width, out_height);
 
-    std::string path = transformed_path_string(coordinates, mask_transl, scale);
+    transform_path(&coordinates, mask_transl, scale);
 
-    // If an odd number of points, add a point at the top of the polygon; this
-    // will shift the calculated center point of the shape so that the center
-    // point of the polygon is at x,y (otherwise the center is mis-located)
-    if (points % 2 == 1) {
-        path = "M0 " + std::to_string(outer_radius) + " " + path;
-    }
-
-    return path;
+    return coordinates;
 }
 
-std::string Mask::svg_circle_path(const float cx, const float cy,
-                                  const float r) const {
-    std::ostringstream ss;
-    ss << "M " << cx - r << ", " << cy << "a" << r << "," << r << " 0 1,0 "
-       << r * 2 << ",0 a " << r << "," << r << " 0 1,0 -" << r * 2 << ",0";
-    return ss.str();
-}
+std::vector<Mask::PathCoordinate>
+Mask::ellipse_path(const float cx, const float cy, const float rx,
+                   const float ry) const {
+    // The number of segments for which the maximum deviation, r * (1 -
+    // cos(pi / n)), stays below 0.1 pixels
+    double radius = std::max({rx, ry, 1.0F});
+    auto segments = std::max(
+        static_cast<int>(std::ceil(M_PI / std::acos(1.0 - 0.1 / radius))), 16);
+
+    std::vector<PathCoordinate> coordinates;
+    coordinates.reserve(segments);
+
+    for (int i = 0; i < segments; ++i) {
+        double angle = i * 2 * M_PI / segments;
+
+        coordinates.push_back(
+            {static_cast<float>(cx + rx * std::cos(angle)),
+             static_cast<float>(cy + ry * std::sin(angle))});
+    }
 
-std::string Mask::svg_ellipse_path(const float cx, const float cy,
-                                   const float rx, const float ry) const {
-    std::ostringstream ss;
-    ss << "M " << cx - rx << ", " << cy << "a" << rx << "," << ry << " 0 1,0 "
-       << rx * 2 << ",0a" << rx << "," << ry << " 0 1,0 -" << rx * 2 << ",0";
-    return ss.str();
+    return coordinates;
 }
 
 std::vector<Mask::PathCoordinate>
@@ -256,24 +409,17 @@ Mask::translation_and_scaling(const int image_width, const int image_height,
     return std::pair{mask_transl, scale};
 }
 
-std::string
-Mask::transformed_path_string(const std::vector<PathCoordinate> &coordinates,
-                              const PathCoordinate &transl,
-                              const double scale) const {
-    std::ostringstream ss;
-    ss << std::fixed << std::showpoint << std::setprecision(1);
-
-    for (size_t i = 0; i != coordinates.size(); ++i) {
-        PathCoordinate coordinate = coordinates[i];
-
-        auto prepend = i == 0 ? "M" : " L";
-        ss << prepend << coordinate.x * scale + transl.x << " "
-           << coordinate.y * scale + transl.y;
+void Mask::transform_path(std::vector<PathCoordinate> *coordinates,
+                          const PathCoordinate &transl,
+                          const double scale) const {
+    for (auto &coordinate : *coordinates) {
+        coordinate.x = static_cast<float>(coordinate.x * scale + transl.x);
+        coordinate.y = static_cast<float>(coordinate.y * scale + transl.y);
     }
+}
 
-    ss << " Z";
-
-    return ss.str();
+bool Mask::is_noop() const {
+    return query_->get<MaskType>("mask", MaskType::None) == MaskType::None;
 }
 
 VImage Mask::process(const VImage &image) const {
@@ -292,12 +438,9 @@ VImage Mask::process(const VImage &image) const {
     auto page_height =
         n_pages > 1 ? query_->get<int>("page_height") : image_height;
 
-    const auto *preserve_aspect_ratio =
-        mask_type == MaskType::Ellipse ? "none" : "xMidYMid meet";
-
     int x_min, y_min, mask_width, mask_height;
-    auto path = svg_path_by_type(image_width, page_height, mask_type, &x_min,
-                                 &y_min, &mask_width, &mask_height);
+    auto path = path_by_type(image_width, page_height, mask_type, &x_min,
+                             &y_min, &mask_width, &mask_height);
 
     auto mask_background = query_->get<Color>("mbg", Color::DEFAULT);
 
@@ -307,26 +450,13 @@ VImage Mask::process(const VImage &image) const {
     // Cut out first if the mask background is not opaque or when the image has
     // an alpha channel
     if (!mask_background.is_opaque() || output_image.has_alpha()) {
-        std::ostringstream svg;
-        svg << R"(<svg xmlns="http://www.w3.org/2000/svg")"
-            << R"( xmlns:xlink="http://www.w3.org/1999/xlink")"
-            << " width=\"" << image_width << "\" height=\"" << image_height
-            << "\""
-            << " preserveAspectRatio=\"" << preserve_aspect_ratio << "\">\n"
-            << R"(<defs><path id="shape" d=")" << path << "\"/></defs>\n";
-        for (int i = 0; i < n_pages; ++i) {
-            svg << R"(<use xlink:href="#shape" y=")"
-                << static_cast<uint64_t>(page_height) * i << "\"/>\n";
-        }
-        svg << "</svg>";
-
-        auto svg_mask = svg.str();
+        auto alpha = rasterize(path, image_width, page_height, n_pages, false);
 
-        // We don't take a copy of the data or free it
-        auto *blob = vips_blob_new(nullptr, svg_mask.data(), svg_mask.size());
-        auto mask = VImage::svgload_buffer(
-            blob, VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
-        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+        // A black mask, which only uses its alpha channel
+        auto mask = alpha.new_from_image(std::vector<double>{0, 0, 0})
+                        .bandjoin(alpha)
+                        .copy(VImage::option()->set("interpretation",
+                                                    VIPS_INTERPRETATION_sRGB));
 
         // Cutout via dest-in
         output_image = output_image.composite2(mask, VIPS_BLEND_MODE_DEST_IN);
@@ -334,29 +464,19 @@ VImage Mask::process(const VImage &image) const {
 
     // If the mask background is not completely transparent; overlay the frame
     if (!mask_background.is_transparent()) {
-        std::ostringstream svg;
-        svg << R"(<svg xmlns="http://www.w3.org/2000/svg")"
-            << R"( xmlns:xlink="http://www.w3.org/1999/xlink")"
-            << " width=\"" << image_width << "\" height=\"" << image_height
-            << "\""
-            << " preserveAspectRatio=\"" << preserve_aspect_ratio << "\">\n"
-            << R"(<defs><path id="shape" d=")" << path << " M0 0 h"
-            << image_width << " v" << page_height << " h-" << image_width
-            << R"( Z" fill-rule="evenodd" )"
-            << "fill=\"" << mask_background.to_string() << "\"/></defs>\n";
-        for (int i = 0; i < n_pages; ++i) {
-            svg << R"(<use xlink:href="#shape" y=")"
-                << static_cast<uint64_t>(page_height) * i << "\"/>\n";
-        }
-        svg << "</svg>";
+        auto rgba = mask_background.to_rgba();
 
-        auto svg_frame = svg.str();
+        // The frame covers everything but the mask
+        auto alpha = rasterize(path, image_width, page_height, n_pages, true);
+        if (!mask_background.is_opaque()) {
+            alpha = (alpha * (rgba[3] / 255.0)).cast(VIPS_FORMAT_UCHAR);
+        }
 
-        // We don't take a copy of the data or free it
-        auto *blob = vips_blob_new(nullptr, svg_frame.data(), svg_frame.size());
-        auto frame = VImage::svgload_buffer(
-            blob, VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
-        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+        auto frame =
+            alpha.new_from_image(std::vector<double>{rgba[0], rgba[1], rgba[2]})
+                .bandjoin(alpha)
+                .copy(VImage::option()->set("interpretation",
+                                            VIPS_INTERPRETATION_sRGB));
 
         // Ensure image to composite is premultiplied sRGB
         frame = frame.premultiply();
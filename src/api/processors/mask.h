@@ -3,12 +3,12 @@
 #include "base.h"
 #include "../enums.h"
 
-#include <string>
+#include <utility>
 #include <vector>
 
 namespace weserv::api::processors {
 
-class Mask : ImageProcessor {
+class Mask : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
@@ -18,9 +18,11 @@ class Mask : ImageProcessor {
 
     VImage process(const VImage &image) const override;
 
+    bool is_noop() const override;
+
  private:
     /**
-     * Get the SVG mask path by type.
+     * Get the mask path by type, i.e. the vertices of a closed polygon.
      * @param width Image width.
      * @param height Image width.
      * @param mask Type mask.
@@ -28,17 +30,19 @@ class Mask : ImageProcessor {
      * @param out_y_min Top edge of mask.
      * @param out_width Mask width.
      * @param out_height Mask height.
+     * @return The mask path, in pixels.
      */
-    std::string svg_path_by_type(int width, int height,
-                                 const enums::MaskType &mask,
-                                 int *out_x_min, int *out_y_min,
-                                 int *out_width, int *out_height) const;
+    std::vector<PathCoordinate> path_by_type(int width, int height,
+                                             const enums::MaskType &mask,
+                                             int *out_x_min, int *out_y_min,
+                                             int *out_width,
+                                             int *out_height) const;
 
     /**
      * Formula from http://mathworld.wolfram.com/HeartCurve.html
      * @param cx The x coordinate of the center of the image.
      * @param cy The y coordinate of the center of the image.
-     * @return The circle represented as SVG path.
+     * @return The heart represented as path.
      */
     std::vector<PathCoordinate> heart_path(float cx, float cy,
                                            int *out_x_min, int *out_y_min,
@@ -61,35 +65,25 @@ class Mask : ImageProcessor {
                             int *mask_width, int *mask_height) const;
 
     /**
-     * Get the transformed path "d" attribute.
+     * Transform a path in place.
      * @param coordinates Path coordinates.
      * @param transl x, y-coordinate transformation.
      * @param scale Scale factor.
-     * @return Transformed path as string.
-     */
-    std::string
-    transformed_path_string(const std::vector<PathCoordinate> &coordinates,
-                            const PathCoordinate &transl, double scale) const;
-
-    /**
-     * Generates an circle SVG path.
-     * See also: https://stackoverflow.com/a/10477334
-     * @param cx The x coordinate of the center of the circle.
-     * @param cy The y coordinate of the center of the circle.
-     * @param r The radius of the circle.
-     * @return The circle represented as SVG path.
      */
-    std::string svg_circle_path(float cx, float cy, float r) const;
+    void transform_path(std::vector<PathCoordinate> *coordinates,
+                        const PathCoordinate &transl, double scale) const;
 
     /**
-     * Generates an ellipse SVG path.
+     * Generates an ellipse path, which is flattened into line segments that
+     * deviate less than a tenth of a pixel from the ellipse.
      * @param cx The x coordinate of the center of the ellipse.
      * @param cy The y coordinate of the center of the ellipse.
      * @param rx The horizontal radius.
      * @param ry The vertical radius.
-     * @return The ellipse represented as SVG path.
+     * @return The ellipse represented as path.
      */
-    std::string svg_ellipse_path(float cx, float cy, float rx, float ry) const;
+    std::vector<PathCoordinate> ellipse_path(float cx, float cy, float rx,
+                                             float ry) const;
 };
 
 }  // namespace weserv::api::processors
@@ -2,22 +2,37 @@
 
 namespace weserv::api::processors {
 
-VImage Modulate::process(const VImage &image) const {
-    auto brightness = query_->get_if<float>(
+void Modulate::get_modulation(float *brightness, float *saturation,
+                              int *hue) const {
+    *brightness = query_->get_if<float>(
         /*"bri"*/"mod",
         [](float b) {
             // Brightness needs to be in range of 0 - 10000
             return b >= 0 && b <= 10000;
         },
         1.0F);
-    auto saturation = query_->get_if<float>(
+    *saturation = query_->get_if<float>(
         "sat",
         [](float s) {
             // Saturation needs to be in range of 0 - 10000
             return s >= 0 && s <= 10000;
         },
         1.0F);
-    auto hue = query_->get<int>("hue", 0);  // Normalized to [0, 360] below
+    *hue = query_->get<int>("hue", 0);  // Normalized to [0, 360] below
+}
+
+bool Modulate::is_noop() const {
+    float brightness, saturation;
+    int hue;
+    get_modulation(&brightness, &saturation, &hue);
+
+    return brightness == 1.0 && saturation == 1.0 && hue == 0;
+}
+
+VImage Modulate::process(const VImage &image) const {
+    float brightness, saturation;
+    int hue;
+    get_modulation(&brightness, &saturation, &hue);
 
     // Should we process the image?
     if (brightness == 1.0 && saturation == 1.0 && hue == 0) {
@@ -4,11 +4,22 @@
 
 namespace weserv::api::processors {
 
-class Modulate : ImageProcessor {
+class Modulate : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+    bool is_noop() const override;
+
+ private:
+    /**
+     * Get the modulation from the query.
+     * @param brightness Output brightness multiplier.
+     * @param saturation Output saturation multiplier.
+     * @param hue Output hue rotation, in degrees.
+     */
+    void get_modulation(float *brightness, float *saturation, int *hue) const;
 };
 
 }  // namespace weserv::api::processors
@@ -4,6 +4,12 @@
 
 namespace weserv::api::processors {
 
+bool Orientation::is_noop() const {
+    return query_->get<int>("angle", 0) == 0 &&
+           !query_->get<bool>("flip", false) &&
+           !query_->get<bool>("flop", false);
+}
+
 VImage Orientation::process(const VImage &image) const {
     auto angle = query_->get<int>("angle", 0);
     auto flip = query_->get<bool>("flip", false);
@@ -18,7 +24,7 @@ VImage Orientation::process(const VImage &image) const {
     auto output_image = image;
 
     // Rotate or flip needs random access
-    if (angle != 0 || flip) {
+    if ((angle != 0 || flip) && !metadata_only()) {
         // Copy to memory evaluates the image, so set up the timeout handler,
         // if necessary.
         utils::setup_timeout_handler(output_image, config_.process_timeout);
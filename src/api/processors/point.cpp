@@ -0,0 +1,175 @@
+#include "point.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace weserv::api::processors {
+
+namespace {
+
+/**
+ * The maximum number of lookup tables that are cached. Only 8-bit lookup
+ * tables are cached, 16-bit lookup tables are 256 times larger and rarely
+ * reused.
+ */
+constexpr size_t MAX_CACHED_LUTS = 64;
+
+/**
+ * A least recently used cache of lookup tables, keyed by the parameters of
+ * the point operations and the layout of the image.
+ */
+class LutCache {
+ public:
+    bool get(const std::string &key, VImage *lut) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+
+        // Move it to the front, since it's the most recently used
+        entries_.splice(entries_.begin(), entries_, it->second);
+        *lut = it->second->second;
+
+        return true;
+    }
+
+    void put(const std::string &key, const VImage &lut) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // It might have been composed in the meantime
+        if (index_.find(key) != index_.end()) {
+            return;
+        }
+
+        entries_.emplace_front(key, lut);
+        index_.emplace(key, entries_.begin());
+
+        if (entries_.size() > MAX_CACHED_LUTS) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+ private:
+    using Entries = std::list<std::pair<std::string, VImage>>;
+
+    std::mutex mutex_;
+    Entries entries_;
+    std::unordered_map<std::string, Entries::iterator> index_;
+};
+
+LutCache &lut_cache() {
+    static LutCache cache;
+    return cache;
+}
+
+/**
+ * Compose a lookup table of the point operations, by applying them to an
+ * identity lookup table with the same layout as the image. This way, mapping
+ * the image through the lookup table yields the same result as applying each
+ * operation to the image in turn.
+ * @param image The image to compose the lookup table for.
+ * @param operations The point operations, in order.
+ * @return A lookup table of a single row.
+ */
+VImage compose_lut(const VImage &image,
+                   const std::vector<const ImageProcessor *> &operations) {
+    bool ushort = image.format() == VIPS_FORMAT_USHORT;
+
+    auto lut = VImage::identity(VImage::option()
+                                    ->set("bands", image.bands())
+                                    ->set("ushort", ushort))
+                   .copy(VImage::option()->set("interpretation",
+                                               image.interpretation()));
+
+    for (const auto *operation : operations) {
+        lut = operation->process(lut);
+    }
+
+    // Evaluate the lookup table once, rather than each time it's used
+    return lut.copy_memory();
+}
+
+/**
+ * Get the lookup table of the point operations, which is composed on the
+ * first use.
+ * @param image The image to get the lookup table for.
+ * @param operations The point operations, in order.
+ * @return A lookup table of a single row.
+ */
+VImage get_lut(const VImage &image,
+               const std::vector<const ImageProcessor *> &operations) {
+    if (image.format() != VIPS_FORMAT_UCHAR) {
+        return compose_lut(image, operations);
+    }
+
+    std::string key = std::to_string(image.bands()) + ':' +
+                      std::to_string(image.interpretation());
+    for (const auto *operation : operations) {
+        key += '&';
+        key += operation->point_parameters();
+    }
+
+    VImage lut;
+    if (!lut_cache().get(key, &lut)) {
+        lut = compose_lut(image, operations);
+        lut_cache().put(key, lut);
+    }
+
+    return lut;
+}
+
+}  // namespace
+
+VImage
+apply_point_operations(const VImage &image,
+                       const std::vector<const ImageProcessor *> &operations) {
+    auto format = image.format();
+    auto interpretation = image.interpretation();
+
+    // Luminance operations are looked up by the 8-bit greyscale image
+    bool luminance = operations.front()->is_luminance_operation();
+    bool supported =
+        luminance ? format == VIPS_FORMAT_UCHAR &&
+                        (interpretation == VIPS_INTERPRETATION_sRGB ||
+                         interpretation == VIPS_INTERPRETATION_B_W)
+                  : format == VIPS_FORMAT_UCHAR || format == VIPS_FORMAT_USHORT;
+
+    if (!supported) {
+        auto output_image = image;
+        for (const auto *operation : operations) {
+            output_image = operation->process(output_image);
+        }
+        return output_image;
+    }
+
+    auto lut = get_lut(image, operations);
+
+    if (!luminance) {
+        return image.maplut(lut);
+    }
+
+    if (image.has_alpha()) {
+        // Separate alpha channel, which is looked up by itself
+        auto image_without_alpha = image.extract_band(
+            0, VImage::option()->set("n", image.bands() - 1));
+        auto alpha = image[image.bands() - 1];
+
+        auto lut_without_alpha =
+            lut.extract_band(0, VImage::option()->set("n", lut.bands() - 1));
+        auto lut_alpha = lut[lut.bands() - 1];
+
+        return image_without_alpha.colourspace(VIPS_INTERPRETATION_B_W)
+            .maplut(lut_without_alpha)
+            .bandjoin(alpha.maplut(lut_alpha));
+    }
+
+    return image.colourspace(VIPS_INTERPRETATION_B_W).maplut(lut);
+}
+
+}  // namespace weserv::api::processors
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "base.h"
+
+#include <vector>
+
+namespace weserv::api::processors {
+
+/**
+ * Apply adjacent point operations at once. 8-bit and 16-bit images are mapped
+ * through a single lookup table that is composed of all operations, other
+ * images are processed by each operation in turn. The lookup tables of 8-bit
+ * images are cached per parameter set.
+ * @note If the first operation only depends on the luminance, the lookup
+ *       table is indexed by the greyscale image (8-bit sRGB images only).
+ * @param image The source image.
+ * @param operations The point operations, in order, see
+ *                   ImageProcessor::is_point_operation().
+ * @return The processed image.
+ */
+VImage
+apply_point_operations(const VImage &image,
+                       const std::vector<const ImageProcessor *> &operations);
+
+}  // namespace weserv::api::processors
@@ -8,6 +8,15 @@ namespace weserv::api::processors {
 
 using parsers::Color;
 
+bool Rotation::is_noop() const {
+    // Only arbitrary angles are valid
+    auto rotation = query_->get_if<int>(
+        "ro", [](int r) { return r % 90 != 0; }, 0);
+
+    // Skip for multi-page images
+    return rotation == 0 || query_->get<int>("n") > 1;
+}
+
 VImage Rotation::process(const VImage &image) const {
     // Only arbitrary angles are valid
     auto rotation = query_->get_if<int>(
@@ -38,6 +47,12 @@ VImage Rotation::process(const VImage &image) const {
             ? image
             : image.bandjoin_const({255});  // Assumes images are always 8-bit
 
+    if (metadata_only()) {
+        return output_image.rotate(
+            static_cast<double>(rotation),
+            VImage::option()->set("background", background_rgba));
+    }
+
     // Copy to memory evaluates the image, so set up the timeout handler,
     // if necessary.
     utils::setup_timeout_handler(output_image, config_.process_timeout);
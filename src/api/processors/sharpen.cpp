@@ -4,6 +4,10 @@
 
 namespace weserv::api::processors {
 
+bool Sharpen::is_noop() const {
+    return query_->get<float>("sharp", 0.0F) == 0.0F;
+}
+
 VImage Sharpen::process(const VImage &image) const {
     // Sigma of gaussian
     auto sigma = query_->get<float>("sharp", 0.0F);
@@ -4,11 +4,13 @@
 
 namespace weserv::api::processors {
 
-class Sharpen : ImageProcessor {
+class Sharpen : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+    bool is_noop() const override;
 };
 
 }  // namespace weserv::api::processors
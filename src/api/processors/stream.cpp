@@ -2,8 +2,8 @@
 
 #include "../exceptions/invalid.h"
 #include "../exceptions/large.h"
-#include "../exceptions/unreadable.h"
 #include "../exceptions/unsupported.h"
+#include "../utils/blurhash.h"
 #include "../utils/utility.h"
 
 #include <algorithm>
@@ -18,23 +18,24 @@ namespace weserv::api::processors {
 using enums::ImageType;
 using enums::Output;
 using parsers::Coordinate;
-using vips::VError;
 
 using io::Source;
 using io::Target;
 
+/**
+ * The maximum width and height of the image from which a placeholder
+ * (`&output=blurhash`) is computed.
+ */
+const int PLACEHOLDER_SIZE = 32;
+
 template <typename Comparator>
 int Stream::resolve_page(const Source &source, const std::string &loader,
                          Comparator comp) const {
-    auto image = new_from_source(source, loader,
-                                 VImage::option()
-                                     ->set("access", VIPS_ACCESS_SEQUENTIAL)
-                                     ->set("fail", config_.fail_on_error == 1)
-                                     ->set("page", 0));
+    // The page geometries are indexed per source, so each page header is
+    // read at most once
+    auto &index = source.page_index(loader, config_.fail_on_error == 1);
 
-    int n_pages = image.get_typeof(VIPS_META_N_PAGES) != 0
-                      ? image.get_int(VIPS_META_N_PAGES)
-                      : 1;
+    int n_pages = index.n_pages(source);
 
     // Limit the number of pages
     if (config_.max_pages > 0 && n_pages > config_.max_pages) {
@@ -44,20 +45,15 @@ int Stream::resolve_page(const Source &source, const std::string &loader,
             std::to_string(config_.max_pages));
     }
 
-    uint64_t size = static_cast<uint64_t>(image.height()) * image.width();
+    auto [width, height] = index.geometry(source, 0);
+    uint64_t size = static_cast<uint64_t>(height) * width;
 
     int target_page = 0;
 
     for (int i = 1; i < n_pages; ++i) {
-        auto image_page =
-            new_from_source(source, loader,
-                            VImage::option()
-                                ->set("access", VIPS_ACCESS_SEQUENTIAL)
-                                ->set("fail", config_.fail_on_error == 1)
-                                ->set("page", i));
+        auto [page_width, page_height] = index.geometry(source, i);
 
-        uint64_t page_size =
-            static_cast<uint64_t>(image_page.height()) * image_page.width();
+        uint64_t page_size = static_cast<uint64_t>(page_height) * page_width;
 
         if (comp(page_size, size)) {
             target_page = i;
@@ -109,29 +105,24 @@ Stream::get_page_load_options(const Source &source,
     return std::pair{n, page};
 }
 
-VImage Stream::new_from_source(const Source &source, const std::string &loader,
-                               vips::VOption *options) const {
-    VImage out_image;
+std::pair<int, int> Stream::placeholder_dimensions(int width, int height) {
+    // Fit within the placeholder size, if no dimensions are given
+    if (width <= 0 && height <= 0) {
+        return std::pair{PLACEHOLDER_SIZE, PLACEHOLDER_SIZE};
+    }
 
-#ifdef WESERV_ENABLE_TRUE_STREAMING
-    try {
-        VImage::call(loader.c_str(),
-                     options->set("source", source)->set("out", &out_image));
-#else
-    // We don't take a copy of the data or free it
-    auto *blob =
-        vips_blob_new(nullptr, source.buffer().data(), source.buffer().size());
-    options = options->set("buffer", blob)->set("out", &out_image);
-    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
-
-    try {
-        VImage::call(loader.c_str(), options);
-#endif
-    } catch (const VError &err) {
-        throw exceptions::UnreadableImageException(err.what());
+    // Scale down proportionally, which retains the aspect ratio of any
+    // cropping or embedding
+    int largest = std::max(width, height);
+    if (largest <= PLACEHOLDER_SIZE) {
+        return std::pair{width, height};
     }
 
-    return out_image;
+    auto scale = [largest](int d) {
+        return d > 0 ? std::max(1, d * PLACEHOLDER_SIZE / largest) : 0;
+    };
+
+    return std::pair{scale(width), scale(height)};
 }
 
 void Stream::resolve_query(const VImage &image) const {
@@ -210,6 +201,14 @@ void Stream::resolve_query(const VImage &image) const {
         std::swap(target_width, target_height);
     }
 
+    // Placeholders are computed from a tiny version of the image, so the most
+    // aggressive shrink-on-load can be used (e.g. a JPEG shrink of 8, the
+    // embedded HEIF thumbnail or the smallest level of a TIFF pyramid)
+    if (query_->get<Output>("output", Output::Origin) == Output::Blurhash) {
+        std::tie(target_width, target_height) =
+            placeholder_dimensions(target_width, target_height);
+    }
+
     // Update the target width and height parameters, a dimension needs to be:
     // d >= 0 && d <= VIPS_MAX_COORD
     query_->update("w", std::clamp(target_width, 0, VIPS_MAX_COORD));
@@ -219,6 +218,30 @@ void Stream::resolve_query(const VImage &image) const {
     // calculations.
     query_->update("input_width", image_width);
     query_->update("input_height", image_height);
+
+    // Resolve the output format, if negotiated
+    if (query_->get<Output>("output", Output::Origin) == Output::Auto) {
+        query_->update("output", static_cast<int>(negotiate_output()));
+    }
+}
+
+Output Stream::negotiate_output() const {
+    auto accepted = query_->get<Output>("accept", Output::Origin) &
+                    static_cast<Output>(config_.savers);
+
+    // AVIF usually results in the smallest images, but libvips can't save
+    // animated AVIF images
+    if ((accepted & Output::Avif) == Output::Avif &&
+        query_->get<int>("n") == 1) {
+        return Output::Avif;
+    }
+
+    if ((accepted & Output::Webp) == Output::Webp) {
+        return Output::Webp;
+    }
+
+    // Fall back to the format of the source image
+    return Output::Origin;
 }
 
 VImage Stream::new_from_source(const Source &source) const {
@@ -245,24 +268,17 @@ VImage Stream::new_from_source(const Source &source) const {
                              ? VIPS_ACCESS_RANDOM
                              : VIPS_ACCESS_SEQUENTIAL;
 
-    vips::VOption *options;
+    vips::VOption *options = nullptr;
     int n = 1;
     int page = 0;
     if (utils::support_multi_pages(image_type)) {
         std::tie(n, page) = get_page_load_options(source, loader);
 
-        options = VImage::option()
-                      ->set("access", access_method)
-                      ->set("fail", config_.fail_on_error == 1)
-                      ->set("n", n)
-                      ->set("page", page);
-    } else {
-        options = VImage::option()
-                      ->set("access", access_method)
-                      ->set("fail", config_.fail_on_error == 1);
+        options = VImage::option()->set("n", n)->set("page", page);
     }
 
-    auto image = new_from_source(source, loader, options);
+    auto image = source.load(loader, access_method,
+                             config_.fail_on_error == 1, options);
 
     // Limit input images to a given number of pixels, where
     // pixels = width * height
@@ -300,6 +316,66 @@ VImage Stream::new_from_source(const Source &source) const {
     return image;
 }
 
+uint64_t Stream::estimate_cost(const VImage &image) const {
+    auto output = query_->get<Output>("output", Output::Origin);
+    if (output == Output::Origin) {
+        output = utils::to_output(
+            query_->get<ImageType>("type", ImageType::Unknown));
+    }
+
+    // The pixels are never evaluated for metadata output
+    if (output == Output::Json) {
+        return 0;
+    }
+
+    // A relative weight of each saver, taking the effort into account
+    uint64_t weight;
+    switch (output) {
+        case Output::Avif:
+            weight = 4 + config_.avif_effort;
+            break;
+        case Output::Webp:
+            weight = 2 + config_.webp_effort / 2;
+            break;
+        case Output::Gif:
+            weight = 2 + config_.gif_effort / 4;
+            break;
+        case Output::Png:
+            weight = 2;
+            break;
+        case Output::Jpeg:
+        case Output::Tiff:
+        default:
+            weight = 1;
+            break;
+    }
+
+    int image_width = image.width();
+    int page_height = utils::get_page_height(image);
+
+    auto n_pages = query_->get<int>("n", 1);
+    auto width = query_->get<int>("w", 0);
+    auto height = query_->get<int>("h", 0);
+
+    // Resolve any missing dimension using the aspect ratio of the image
+    if (width == 0 && height == 0) {
+        width = image_width;
+        height = page_height;
+    } else if (width == 0) {
+        width = static_cast<int>(static_cast<uint64_t>(height) * image_width /
+                                 page_height);
+    } else if (height == 0) {
+        height = static_cast<int>(static_cast<uint64_t>(width) * page_height /
+                                  image_width);
+    }
+
+    uint64_t input_pixels = static_cast<uint64_t>(image_width) * image.height();
+    uint64_t output_pixels =
+        static_cast<uint64_t>(width) * height * std::max(n_pages, 1);
+
+    return input_pixels + output_pixels * weight;
+}
+
 template <>
 void Stream::append_save_options<Output::Jpeg>(vips::VOption *options) const {
     auto quality = query_->get_if<int>(
@@ -452,6 +528,47 @@ void Stream::append_save_options(const Output &output,
     }
 }
 
+std::string Stream::placeholder_to_json(const VImage &image) const {
+    // Only the first page is used for multi-page images
+    auto page_height = utils::get_page_height(image);
+    auto placeholder = page_height < image.height()
+                           ? image.crop(0, 0, image.width(), page_height)
+                           : image;
+
+    placeholder = placeholder.colourspace(VIPS_INTERPRETATION_sRGB);
+
+    // Transparent areas are shown as white
+    if (placeholder.has_alpha()) {
+        placeholder = placeholder.flatten(
+            VImage::option()->set("background", std::vector<double>{255.0}));
+    }
+
+    if (placeholder.format() != VIPS_FORMAT_UCHAR) {
+        placeholder = placeholder.cast(VIPS_FORMAT_UCHAR);
+    }
+
+    // Set up the timeout handler, if necessary
+    utils::setup_timeout_handler(placeholder, config_.process_timeout);
+
+    int width = placeholder.width();
+    int height = placeholder.height();
+
+    size_t size;
+    auto *pixels =
+        static_cast<uint8_t *>(placeholder.write_to_memory(&size));
+
+    // The conventional 4x3 components, transposed for portrait images
+    std::string hash = utils::blurhash_encode(
+        pixels, width, height, placeholder.bands(), width >= height ? 4 : 3,
+        width >= height ? 3 : 4);
+
+    g_free(pixels);
+
+    return R"({"blurhash":")" + hash + R"(","width":)" +
+           std::to_string(width) + R"(,"height":)" + std::to_string(height) +
+           "}";
+}
+
 void Stream::write_to_target(const VImage &image, const Target &target) const {
     // Attaching metadata, need to copy the image
     auto copy = image.copy();
@@ -500,6 +617,10 @@ void Stream::write_to_target(const VImage &image, const Target &target) const {
         output = utils::support_alpha_channel(image_type) || !copy.has_alpha()
                      ? utils::to_output(image_type)
                      : Output::Png;
+
+        // Save the resolved output, so that it can be reported along with
+        // the statistics of the processed image
+        query_->update("output", static_cast<int>(output));
     }
 
     std::string extension = utils::determine_image_extension(output);
@@ -517,6 +638,13 @@ void Stream::write_to_target(const VImage &image, const Target &target) const {
         target.setup(extension);
         target.write(out.c_str(), out.size());
         target.end();
+    } else if (output == Output::Blurhash) {
+        std::string out = placeholder_to_json(copy);
+
+        // The placeholder is returned inline as JSON
+        target.setup(".json");
+        target.write(out.c_str(), out.size());
+        target.end();
     } else {
         // Strip all metadata (EXIF, XMP, IPTC).
         // (all savers supports this option)
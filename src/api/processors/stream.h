@@ -4,6 +4,7 @@
 #include "../io/target.h"
 #include "base.h"
 
+#include <cstdint>
 #include <string>
 
 #include <weserv/config.h>
@@ -20,6 +21,15 @@ class Stream {
 
     void write_to_target(const VImage &image, const io::Target &target) const;
 
+    /**
+     * Estimate the cost of processing an image, based on its input dimensions,
+     * the requested output dimensions and the output format.
+     * @note The query must be resolved, see `new_from_source`.
+     * @param image The source image.
+     * @return The estimated cost, in pixels.
+     */
+    uint64_t estimate_cost(const VImage &image) const;
+
  private:
     /**
      * Query holder.
@@ -56,18 +66,20 @@ class Stream {
                                               const std::string &loader) const;
 
     /**
-     * Load a formatted image from a source.
-     * @note This behaves exactly as `VImage::new_from_source`, but the loader
-     *       can be specified instead of being found automatically.
-     *       It will throw a `UnreadableImageException` if an error occurs
-     *       during loading.
-     * @param source Source to read from.
-     * @param loader Image loader.
-     * @param options Any options to pass on to the load operation.
-     * @return A new `VImage`.
+     * Scale the target dimensions down to the size of a placeholder
+     * (`&output=blurhash`).
+     * @param width Target width, or 0 if not given.
+     * @param height Target height, or 0 if not given.
+     * @return The (width, height) of the placeholder as pair.
      */
-    VImage new_from_source(const io::Source &source, const std::string &loader,
-                           vips::VOption *options) const;
+    static std::pair<int, int> placeholder_dimensions(int width, int height);
+
+    /**
+     * Compute the BlurHash of a placeholder.
+     * @param image The image, shrunk to the size of a placeholder.
+     * @return The BlurHash and the dimensions of the placeholder, as JSON.
+     */
+    std::string placeholder_to_json(const VImage &image) const;
 
     /**
      * Resolve/validate the query parameters based on the given image.
@@ -75,6 +87,15 @@ class Stream {
      */
     void resolve_query(const VImage &image) const;
 
+    /**
+     * Negotiate the output format (`&output=auto`), based on the formats
+     * accepted by the client (`&accept=`) and the enabled savers.
+     * @note The number of pages must be resolved.
+     * @return The smallest acceptable output, or `Output::Origin` if no
+     *         other format than the universally supported ones is accepted.
+     */
+    enums::Output negotiate_output() const;
+
     /**
      * Append the save options for a specified image output.
      * These options will be passed on to the selected save operation.
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <string>
 #include <tuple>
 
@@ -20,6 +21,128 @@ const bool FAST_SHRINK_ON_LOAD = true;
 
 using io::Source;
 
+namespace {
+
+/**
+ * Reads the integers of an EXIF block (i.e. a TIFF structure), in its byte
+ * order.
+ */
+class ExifReader {
+ public:
+    ExifReader(const uint8_t *data, size_t length, bool little_endian)
+        : data_(data), length_(length), little_endian_(little_endian) {}
+
+    bool u16(size_t offset, uint32_t *value) const {
+        if (offset > length_ || length_ - offset < 2) {
+            return false;
+        }
+
+        const uint8_t *p = data_ + offset;
+        *value = little_endian_ ? p[0] | p[1] << 8 : p[0] << 8 | p[1];
+        return true;
+    }
+
+    bool u32(size_t offset, uint32_t *value) const {
+        uint32_t first;
+        uint32_t second;
+        if (!u16(offset, &first) || !u16(offset + 2, &second)) {
+            return false;
+        }
+
+        *value = little_endian_ ? first | second << 16 : first << 16 | second;
+        return true;
+    }
+
+ private:
+    const uint8_t *data_;
+    size_t length_;
+    bool little_endian_;
+};
+
+/**
+ * Find the JPEG thumbnail within an EXIF block, which is described by the
+ * JPEGInterchangeFormat(Length) tags of the second IFD (IFD1).
+ * @param exif The EXIF block, with or without the `Exif\0\0` prefix.
+ * @param length Length of the EXIF block.
+ * @param thumbnail Output, the start of the thumbnail.
+ * @param thumbnail_length Output, the length of the thumbnail.
+ * @return true if a thumbnail was found.
+ */
+bool find_exif_thumbnail(const uint8_t *exif, size_t length,
+                         const uint8_t **thumbnail, size_t *thumbnail_length) {
+    if (length >= 6 && std::equal(exif, exif + 6, "Exif\0\0")) {
+        exif += 6;
+        length -= 6;
+    }
+
+    if (length < 8 || exif[0] != exif[1] ||
+        (exif[0] != 'I' && exif[0] != 'M')) {
+        return false;
+    }
+
+    ExifReader reader(exif, length, exif[0] == 'I');
+
+    uint32_t magic;
+    uint32_t ifd0;
+    uint32_t n_entries;
+    uint32_t ifd1;
+    if (!reader.u16(2, &magic) || magic != 42 || !reader.u32(4, &ifd0) ||
+        !reader.u16(ifd0, &n_entries) ||
+        !reader.u32(ifd0 + 2 + 12 * static_cast<size_t>(n_entries), &ifd1) ||
+        ifd1 == 0 || !reader.u16(ifd1, &n_entries)) {
+        return false;
+    }
+
+    uint32_t compression = 0;
+    uint32_t offset = 0;
+    uint32_t size = 0;
+
+    for (uint32_t i = 0; i < n_entries; ++i) {
+        size_t entry = ifd1 + 2 + 12 * static_cast<size_t>(i);
+
+        uint32_t tag;
+        uint32_t type;
+        if (!reader.u16(entry, &tag) || !reader.u16(entry + 2, &type)) {
+            return false;
+        }
+
+        // Values of up to 4 bytes are stored within the entry itself, either
+        // as SHORT (3) or LONG (4)
+        uint32_t value;
+        if (!(type == 3 ? reader.u16(entry + 8, &value)
+                        : reader.u32(entry + 8, &value))) {
+            return false;
+        }
+
+        switch (tag) {
+            case 0x0103:  // Compression
+                compression = value;
+                break;
+            case 0x0201:  // JPEGInterchangeFormat
+                offset = value;
+                break;
+            case 0x0202:  // JPEGInterchangeFormatLength
+                size = value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Only JPEG compressed (6) thumbnails, which start with a SOI marker
+    if (compression != 6 || offset == 0 || size < 2 || offset > length ||
+        length - offset < size || exif[offset] != 0xFF ||
+        exif[offset + 1] != 0xD8) {
+        return false;
+    }
+
+    *thumbnail = exif + offset;
+    *thumbnail_length = size;
+    return true;
+}
+
+}  // namespace
+
 template <>
 VImage
 Thumbnail::new_from_source<ImageType::Jpeg>(const Source &source,
@@ -241,17 +364,20 @@ int Thumbnail::resolve_tiff_pyramid(const VImage &image, const Source &source,
         return -1;
     }
 
+    // Page headers that have already been read (e.g. for `&page=-1`) are
+    // reused from the page index of the source
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    auto &index =
+        source.page_index("tiffload_source", config_.fail_on_error == 1);
+#else
+    auto &index =
+        source.page_index("tiffload_buffer", config_.fail_on_error == 1);
+#endif
+
     int target_page = -1;
 
     for (int i = n_pages - 1; i >= 0; i--) {
-        auto page = new_from_source<ImageType::Tiff>(
-            source, VImage::option()
-                        ->set("access", VIPS_ACCESS_SEQUENTIAL)
-                        ->set("fail", config_.fail_on_error == 1)
-                        ->set("page", i));
-
-        int level_width = page.width();
-        int level_height = page.height();
+        auto [level_width, level_height] = index.geometry(source, i);
 
         // Try to sanity-check the size of the pages. Do they look
         // like a pyramid?
@@ -277,6 +403,115 @@ int Thumbnail::resolve_tiff_pyramid(const VImage &image, const Source &source,
     return target_page;
 }
 
+int Thumbnail::resolve_tiff_subifd(const Source &source, int width,
+                                   int height) const {
+#ifdef WESERV_ENABLE_TRUE_STREAMING
+    auto &index =
+        source.page_index("tiffload_source", config_.fail_on_error == 1);
+#else
+    auto &index =
+        source.page_index("tiffload_buffer", config_.fail_on_error == 1);
+#endif
+
+    const auto &levels = index.subifds(source, query_->get<int>("page", 0));
+
+    // Don't bother with more levels than fit in an int
+    if (levels.empty() || levels.size() > 30) {
+        return -1;
+    }
+
+    int target_level = -1;
+
+    for (int i = static_cast<int>(levels.size()) - 1; i >= 0; i--) {
+        auto [level_width, level_height] = levels[i];
+
+        // SubIFD 0 is the first level below the page itself
+        int expected_level_width = width / (2 << i);
+        int expected_level_height = height / (2 << i);
+
+        // Won't be exact due to rounding etc.
+        if (std::abs(level_width - expected_level_width) > 5 ||
+            std::abs(level_height - expected_level_height) > 5 ||
+            level_width < 2 || level_height < 2) {
+            return -1;
+        }
+
+        if (target_level == -1 &&
+            resolve_common_shrink(level_width, level_height) >= 1.0) {
+            target_level = i;
+        }
+    }
+
+    return target_level;
+}
+
+bool Thumbnail::load_exif_thumbnail(const VImage &image, VImage *thumb) const {
+    if (image.get_typeof(VIPS_META_EXIF_NAME) == 0) {
+        return false;
+    }
+
+    size_t length;
+    const auto *exif = static_cast<const uint8_t *>(
+        image.get_blob(VIPS_META_EXIF_NAME, &length));
+
+    const uint8_t *thumbnail;
+    size_t thumbnail_length;
+    if (!find_exif_thumbnail(exif, length, &thumbnail, &thumbnail_length)) {
+        return false;
+    }
+
+    try {
+        // The EXIF block is owned by the source image, so take a copy
+        auto *blob = vips_blob_copy(thumbnail, thumbnail_length);
+        *thumb = VImage::jpegload_buffer(
+            blob, VImage::option()
+                      ->set("access", VIPS_ACCESS_SEQUENTIAL)
+                      ->set("fail", config_.fail_on_error == 1));
+        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+    } catch (const vips::VError &) {
+        // Ignore corrupt thumbnails
+        vips_error_clear();
+        return false;
+    }
+
+    int width = image.width();
+    int height = image.height();
+    int thumb_width = thumb->width();
+    int thumb_height = thumb->height();
+
+    // The thumbnail must be a smaller version of the image. This rejects
+    // letterboxed thumbnails (e.g. 160x120 for a 3:2 image) and thumbnails
+    // stored in a different orientation. Won't be exact due to rounding
+    auto expected_height = static_cast<int>(std::lround(
+        static_cast<double>(height) * thumb_width / width));
+    if (thumb_width >= width || std::abs(thumb_height - expected_height) > 1 ||
+        thumb->bands() != image.bands() ||
+        thumb->interpretation() != image.interpretation()) {
+        return false;
+    }
+
+    // Use the thumbnail if, by using it, we could get a factor > 1.0,
+    // i.e. we would not need to expand the thumbnail (see the HEIF
+    // thumbnail below)
+    if (resolve_common_shrink(thumb_width, thumb_height) <= 1.0) {
+        return false;
+    }
+
+    // Thumbnails don't carry an ICC profile, but share that of the image
+    if (utils::has_profile(image)) {
+        size_t profile_length;
+        const void *profile =
+            image.get_blob(VIPS_META_ICC_NAME, &profile_length);
+
+        // Attaching metadata, need to copy the image
+        *thumb = thumb->copy();
+        vips_image_set_blob_copy(thumb->get_image(), VIPS_META_ICC_NAME,
+                                 profile, profile_length);
+    }
+
+    return true;
+}
+
 // TODO(kleisauke): Support whole-slide images(?)
 /*int Thumbnail::resolve_open_slide_level(const VImage &image) const {
     int level_count = 1;
@@ -336,6 +571,14 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
         return image;
     }
 
+    // Use the thumbnail embedded within the EXIF metadata, if enabled. The
+    // metadata of the image itself is needed for `&output=json`
+    VImage thumb;
+    if (config_.exif_thumbnail == 1 && !metadata_only() &&
+        query_->get<int>("n") == 1 && load_exif_thumbnail(image, &thumb)) {
+        return thumb;
+    }
+
     int width = image.width();
     int height = image.height();
 
@@ -377,6 +620,20 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
             return new_from_source<ImageType::Tiff>(
                 source, load_options->set("page", page));
         }
+
+#if VIPS_VERSION_AT_LEAST(8, 10, 0)
+        // The pyramid may also be stored within the SubIFDs of the page
+        auto level = query_->get<int>("n") == 1
+                         ? resolve_tiff_subifd(source, width, height)
+                         : -1;
+
+        if (level != -1) {
+            append_page_options(load_options);
+
+            return new_from_source<ImageType::Tiff>(
+                source, load_options->set("subifd", level));
+        }
+#endif
     /*} else if (image_type == ImageType::OpenSlide) {
         auto level = resolve_open_slide_level(image);
 
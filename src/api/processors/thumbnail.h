@@ -5,7 +5,7 @@
 
 namespace weserv::api::processors {
 
-class Thumbnail : ImageProcessor {
+class Thumbnail : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
@@ -69,6 +69,17 @@ class Thumbnail : ImageProcessor {
     int resolve_tiff_pyramid(const VImage &image, const io::Source &source,
                              int width, int height) const;
 
+    /**
+     * Find the SubIFD pyramid level, if the page is a pyramid stored in its
+     * SubIFDs. The levels are expected to follow roughly /2 shrinks.
+     * @param source Source to read from.
+     * @param width Input width.
+     * @param height Input height.
+     * @return The SubIFD to load, or -1 if there's no suitable level.
+     */
+    int resolve_tiff_subifd(const io::Source &source, int width,
+                            int height) const;
+
     /**
      * Find the best openslide level.
      * @param image The source image.
@@ -76,6 +87,17 @@ class Thumbnail : ImageProcessor {
      */
     /*int resolve_open_slide_level(const VImage &image) const;*/
 
+    /**
+     * Load the JPEG thumbnail embedded within the EXIF metadata of an image,
+     * if it covers the requested size and it's a smaller version of the
+     * image, i.e. it has the same aspect ratio (and thus orientation) and
+     * color space.
+     * @param image The source image.
+     * @param thumb Output, the thumbnail.
+     * @return true if the thumbnail can be used instead of the image.
+     */
+    bool load_exif_thumbnail(const VImage &image, VImage *thumb) const;
+
     /**
      * Append which page and the amount of pages we need to render for loaders
      * that support this.
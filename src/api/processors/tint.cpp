@@ -1,11 +1,21 @@
 #include "tint.h"
 
+#include <string>
 #include <vector>
 
 namespace weserv::api::processors {
 
 using parsers::Color;
 
+bool Tint::is_noop() const {
+    // The tint is completely transparent
+    return query_->get<Color>("tint", Color::DEFAULT).is_transparent();
+}
+
+std::string Tint::point_parameters() const {
+    return "tint=" + query_->get<Color>("tint", Color::DEFAULT).to_hex();
+}
+
 VImage Tint::process(const VImage &image) const {
     auto tint = query_->get<Color>("tint", Color::DEFAULT);
 
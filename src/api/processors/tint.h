@@ -2,13 +2,30 @@
 
 #include "base.h"
 
+#include <string>
+
 namespace weserv::api::processors {
 
-class Tint : ImageProcessor {
+class Tint : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+    bool is_noop() const override;
+
+    bool is_point_operation() const override {
+        return true;
+    }
+
+    /**
+     * The tinted image only depends on the luminance of the original.
+     */
+    bool is_luminance_operation() const override {
+        return true;
+    }
+
+    std::string point_parameters() const override;
 };
 
 }  // namespace weserv::api::processors
@@ -14,8 +14,11 @@ VImage Trim::process(const VImage &image) const {
         },
         0);
 
-    // Make sure that trimming is required
-    if (threshold == 0 || image.width() < 3 || image.height() < 3) {
+    // Make sure that trimming is required. The trim area depends on the
+    // pixel values, so metadata output reports the untrimmed dimensions
+    // instead of evaluating the image.
+    if (threshold == 0 || image.width() < 3 || image.height() < 3 ||
+        metadata_only()) {
         // We could use shrink-on-load for the next thumbnail processor
         query_->update("trim", false);
 
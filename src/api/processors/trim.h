@@ -4,7 +4,7 @@
 
 namespace weserv::api::processors {
 
-class Trim : ImageProcessor {
+class Trim : public ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
@@ -0,0 +1,158 @@
+#include "blurhash.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+namespace weserv::api::utils {
+
+namespace {
+
+/**
+ * The base 83 alphabet of a BlurHash.
+ */
+constexpr char BASE83_CHARS[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+    "#$%*+,-.:;=?@[]^_{|}~";
+
+using Color = std::array<double, 3>;
+
+void encode_base83(int value, int length, std::string *out) {
+    int divisor = 1;
+    for (int i = 1; i < length; ++i) {
+        divisor *= 83;
+    }
+
+    for (; divisor > 0; divisor /= 83) {
+        out->push_back(BASE83_CHARS[(value / divisor) % 83]);
+    }
+}
+
+double srgb_to_linear(uint8_t value) {
+    double v = value / 255.0;
+    return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+}
+
+int linear_to_srgb(double value) {
+    double v = std::clamp(value, 0.0, 1.0);
+    return v <= 0.0031308
+               ? static_cast<int>(v * 12.92 * 255 + 0.5)
+               : static_cast<int>((1.055 * std::pow(v, 1 / 2.4) - 0.055) * 255 +
+                                  0.5);
+}
+
+double sign_pow(double value, double exp) {
+    return std::copysign(std::pow(std::abs(value), exp), value);
+}
+
+}  // namespace
+
+std::string blurhash_encode(const uint8_t *pixels, int width, int height,
+                            int bands, int x_components, int y_components) {
+    x_components = std::clamp(x_components, 1, 9);
+    y_components = std::clamp(y_components, 1, 9);
+
+    // The sRGB to linear conversion of each possible value
+    std::array<double, 256> linear{};
+    for (size_t i = 0; i < linear.size(); ++i) {
+        linear[i] = srgb_to_linear(static_cast<uint8_t>(i));
+    }
+
+    // The cosines of each component, per column and row
+    std::vector<double> x_cosines(static_cast<size_t>(x_components) * width);
+    for (int i = 0; i < x_components; ++i) {
+        for (int x = 0; x < width; ++x) {
+            x_cosines[static_cast<size_t>(i) * width + x] =
+                std::cos(M_PI * i * x / width);
+        }
+    }
+
+    std::vector<double> y_cosines(static_cast<size_t>(y_components) * height);
+    for (int j = 0; j < y_components; ++j) {
+        for (int y = 0; y < height; ++y) {
+            y_cosines[static_cast<size_t>(j) * height + y] =
+                std::cos(M_PI * j * y / height);
+        }
+    }
+
+    // The DCT factors, the first one is the average (DC) color
+    std::vector<Color> factors(static_cast<size_t>(x_components) *
+                               y_components);
+    for (int j = 0; j < y_components; ++j) {
+        for (int i = 0; i < x_components; ++i) {
+            const double *x_cosine = &x_cosines[static_cast<size_t>(i) * width];
+            const double *y_cosine =
+                &y_cosines[static_cast<size_t>(j) * height];
+
+            Color factor{};
+
+            for (int y = 0; y < height; ++y) {
+                const uint8_t *pixel =
+                    pixels + static_cast<size_t>(y) * width * bands;
+
+                for (int x = 0; x < width; ++x, pixel += bands) {
+                    double basis = x_cosine[x] * y_cosine[y];
+
+                    factor[0] += basis * linear[pixel[0]];
+                    factor[1] += basis * linear[pixel[1]];
+                    factor[2] += basis * linear[pixel[2]];
+                }
+            }
+
+            double scale = (i == 0 && j == 0 ? 1.0 : 2.0) /
+                           (static_cast<double>(width) * height);
+            for (auto &component : factor) {
+                component *= scale;
+            }
+
+            factors[static_cast<size_t>(j) * x_components + i] = factor;
+        }
+    }
+
+    std::string hash;
+    hash.reserve(4 + 2 * factors.size());
+
+    encode_base83((x_components - 1) + (y_components - 1) * 9, 1, &hash);
+
+    // The AC components are quantized relative to the largest of them
+    double maximum_value = 1.0;
+    if (factors.size() > 1) {
+        double actual_maximum = 0.0;
+        for (size_t k = 1; k < factors.size(); ++k) {
+            for (double component : factors[k]) {
+                actual_maximum = std::max(actual_maximum, std::abs(component));
+            }
+        }
+
+        int quantized_maximum = std::clamp(
+            static_cast<int>(std::floor(actual_maximum * 166 - 0.5)), 0, 82);
+        maximum_value = (quantized_maximum + 1) / 166.0;
+
+        encode_base83(quantized_maximum, 1, &hash);
+    } else {
+        encode_base83(0, 1, &hash);
+    }
+
+    const Color &dc = factors[0];
+    encode_base83((linear_to_srgb(dc[0]) << 16) + (linear_to_srgb(dc[1]) << 8) +
+                      linear_to_srgb(dc[2]),
+                  4, &hash);
+
+    for (size_t k = 1; k < factors.size(); ++k) {
+        int value = 0;
+        for (double component : factors[k]) {
+            int quantized = std::clamp(
+                static_cast<int>(std::floor(
+                    sign_pow(component / maximum_value, 0.5) * 9 + 9.5)),
+                0, 18);
+            value = value * 19 + quantized;
+        }
+
+        encode_base83(value, 2, &hash);
+    }
+
+    return hash;
+}
+
+}  // namespace weserv::api::utils
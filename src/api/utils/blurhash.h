@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace weserv::api::utils {
+
+/**
+ * Encode an image into a BlurHash, a compact string representation of a
+ * blurred placeholder of the image.
+ * See: https://github.com/woltapp/blurhash/blob/master/Algorithm.md
+ * @note The encoding cost is proportional to the number of pixels, so the
+ *       image should be shrunk to a few dozen pixels beforehand.
+ * @param pixels The interleaved 8-bit sRGB pixels of the image, any bands
+ *               following the first three are ignored.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param bands Number of bands of the image, at least 3.
+ * @param x_components Number of horizontal components, 1 - 9.
+ * @param y_components Number of vertical components, 1 - 9.
+ * @return The BlurHash.
+ */
+std::string blurhash_encode(const uint8_t *pixels, int width, int height,
+                            int bands, int x_components, int y_components);
+
+}  // namespace weserv::api::utils
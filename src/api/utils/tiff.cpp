@@ -0,0 +1,248 @@
+#include "tiff.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace weserv::api::utils {
+
+namespace {
+
+/**
+ * The maximum number of directories to read, this matches the maximum page
+ * that can be requested (`&page=`).
+ */
+constexpr size_t MAX_DIRECTORIES = 100001;
+
+/**
+ * The tags that are read from each directory.
+ */
+constexpr uint32_t TAG_IMAGE_WIDTH = 0x0100;
+constexpr uint32_t TAG_IMAGE_LENGTH = 0x0101;
+constexpr uint32_t TAG_SUBIFDS = 0x014A;
+
+/**
+ * The field types that can hold a dimension or an offset.
+ */
+constexpr uint32_t TYPE_SHORT = 3;
+constexpr uint32_t TYPE_LONG = 4;
+constexpr uint32_t TYPE_IFD = 13;
+constexpr uint32_t TYPE_LONG8 = 16;
+constexpr uint32_t TYPE_IFD8 = 18;
+
+/**
+ * The maximum number of entries of a directory. The count of a classic TIFF
+ * directory is a 16-bit integer, which BigTIFF directories are held to as
+ * well.
+ */
+constexpr uint64_t MAX_ENTRIES = 65535;
+
+class TiffReader {
+ public:
+    explicit TiffReader(const TiffReadFn &read) : read_(read) {}
+
+    /**
+     * Read the header.
+     * @param first_ifd Output, the offset of the first directory.
+     * @return false if this isn't a TIFF image.
+     */
+    bool header(uint64_t *first_ifd) {
+        uint8_t header[16];
+        if (!read_(0, header, 8) || header[0] != header[1] ||
+            (header[0] != 'I' && header[0] != 'M')) {
+            return false;
+        }
+
+        little_endian_ = header[0] == 'I';
+
+        uint64_t version = decode(header + 2, 2);
+        if (version == 42) {
+            big_tiff_ = false;
+            *first_ifd = decode(header + 4, 4);
+            return true;
+        }
+
+        // BigTIFF uses 8-byte offsets
+        big_tiff_ = true;
+        if (version != 43 || decode(header + 4, 2) != 8 ||
+            !read_(8, header + 8, 8)) {
+            return false;
+        }
+
+        *first_ifd = decode(header + 8, 8);
+        return true;
+    }
+
+    /**
+     * Read a directory.
+     * @param offset Offset of the directory.
+     * @param directory Output, the dimensions of the directory.
+     * @param subifds Output, the offsets of its SubIFDs.
+     * @param next Output, the offset of the next directory, or 0 if none.
+     * @return false if the directory is invalid.
+     */
+    bool directory(uint64_t offset, TiffDirectory *directory,
+                   std::vector<uint64_t> *subifds, uint64_t *next) const {
+        size_t count_size = big_tiff_ ? 8 : 2;
+        size_t entry_size = big_tiff_ ? 20 : 12;
+        size_t offset_size = big_tiff_ ? 8 : 4;
+
+        uint64_t n_entries;
+        if (!read(offset, count_size, &n_entries) || n_entries > MAX_ENTRIES) {
+            return false;
+        }
+
+        // Read the entries and the offset of the next directory at once
+        std::vector<uint8_t> entries(n_entries * entry_size + offset_size);
+        if (!read_(offset + count_size, entries.data(), entries.size())) {
+            return false;
+        }
+
+        uint64_t width = 0;
+        uint64_t height = 0;
+
+        for (uint64_t i = 0; i < n_entries; ++i) {
+            const uint8_t *entry = &entries[i * entry_size];
+
+            uint64_t tag = decode(entry, 2);
+            uint64_t type = decode(entry + 2, 2);
+            uint64_t count = decode(entry + 4, offset_size);
+
+            const uint8_t *value = entry + 4 + offset_size;
+
+            if (tag == TAG_IMAGE_WIDTH || tag == TAG_IMAGE_LENGTH) {
+                size_t size = type == TYPE_SHORT   ? 2
+                              : type == TYPE_LONG8 ? 8
+                                                   : 4;
+
+                // Only BigTIFF can store a LONG8 within the entry
+                if (size > offset_size) {
+                    return false;
+                }
+
+                (tag == TAG_IMAGE_WIDTH ? width : height) = decode(value, size);
+            } else if (tag == TAG_SUBIFDS && subifds != nullptr) {
+                size_t size =
+                    type == TYPE_LONG8 || type == TYPE_IFD8 ? 8 : 4;
+                if ((type != TYPE_LONG && type != TYPE_IFD && size == 4) ||
+                    count > MAX_DIRECTORIES) {
+                    continue;
+                }
+
+                std::vector<uint8_t> array(count * size);
+
+                // The offsets are stored within the entry, if they fit
+                if (array.size() <= offset_size) {
+                    std::copy(value, value + array.size(), array.begin());
+                } else if (!read_(decode(value, offset_size), array.data(),
+                                  array.size())) {
+                    return false;
+                }
+
+                for (uint64_t j = 0; j < count; ++j) {
+                    subifds->push_back(decode(&array[j * size], size));
+                }
+            }
+        }
+
+        // A dimension needs to be in the range of 1 - VIPS_MAX_COORD
+        if (width == 0 || height == 0 || width > 10000000 ||
+            height > 10000000) {
+            return false;
+        }
+
+        directory->width = static_cast<int>(width);
+        directory->height = static_cast<int>(height);
+
+        *next = decode(&entries[n_entries * entry_size], offset_size);
+        return true;
+    }
+
+ private:
+    const TiffReadFn &read_;
+    bool little_endian_ = false;
+    bool big_tiff_ = false;
+
+    /**
+     * Decode an unsigned integer in the byte order of the image.
+     */
+    uint64_t decode(const uint8_t *p, size_t size) const {
+        uint64_t result = 0;
+        for (size_t i = 0; i < size; ++i) {
+            result |= static_cast<uint64_t>(p[i])
+                      << (8 * (little_endian_ ? i : size - 1 - i));
+        }
+
+        return result;
+    }
+
+    bool read(uint64_t offset, size_t size, uint64_t *value) const {
+        uint8_t buffer[8];
+        if (!read_(offset, buffer, size)) {
+            return false;
+        }
+
+        *value = decode(buffer, size);
+        return true;
+    }
+};
+
+}  // namespace
+
+bool read_tiff_directories(const TiffReadFn &read,
+                           std::vector<TiffDirectory> *directories) {
+    TiffReader reader(read);
+
+    uint64_t offset;
+    if (!reader.header(&offset)) {
+        return false;
+    }
+
+    // Guard against directories that refer back to each other
+    std::unordered_set<uint64_t> visited;
+
+    std::vector<TiffDirectory> result;
+    while (offset != 0) {
+        if (result.size() == MAX_DIRECTORIES ||
+            !visited.insert(offset).second) {
+            return false;
+        }
+
+        TiffDirectory directory{};
+        std::vector<uint64_t> subifds;
+        if (!reader.directory(offset, &directory, &subifds, &offset)) {
+            return false;
+        }
+
+        for (uint64_t subifd : subifds) {
+            TiffDirectory level{};
+            uint64_t next;
+            if (!visited.insert(subifd).second ||
+                !reader.directory(subifd, &level, nullptr, &next)) {
+                return false;
+            }
+
+            directory.subifds.emplace_back(level.width, level.height);
+        }
+
+        result.push_back(std::move(directory));
+    }
+
+    *directories = std::move(result);
+    return true;
+}
+
+bool read_tiff_directories(const uint8_t *data, size_t length,
+                           std::vector<TiffDirectory> *directories) {
+    return read_tiff_directories(
+        [data, length](uint64_t offset, uint8_t *out, size_t size) {
+            if (offset > length || length - offset < size) {
+                return false;
+            }
+
+            std::copy(data + offset, data + offset + size, out);
+            return true;
+        },
+        directories);
+}
+
+}  // namespace weserv::api::utils
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace weserv::api::utils {
+
+/**
+ * The dimensions of an image file directory (IFD) of a TIFF image.
+ */
+struct TiffDirectory {
+    int width;
+    int height;
+
+    /**
+     * The dimensions of the SubIFDs of this directory, e.g. the levels of a
+     * SubIFD-based pyramid.
+     */
+    std::vector<std::pair<int, int>> subifds;
+};
+
+/**
+ * Reads a range of bytes of a TIFF image.
+ * @param offset Offset of the range.
+ * @param data Output, the bytes read.
+ * @param size Number of bytes to read.
+ * @return false if the range couldn't be read in its entirety.
+ */
+using TiffReadFn =
+    std::function<bool(uint64_t offset, uint8_t *data, size_t size)>;
+
+/**
+ * Read the dimensions of all directories of a TIFF image (classic or
+ * BigTIFF) in a single pass, without decoding any of them. Only the
+ * directories themselves are visited, so this takes microseconds even for
+ * images with many pages.
+ * @param read Reads a range of bytes of the TIFF image.
+ * @param directories Output, the top-level directories (i.e. the pages).
+ * @return false if the TIFF structure is invalid.
+ */
+bool read_tiff_directories(const TiffReadFn &read,
+                           std::vector<TiffDirectory> *directories);
+
+/**
+ * Read the dimensions of all directories of a TIFF image held in memory.
+ * @param data The TIFF image.
+ * @param length Length of the TIFF image.
+ * @param directories Output, the top-level directories (i.e. the pages).
+ * @return false if the TIFF structure is invalid.
+ */
+bool read_tiff_directories(const uint8_t *data, size_t length,
+                           std::vector<TiffDirectory> *directories);
+
+}  // namespace weserv::api::utils
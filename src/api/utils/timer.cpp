@@ -0,0 +1,131 @@
+#include "timer.h"
+
+#include "utility.h"
+
+#include <cstring>
+#include <pthread.h>
+
+namespace weserv::api::utils {
+
+using vips::VError;
+using vips::VImage;
+
+namespace {
+
+/**
+ * The state of a worker thread that evaluates an image.
+ */
+struct EvaluateThread {
+    pthread_t thread;
+
+    /**
+     * CPU time of the thread when it was last accounted.
+     */
+    int64_t cpu_time;
+};
+
+void *evaluate_start(VipsImage * /* unused */, void * /* unused */,
+                     void * /* unused */) {
+    return new EvaluateThread{pthread_self(), thread_cpu_time()};
+}
+
+int evaluate_generate(VipsRegion *region, void *seq, void *a, void *b,
+                      gboolean * /* unused */) {
+    auto *memory = static_cast<VipsImage *>(a);
+    auto *worker_cpu = static_cast<std::atomic<int64_t> *>(b);
+    auto *thread = static_cast<EvaluateThread *>(seq);
+
+    VipsRect *rect = &region->valid;
+    size_t line_size = VIPS_IMAGE_SIZEOF_PEL(memory) * rect->width;
+
+    for (int y = rect->top; y < VIPS_RECT_BOTTOM(rect); ++y) {
+        std::memcpy(VIPS_IMAGE_ADDR(memory, rect->left, y),
+                    VIPS_REGION_ADDR(region, rect->left, y), line_size);
+    }
+
+    // Account the CPU time spent on computing this region (and any region
+    // before it) on this thread
+    int64_t now = thread_cpu_time();
+    if (pthread_equal(thread->thread, pthread_self()) != 0) {
+        *worker_cpu += now - thread->cpu_time;
+    } else {
+        thread->thread = pthread_self();
+    }
+    thread->cpu_time = now;
+
+    return 0;
+}
+
+int evaluate_stop(void *seq, void * /* unused */, void * /* unused */) {
+    delete static_cast<EvaluateThread *>(seq);
+
+    return 0;
+}
+
+}  // namespace
+
+int64_t thread_cpu_time() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void StageTimer::next(const char *name) {
+    if (!enabled_) {
+        return;
+    }
+
+    stop();
+
+    name_ = name;
+    wall_start_ = std::chrono::steady_clock::now();
+    cpu_start_ = thread_cpu_time();
+    worker_cpu_ = 0;
+}
+
+void StageTimer::stop() {
+    if (name_ == nullptr) {
+        return;
+    }
+
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - wall_start_)
+                    .count();
+    int64_t cpu = thread_cpu_time() - cpu_start_ + worker_cpu_;
+
+    stages_.push_back({name_, static_cast<int64_t>(wall), cpu});
+    name_ = nullptr;
+}
+
+VImage StageTimer::evaluate(const VImage &image,
+                            time_t process_timeout) const {
+    if (!enabled_) {
+        return image;
+    }
+
+    VipsImage *memory = vips_image_new_memory();
+
+    if (vips_image_pipelinev(memory, VIPS_DEMAND_STYLE_ANY, image.get_image(),
+                             nullptr) != 0 ||
+        vips_image_write_prepare(memory) != 0) {
+        g_object_unref(memory);
+        throw VError();
+    }
+
+    // Takes ownership of the memory image
+    VImage out(memory);
+
+    // Evaluating the image may take a while, so set up the timeout handler,
+    // if necessary
+    setup_timeout_handler(image, process_timeout);
+
+    if (vips_sink(image.get_image(), evaluate_start, evaluate_generate,
+                  evaluate_stop, memory, &worker_cpu_) != 0) {
+        throw VError();
+    }
+
+    return out;
+}
+
+}  // namespace weserv::api::utils
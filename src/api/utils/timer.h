@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+#include <vips/vips8>
+#include <weserv/env_interface.h>
+
+namespace weserv::api::utils {
+
+/**
+ * @return The CPU time consumed by the calling thread, in microseconds.
+ */
+int64_t thread_cpu_time();
+
+/**
+ * Measures the wall-clock and CPU time of consecutive pipeline stages.
+ * libvips evaluates images lazily, so each stage needs to be evaluated with
+ * `evaluate` to attribute its work to it. The CPU time is accounted per
+ * thread: that of the calling thread, plus that of the libvips worker threads
+ * while they evaluate an image for this timer.
+ */
+class StageTimer {
+ public:
+    explicit StageTimer(bool enabled) : enabled_(enabled) {}
+
+    /**
+     * @return true if the stages are timed.
+     */
+    bool enabled() const {
+        return enabled_;
+    }
+
+    /**
+     * Finish the current stage, if any, and start a new one.
+     * @param name Name of the new stage, must outlive this timer.
+     */
+    void next(const char *name);
+
+    /**
+     * Finish the current stage, if any.
+     */
+    void stop();
+
+    /**
+     * Evaluate an image into memory, so that the work done so far is
+     * attributed to the current stage instead of to a later one.
+     * @note This is a no-op if the stages are not timed.
+     * @param image The image to evaluate.
+     * @param process_timeout Maximum allowed time for the evaluation.
+     * @return The evaluated image.
+     */
+    vips::VImage evaluate(const vips::VImage &image,
+                          time_t process_timeout) const;
+
+    /**
+     * @return The timings of the finished stages, in order.
+     */
+    const std::vector<StageTiming> &stages() const {
+        return stages_;
+    }
+
+ private:
+    const bool enabled_;
+
+    const char *name_ = nullptr;
+
+    std::chrono::steady_clock::time_point wall_start_;
+
+    int64_t cpu_start_ = 0;
+
+    /**
+     * CPU time of the libvips worker threads during the current stage.
+     */
+    mutable std::atomic<int64_t> worker_cpu_{0};
+
+    std::vector<StageTiming> stages_;
+};
+
+}  // namespace weserv::api::utils
@@ -126,6 +126,8 @@ inline std::string determine_image_extension(const Output &output) {
             return ".gif";
         case Output::Json:
             return ".json";
+        case Output::Blurhash:
+            return ".blurhash";
         case Output::Png:
         default:
             return ".png";
@@ -140,9 +142,9 @@ inline std::string determine_image_extension(const Output &output) {
 inline std::string supported_savers_string(const uintptr_t msk) {
     std::string result;
 
-    for (int i = 1; i <= 7; ++i) {
+    for (int i = 1; i <= 9; ++i) {
         uintptr_t output = 1U << i;
-        if ((msk & output) != 0) {
+        if ((msk & output & static_cast<uintptr_t>(Output::All)) != 0) {
             std::string saver =
                 determine_image_extension(static_cast<Output>(output))
                     .substr(1);
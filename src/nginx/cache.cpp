@@ -0,0 +1,626 @@
+#include "cache.h"
+
+#include "module.h"
+
+namespace weserv::nginx {
+
+/**
+ * The maximum length of an image extension that can be stored (e.g. "webp").
+ */
+#define NGX_WESERV_CACHE_EXTENSION_LEN 8
+
+/**
+ * A cached image within the shared memory zone.
+ * Reference: ngx_http_file_cache_node_t
+ */
+struct ngx_weserv_cache_node_t {
+    ngx_rbtree_node_t node;
+    ngx_queue_t queue;
+
+    /**
+     * The remainder of the cache key, the first bytes are stored in node.key.
+     */
+    u_char key[NGX_WESERV_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t)];
+
+    u_char extension[NGX_WESERV_CACHE_EXTENSION_LEN];
+    size_t extension_len;
+
+    /**
+     * Last time this entry was accessed, used to expire inactive entries.
+     */
+    time_t accessed;
+
+    /**
+     * The number of requests that are copying the image, outside the lock.
+     * Reference: ngx_http_file_cache_node_t::count
+     */
+    ngx_uint_t count;
+
+    /**
+     * Whether this entry was removed from the cache while it was still
+     * pinned, its memory is freed once the last request unpins it.
+     */
+    unsigned deleted:1;
+
+    /**
+     * The processed image.
+     */
+    u_char *data;
+    size_t size;
+};
+
+/**
+ * Shared state of a cache zone.
+ */
+struct ngx_weserv_cache_sh_t {
+    ngx_rbtree_t rbtree;
+    ngx_rbtree_node_t sentinel;
+
+    /**
+     * Least recently used entries are at the tail of this queue.
+     */
+    ngx_queue_t queue;
+};
+
+/**
+ * Cache zone configuration.
+ */
+struct ngx_weserv_cache_t {
+    ngx_weserv_cache_sh_t *sh;
+    ngx_slab_pool_t *shpool;
+
+    /**
+     * Entries that are not accessed during this time are removed.
+     */
+    time_t inactive;
+
+    /**
+     * Images larger than this are not cached.
+     */
+    size_t max_entry_size;
+};
+
+namespace {
+
+/**
+ * Reference: ngx_http_file_cache_rbtree_insert_value
+ */
+void ngx_weserv_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+                                          ngx_rbtree_node_t *node,
+                                          ngx_rbtree_node_t *sentinel) {
+    ngx_rbtree_node_t **p;
+
+    for (;;) {
+        if (node->key < temp->key) {
+            p = &temp->left;
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+        } else { /* node->key == temp->key */
+            auto *cn = reinterpret_cast<ngx_weserv_cache_node_t *>(node);
+            auto *cnt = reinterpret_cast<ngx_weserv_cache_node_t *>(temp);
+
+            p = ngx_memcmp(cn->key, cnt->key, sizeof(cn->key)) < 0
+                    ? &temp->left
+                    : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+ngx_int_t ngx_weserv_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data) {
+    auto *ocache = reinterpret_cast<ngx_weserv_cache_t *>(data);
+    auto *cache = reinterpret_cast<ngx_weserv_cache_t *>(shm_zone->data);
+
+    // Reuse the shared state on reconfiguration
+    if (ocache != nullptr) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = reinterpret_cast<ngx_slab_pool_t *>(shm_zone->shm.addr);
+
+    if (shm_zone->shm.exists) {
+        cache->sh = reinterpret_cast<ngx_weserv_cache_sh_t *>(
+            cache->shpool->data);
+
+        return NGX_OK;
+    }
+
+    cache->sh = reinterpret_cast<ngx_weserv_cache_sh_t *>(
+        ngx_slab_alloc(cache->shpool, sizeof(ngx_weserv_cache_sh_t)));
+    if (cache->sh == nullptr) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_weserv_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    size_t len = sizeof(" in weserv cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx =
+        reinterpret_cast<u_char *>(ngx_slab_alloc(cache->shpool, len));
+    if (cache->shpool->log_ctx == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in weserv cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    // Running out of memory is expected, we evict entries in that case
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+ngx_weserv_cache_node_t *ngx_weserv_cache_lookup_locked(
+    ngx_weserv_cache_t *cache, const u_char *key) {
+    ngx_rbtree_key_t node_key;
+    ngx_memcpy(&node_key, key, sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_node_t *node = cache->sh->rbtree.root;
+    ngx_rbtree_node_t *sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        auto *cn = reinterpret_cast<ngx_weserv_cache_node_t *>(node);
+
+        ngx_int_t rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], cn->key,
+                                  sizeof(cn->key));
+        if (rc == 0) {
+            return cn;
+        }
+
+        node = rc < 0 ? node->left : node->right;
+    }
+
+    return nullptr;
+}
+
+void ngx_weserv_cache_delete_locked(ngx_weserv_cache_t *cache,
+                                    ngx_weserv_cache_node_t *cn) {
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+
+    // The image is still being copied, leave it to the last request that
+    // unpins it
+    if (cn->count > 0) {
+        cn->deleted = 1;
+        return;
+    }
+
+    ngx_slab_free_locked(cache->shpool, cn->data);
+    ngx_slab_free_locked(cache->shpool, cn);
+}
+
+/**
+ * Remove inactive entries. If force is set, the least recently used entry
+ * is removed regardless of its last access time.
+ */
+void ngx_weserv_cache_expire_locked(ngx_weserv_cache_t *cache, bool force) {
+    time_t now = ngx_time();
+
+    while (!ngx_queue_empty(&cache->sh->queue)) {
+        ngx_queue_t *q = ngx_queue_last(&cache->sh->queue);
+        auto *cn = ngx_queue_data(q, ngx_weserv_cache_node_t, queue);
+
+        if (!force && now - cn->accessed < cache->inactive) {
+            return;
+        }
+
+        force = false;
+
+        ngx_weserv_cache_delete_locked(cache, cn);
+    }
+}
+
+void *ngx_weserv_cache_alloc_locked(ngx_weserv_cache_t *cache, size_t size) {
+    void *p = ngx_slab_alloc_locked(cache->shpool, size);
+
+    // Evict the least recently used entries until the allocation succeeds
+    while (p == nullptr && !ngx_queue_empty(&cache->sh->queue)) {
+        ngx_weserv_cache_expire_locked(cache, true);
+
+        p = ngx_slab_alloc_locked(cache->shpool, size);
+    }
+
+    return p;
+}
+
+ngx_int_t ngx_weserv_cache_insert_locked(ngx_weserv_cache_t *cache,
+                                         const u_char *key,
+                                         const std::string &extension,
+                                         const u_char *data, size_t size) {
+    auto *cn = reinterpret_cast<ngx_weserv_cache_node_t *>(
+        ngx_weserv_cache_alloc_locked(cache, sizeof(ngx_weserv_cache_node_t)));
+    if (cn == nullptr) {
+        return NGX_ERROR;
+    }
+
+    cn->data = reinterpret_cast<u_char *>(
+        ngx_weserv_cache_alloc_locked(cache, size));
+    if (cn->data == nullptr) {
+        ngx_slab_free_locked(cache->shpool, cn);
+
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(&cn->node.key, key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(cn->key, &key[sizeof(ngx_rbtree_key_t)], sizeof(cn->key));
+
+    cn->extension_len = extension.size();
+    ngx_memcpy(cn->extension, extension.data(), extension.size());
+
+    cn->accessed = ngx_time();
+    cn->count = 0;
+    cn->deleted = 0;
+    cn->size = size;
+    ngx_memcpy(cn->data, data, size);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    return NGX_OK;
+}
+
+/**
+ * Hash the parts of a cache key that are shared by processed images and
+ * validators.
+ */
+void ngx_weserv_cache_key_init(ngx_md5_t *md5, const std::string &canonical,
+                               const api::Config &config) {
+    ngx_md5_init(md5);
+
+    ngx_md5_update(md5, canonical.data(), canonical.size() + 1);
+
+    // The default quality and effort settings affect the output as well, as
+    // do the enabled savers (for `&output=auto`) and decoding the embedded
+    // EXIF thumbnail instead of the image itself
+    intptr_t settings[] = {
+        config.quality,
+        config.avif_quality,
+        config.jpeg_quality,
+        config.tiff_quality,
+        config.webp_quality,
+        config.avif_effort,
+        config.gif_effort,
+        config.webp_effort,
+        config.zlib_level,
+        config.fail_on_error,
+        config.exif_thumbnail,
+        static_cast<intptr_t>(config.savers),
+    };
+    ngx_md5_update(md5, settings, sizeof(settings));
+}
+
+}  // namespace
+
+char *ngx_weserv_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_str_t *value = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+    u_char *p = ngx_strlchr(value[1].data, value[1].data + value[1].len, ':');
+    if (p == nullptr || p == value[1].data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid zone \"%V\"",
+                           &value[1]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    ngx_str_t name = {static_cast<size_t>(p - value[1].data), value[1].data};
+    ngx_str_t s = {value[1].len - name.len - 1, p + 1};
+
+    ssize_t size = ngx_parse_size(&s);
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid zone size \"%V\"",
+                           &value[1]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    if (size < static_cast<ssize_t>(8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "zone \"%V\" is too small",
+                           &value[1]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    // Remove entries that are not accessed for 10 minutes by default
+    time_t inactive = 600;
+
+    // Do not cache images larger than 1 MiB by default
+    ssize_t max_entry_size = 1024 * 1024;
+
+    for (ngx_uint_t i = 2; i < cf->args->nelts; i++) {
+        if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            inactive = ngx_parse_time(&s, 1);
+            if (inactive == static_cast<time_t>(NGX_ERROR)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid inactive value \"%V\"", &value[i]);
+                return reinterpret_cast<char *>(NGX_CONF_ERROR);
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_entry_size=", 15) == 0) {
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            max_entry_size = ngx_parse_size(&s);
+            if (max_entry_size == NGX_ERROR || max_entry_size >= size) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_entry_size value \"%V\"",
+                                   &value[i]);
+                return reinterpret_cast<char *>(NGX_CONF_ERROR);
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"",
+                           &value[i]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    auto *cache = reinterpret_cast<ngx_weserv_cache_t *>(
+        ngx_pcalloc(cf->pool, sizeof(ngx_weserv_cache_t)));
+    if (cache == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    cache->inactive = inactive;
+    cache->max_entry_size = max_entry_size;
+
+    ngx_shm_zone_t *shm_zone =
+        ngx_shared_memory_add(cf, &name, size, &ngx_weserv_module);
+    if (shm_zone == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "duplicate zone \"%V\"",
+                           &name);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    shm_zone->init = ngx_weserv_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+char *ngx_weserv_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(conf);
+
+    if (lc->cache_zone != NGX_CONF_UNSET_PTR) {
+        return const_cast<char *>("is duplicate");
+    }
+
+    ngx_str_t *value = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        lc->cache_zone = nullptr;
+        return NGX_CONF_OK;
+    }
+
+    // The size of the zone is set by the weserv_cache_zone directive
+    lc->cache_zone =
+        ngx_shared_memory_add(cf, &value[1], 0, &ngx_weserv_module);
+    if (lc->cache_zone == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    return NGX_CONF_OK;
+}
+
+void ngx_weserv_cache_key(const std::string &canonical,
+                          const api::Config &config, ngx_chain_t *in,
+                          u_char *key) {
+    ngx_md5_t md5;
+    ngx_weserv_cache_key_init(&md5, canonical, config);
+
+    for (ngx_chain_t *cl = in; cl; cl = cl->next) {
+        ngx_md5_update(&md5, cl->buf->pos, cl->buf->last - cl->buf->pos);
+
+        if (cl->buf->last_buf) {
+            break;
+        }
+    }
+
+    ngx_md5_final(key, &md5);
+}
+
+void ngx_weserv_cache_validators_key(const std::string &canonical,
+                                     const api::Config &config,
+                                     const ngx_str_t &url, u_char *key) {
+    ngx_md5_t md5;
+    ngx_weserv_cache_key_init(&md5, canonical, config);
+
+    // Prefixed, so that it can never collide with the key of a processed
+    // image of the same query
+    ngx_md5_update(&md5, "url:", sizeof("url:") - 1);
+    ngx_md5_update(&md5, url.data, url.len);
+
+    ngx_md5_final(key, &md5);
+}
+
+ngx_int_t ngx_weserv_cache_get(ngx_shm_zone_t *shm_zone, const u_char *key,
+                               api::io::TargetInterface *target) {
+    auto *cache = reinterpret_cast<ngx_weserv_cache_t *>(shm_zone->data);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_weserv_cache_node_t *cn = ngx_weserv_cache_lookup_locked(cache, key);
+    if (cn == nullptr) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_DECLINED;
+    }
+
+    cn->accessed = ngx_time();
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    // Pin the entry, so that the image can be copied without holding the
+    // lock (which would serialize all worker processes on the copy)
+    cn->count++;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    target->setup(std::string(reinterpret_cast<char *>(cn->extension),
+                              cn->extension_len));
+    int64_t rc = target->write(cn->data, cn->size);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    // The entry may have been evicted in the meantime
+    if (--cn->count == 0 && cn->deleted) {
+        ngx_slab_free_locked(cache->shpool, cn->data);
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc == -1 ? NGX_ERROR : NGX_OK;
+}
+
+ngx_int_t ngx_weserv_cache_put(ngx_shm_zone_t *shm_zone, const u_char *key,
+                               const std::string &extension,
+                               const std::string &output) {
+    auto *cache = reinterpret_cast<ngx_weserv_cache_t *>(shm_zone->data);
+
+    if (output.size() > cache->max_entry_size ||
+        extension.size() > NGX_WESERV_CACHE_EXTENSION_LEN) {
+        return NGX_DECLINED;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_weserv_cache_expire_locked(cache, false);
+
+    // Another worker process might have stored this image in the meantime
+    if (ngx_weserv_cache_lookup_locked(cache, key) != nullptr) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_OK;
+    }
+
+    ngx_int_t rc = ngx_weserv_cache_insert_locked(
+        cache, key, extension,
+        reinterpret_cast<const u_char *>(output.data()), output.size());
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc;
+}
+
+ngx_int_t ngx_weserv_cache_get_validators(ngx_shm_zone_t *shm_zone,
+                                          const u_char *key, ngx_pool_t *pool,
+                                          ngx_str_t *etag,
+                                          ngx_str_t *last_modified,
+                                          u_char *image_key) {
+    auto *cache = reinterpret_cast<ngx_weserv_cache_t *>(shm_zone->data);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_weserv_cache_node_t *cn = ngx_weserv_cache_lookup_locked(cache, key);
+    if (cn == nullptr) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_DECLINED;
+    }
+
+    cn->accessed = ngx_time();
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    // The data holds the image key, followed by the ETag and Last-Modified
+    // values which are separated by a NUL byte, see
+    // ngx_weserv_cache_put_validators
+    size_t size = cn->size - NGX_WESERV_CACHE_KEY_LEN;
+
+    auto *p = reinterpret_cast<u_char *>(ngx_pnalloc(pool, size));
+    if (p == nullptr) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(image_key, cn->data, NGX_WESERV_CACHE_KEY_LEN);
+    ngx_memcpy(p, cn->data + NGX_WESERV_CACHE_KEY_LEN, size);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    etag->data = p;
+    etag->len = ngx_strlen(p);
+
+    last_modified->data = p + etag->len + 1;
+    last_modified->len = size - etag->len - 1;
+
+    return NGX_OK;
+}
+
+ngx_int_t ngx_weserv_cache_put_validators(ngx_shm_zone_t *shm_zone,
+                                          const u_char *key,
+                                          const ngx_str_t &etag,
+                                          const ngx_str_t &last_modified,
+                                          const u_char *image_key) {
+    auto *cache = reinterpret_cast<ngx_weserv_cache_t *>(shm_zone->data);
+
+    std::string data(reinterpret_cast<const char *>(image_key),
+                     NGX_WESERV_CACHE_KEY_LEN);
+    data.append(reinterpret_cast<char *>(etag.data), etag.len);
+    data.push_back('\0');
+    data.append(reinterpret_cast<char *>(last_modified.data),
+                last_modified.len);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_weserv_cache_expire_locked(cache, false);
+
+    // The source image may have been modified since the validators were
+    // stored
+    ngx_weserv_cache_node_t *cn = ngx_weserv_cache_lookup_locked(cache, key);
+    if (cn != nullptr) {
+        ngx_weserv_cache_delete_locked(cache, cn);
+    }
+
+    ngx_int_t rc = ngx_weserv_cache_insert_locked(
+        cache, key, "", reinterpret_cast<const u_char *>(data.data()),
+        data.size());
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc;
+}
+
+}  // namespace weserv::nginx
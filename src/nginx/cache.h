@@ -0,0 +1,121 @@
+#pragma once
+
+extern "C" {
+#include <ngx_http.h>
+#include <ngx_md5.h>
+}
+
+#include <weserv/config.h>
+#include <weserv/io/target_interface.h>
+
+#include <string>
+
+/**
+ * The length of a cache key, which is a MD5 digest.
+ */
+#define NGX_WESERV_CACHE_KEY_LEN 16
+
+#define NGX_WESERV_CACHE_MISS 1
+#define NGX_WESERV_CACHE_HIT 2
+#define NGX_WESERV_CACHE_REVALIDATED 3
+
+namespace weserv::nginx {
+
+/**
+ * Directive handler for the `weserv_cache_zone` directive.
+ * Syntax: weserv_cache_zone <name>:<size> [inactive=<time>]
+ *                           [max_entry_size=<size>];
+ */
+char *ngx_weserv_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+/**
+ * Directive handler for the `weserv_cache` directive.
+ * Syntax: weserv_cache <name>|off;
+ */
+char *ngx_weserv_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+/**
+ * Calculate the cache key of a processed image.
+ * @param canonical The canonical query string.
+ * @param config API configuration, which may affect the output as well.
+ * @param in The buffered source chain.
+ * @param key Output key, must be at least NGX_WESERV_CACHE_KEY_LEN bytes.
+ */
+void ngx_weserv_cache_key(const std::string &canonical,
+                          const api::Config &config, ngx_chain_t *in,
+                          u_char *key);
+
+/**
+ * Calculate the key under which the validators of a source image are stored.
+ * Unlike ngx_weserv_cache_key, this key is derived from the URL of the
+ * source image, so that it's known before the image is fetched.
+ * @param canonical The canonical query string.
+ * @param config API configuration, which may affect the output as well.
+ * @param url The URL of the source image.
+ * @param key Output key, must be at least NGX_WESERV_CACHE_KEY_LEN bytes.
+ */
+void ngx_weserv_cache_validators_key(const std::string &canonical,
+                                     const api::Config &config,
+                                     const ngx_str_t &url, u_char *key);
+
+/**
+ * Look up a processed image and write it to the given target.
+ * @param shm_zone The cache zone.
+ * @param key The cache key.
+ * @param target Target to write to, end() is left to the caller.
+ * @return NGX_OK on a hit, NGX_DECLINED on a miss or NGX_ERROR on failure.
+ */
+ngx_int_t ngx_weserv_cache_get(ngx_shm_zone_t *shm_zone, const u_char *key,
+                               api::io::TargetInterface *target);
+
+/**
+ * Store a processed image, evicting the least recently used entries if the
+ * cache zone is full.
+ * @param shm_zone The cache zone.
+ * @param key The cache key.
+ * @param extension Extension of the processed image.
+ * @param output The processed image.
+ * @return NGX_OK if stored, NGX_DECLINED if the image is too large to be
+ *         cached or NGX_ERROR on failure.
+ */
+ngx_int_t ngx_weserv_cache_put(ngx_shm_zone_t *shm_zone, const u_char *key,
+                               const std::string &extension,
+                               const std::string &output);
+
+/**
+ * Look up the validators of a source image, i.e. its `ETag` and
+ * `Last-Modified` response headers.
+ * @param shm_zone The cache zone.
+ * @param key The validators key, see ngx_weserv_cache_validators_key.
+ * @param pool Pool to allocate the validators from.
+ * @param etag Output ETag, empty if the source image had none.
+ * @param last_modified Output Last-Modified, empty if the source image had
+ *                      none.
+ * @param image_key Output cache key of the image that was processed from the
+ *                  source image, must be at least NGX_WESERV_CACHE_KEY_LEN
+ *                  bytes.
+ * @return NGX_OK on a hit, NGX_DECLINED on a miss or NGX_ERROR on failure.
+ */
+ngx_int_t ngx_weserv_cache_get_validators(ngx_shm_zone_t *shm_zone,
+                                          const u_char *key, ngx_pool_t *pool,
+                                          ngx_str_t *etag,
+                                          ngx_str_t *last_modified,
+                                          u_char *image_key);
+
+/**
+ * Store the validators of a source image, replacing any previous ones.
+ * @param shm_zone The cache zone.
+ * @param key The validators key, see ngx_weserv_cache_validators_key.
+ * @param etag ETag of the source image, may be empty.
+ * @param last_modified Last-Modified of the source image, may be empty.
+ * @param image_key Cache key of the image that was processed from the source
+ *                  image.
+ * @return NGX_OK if stored or NGX_ERROR on failure.
+ */
+ngx_int_t ngx_weserv_cache_put_validators(ngx_shm_zone_t *shm_zone,
+                                          const u_char *key,
+                                          const ngx_str_t &etag,
+                                          const ngx_str_t &last_modified,
+                                          const u_char *image_key);
+
+}  // namespace weserv::nginx
@@ -0,0 +1,382 @@
+#include "coalesce.h"
+
+#include "http.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace weserv::nginx {
+
+namespace {
+
+/**
+ * Lead a new flight with the given key, or wait for the existing one.
+ * @return true if the request leads the flight.
+ */
+bool ngx_weserv_flight_join(ngx_weserv_flights_t *flights,
+                            const std::string &key, ngx_http_request_t *r,
+                            ngx_weserv_base_ctx_t *ctx) {
+    auto it = flights->find(key);
+    if (it != flights->end()) {
+        it->second->waiters.push_back(r);
+
+        ctx->flight = it->second;
+        ctx->flight_leader = 0;
+
+        return false;
+    }
+
+    auto *flight = new ngx_weserv_flight_t;
+    flight->flights = flights;
+    flight->key = key;
+
+    flights->emplace(key, flight);
+
+    ctx->flight = flight;
+    ctx->flight_leader = 1;
+
+    return true;
+}
+
+/**
+ * Remove the flight led by this request from its registry, so that
+ * subsequent requests will lead a new one.
+ * @return The requests that were waiting for the flight.
+ */
+std::vector<ngx_http_request_t *> ngx_weserv_flight_land(
+    ngx_weserv_base_ctx_t *ctx) {
+    ngx_weserv_flight_t *flight = ctx->flight;
+
+    std::vector<ngx_http_request_t *> waiters;
+    waiters.swap(flight->waiters);
+
+    flight->flights->erase(flight->key);
+    delete flight;
+
+    ctx->flight = nullptr;
+    ctx->flight_leader = 0;
+
+    return waiters;
+}
+
+/**
+ * Resume a waiting request on the next iteration of the event loop.
+ */
+void ngx_weserv_flight_resume(ngx_http_request_t *r,
+                              ngx_weserv_base_ctx_t *ctx,
+                              ngx_event_handler_pt handler) {
+    ctx->flight = nullptr;
+
+    ngx_event_t *ev = &ctx->flight_event;
+    ev->data = r;
+    ev->handler = handler;
+    ev->log = r->connection->log;
+
+    ngx_post_event(ev, &ngx_posted_events);
+}
+
+/**
+ * Store a copy of the fetched image within the module context of a waiting
+ * request, see ngx_weserv_fetch_event_handler.
+ */
+ngx_int_t ngx_weserv_fetch_stash(ngx_http_request_t *r,
+                                 ngx_weserv_upstream_ctx_t *ctx,
+                                 ngx_chain_t *in, size_t size) {
+    ngx_buf_t *b = size > 0 ? ngx_create_temp_buf(r->pool, size)
+                            : ngx_calloc_buf(r->pool);
+    if (b == nullptr) {
+        return NGX_ERROR;
+    }
+
+    for (ngx_chain_t *cl = in; cl && size > 0; cl = cl->next) {
+        b->last = ngx_cpymem(b->last, cl->buf->pos,
+                             cl->buf->last - cl->buf->pos);
+    }
+
+    b->last_buf = 1;
+
+    // Ensure it's released by ngx_weserv_image_filter_free_buf
+    b->tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+
+    ngx_chain_t *cl = ngx_alloc_chain_link(r->pool);
+    if (cl == nullptr) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = nullptr;
+
+    ctx->in = cl;
+
+    return NGX_OK;
+}
+
+/**
+ * Resumes a request that waited for an in-flight fetch.
+ */
+void ngx_weserv_fetch_event_handler(ngx_event_t *ev) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(ev->data);
+    ngx_connection_t *c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "weserv coalesced fetch: \"%V?%V\"", &r->uri, &r->args);
+
+    auto *ctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    // Pass the stashed image down, as if it was received from the upstream
+    // server. The body filter will take care of an unsuccessful response
+    // status.
+    ngx_chain_t *in = ctx->in;
+    ctx->in = nullptr;
+
+    if (in == nullptr) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        ngx_http_run_posted_requests(c);
+        return;
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+
+    ngx_int_t rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        ngx_http_finalize_request(r, rc);
+    } else {
+        ngx_http_finalize_request(r, ngx_http_output_filter(r, in));
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+/**
+ * Retries the fetch of a request that waited for a fetch whose leading
+ * request was finalized prematurely.
+ */
+void ngx_weserv_fetch_retry_handler(ngx_event_t *ev) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(ev->data);
+    ngx_connection_t *c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "weserv coalesced fetch retry: \"%V?%V\"", &r->uri,
+                   &r->args);
+
+    auto *ctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    // Release the reference taken while waiting, both the upstream module
+    // and a new wait will take their own
+    r->main->count--;
+
+    if (ngx_weserv_coalesce_fetch(r, ctx) != NGX_ERROR) {
+        return;
+    }
+
+    // Pass the failure down through the body filter
+    if (ngx_weserv_fetch_stash(r, ctx, nullptr, 0) != NGX_OK) {
+        ctx->in = nullptr;
+    }
+
+    ngx_weserv_fetch_event_handler(ev);
+}
+
+/**
+ * Detaches a request from its flight when the request pool is destroyed.
+ */
+void ngx_weserv_fetch_cleanup(void *data) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(data);
+
+    auto *ctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr) {
+        return;
+    }
+
+    if (ctx->flight_event.posted) {
+        ngx_delete_posted_event(&ctx->flight_event);
+    }
+
+    if (ctx->flight == nullptr) {
+        return;
+    }
+
+    if (!ctx->flight_leader) {
+        // Stop waiting, e.g. when the client closed the connection
+        std::vector<ngx_http_request_t *> &waiters = ctx->flight->waiters;
+        waiters.erase(std::remove(waiters.begin(), waiters.end(), r),
+                      waiters.end());
+
+        ctx->flight = nullptr;
+
+        return;
+    }
+
+    // The leading request was finalized before the image was fetched, let
+    // the waiting requests retry the fetch on their own
+    for (ngx_http_request_t *w : ngx_weserv_flight_land(ctx)) {
+        auto *wctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+            ngx_http_get_module_ctx(w, ngx_weserv_module));
+
+        ngx_weserv_flight_resume(w, wctx, ngx_weserv_fetch_retry_handler);
+    }
+}
+
+}  // namespace
+
+ngx_int_t ngx_weserv_coalesce_fetch(ngx_http_request_t *r,
+                                    ngx_weserv_upstream_ctx_t *ctx) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
+    if (!ctx->flight_cleanup) {
+        ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == nullptr) {
+            ctx->response_status = {NGX_ERROR, "Out of memory"};
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_weserv_fetch_cleanup;
+        cln->data = r;
+
+        ctx->flight_cleanup = 1;
+    }
+
+    // Only coalesce fetches within the same location, since the upstream
+    // configuration (timeouts, max size, etc.) may differ per location
+    std::string key = std::to_string(reinterpret_cast<uintptr_t>(lc)) + ' ' +
+                      ngx_str_to_std(ctx->request->url());
+
+    if (ngx_weserv_flight_join(&mc->fetches, key, r, ctx)) {
+        ngx_int_t rc = ngx_weserv_send_http_request(r, ctx);
+
+        if (rc == NGX_ERROR) {
+            ngx_weserv_coalesce_fetch_done(r, ctx);
+        }
+
+        return rc;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "weserv: waiting for in-flight fetch of %V",
+                   &ctx->request->url());
+
+    // Keep the request alive until the fetch has finished, the same way as
+    // ngx_http_read_client_request_body does
+    r->main->count++;
+
+    r->read_event_handler = ngx_http_test_reading;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    return NGX_DONE;
+}
+
+void ngx_weserv_coalesce_fetch_done(ngx_http_request_t *r,
+                                    ngx_weserv_upstream_ctx_t *ctx) {
+    if (ctx->flight == nullptr || !ctx->flight_leader) {
+        return;
+    }
+
+    std::vector<ngx_http_request_t *> waiters = ngx_weserv_flight_land(ctx);
+    if (waiters.empty()) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "weserv: passing fetch to %uz waiting requests",
+                   waiters.size());
+
+    ngx_chain_t *in = nullptr;
+    size_t size = 0;
+
+    if (ctx->response_status.ok()) {
+        in = ctx->in;
+
+        for (ngx_chain_t *cl = in; cl; cl = cl->next) {
+            size += cl->buf->last - cl->buf->pos;
+        }
+    }
+
+    for (ngx_http_request_t *w : waiters) {
+        auto *wctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+            ngx_http_get_module_ctx(w, ngx_weserv_module));
+
+        wctx->response_status = ctx->response_status;
+
+        if (ctx->canonical.len > 0) {
+            wctx->canonical.data = ngx_pstrdup(w->pool, &ctx->canonical);
+            wctx->canonical.len =
+                wctx->canonical.data != nullptr ? ctx->canonical.len : 0;
+        }
+
+        if (ngx_weserv_fetch_stash(w, wctx, in, size) != NGX_OK) {
+            wctx->in = nullptr;
+        }
+
+        ngx_weserv_flight_resume(w, wctx, ngx_weserv_fetch_event_handler);
+    }
+}
+
+#if NGX_THREADS
+ngx_int_t ngx_weserv_coalesce_transform(ngx_http_request_t *r,
+                                        ngx_weserv_loc_conf_t *lc,
+                                        ngx_weserv_base_ctx_t *ctx) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    // Only coalesce transforms within the same location, since the API
+    // configuration (limits, savers, etc.) may differ per location
+    std::string key = std::to_string(reinterpret_cast<uintptr_t>(lc)) + ' ' +
+                      std::string(reinterpret_cast<char *>(ctx->cache_key),
+                                  NGX_WESERV_CACHE_KEY_LEN);
+
+    if (ngx_weserv_flight_join(&mc->transforms, key, r, ctx)) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "weserv: waiting for in-flight transform");
+
+    // Wait the same way as for an image processed within a thread, see
+    // ngx_weserv_image_thread_post
+    ctx->processing = 1;
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_AGAIN;
+}
+
+void ngx_weserv_coalesce_transform_done(ngx_weserv_base_ctx_t *ctx,
+                                        ngx_event_handler_pt handler) {
+    if (ctx->flight == nullptr || !ctx->flight_leader) {
+        return;
+    }
+
+    for (ngx_http_request_t *w : ngx_weserv_flight_land(ctx)) {
+        auto *wctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+            ngx_http_get_module_ctx(w, ngx_weserv_module));
+
+        wctx->status = ctx->status;
+        wctx->extension = ctx->extension;
+        wctx->output = ctx->output;
+
+        if (ctx->srcset != nullptr) {
+            wctx->srcset.reset(new ngx_weserv_srcset_t(*ctx->srcset));
+        }
+
+        ngx_weserv_flight_resume(w, wctx, handler);
+    }
+}
+#endif
+
+}  // namespace weserv::nginx
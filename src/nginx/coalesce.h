@@ -0,0 +1,56 @@
+#pragma once
+
+extern "C" {
+#include <ngx_http.h>
+}
+
+#include "module.h"
+
+namespace weserv::nginx {
+
+/**
+ * Fetch the image from the upstream server or, when an identical fetch is
+ * already in flight within this worker process, wait for its result.
+ * @param r The request.
+ * @param ctx The upstream module context, its HTTP request must be set.
+ * @return NGX_DONE on success or NGX_ERROR on failure, in which case the
+ *         response status is stored within the module context.
+ */
+ngx_int_t ngx_weserv_coalesce_fetch(ngx_http_request_t *r,
+                                    ngx_weserv_upstream_ctx_t *ctx);
+
+/**
+ * Pass the fetched image (or the response status on failure) to the requests
+ * waiting for the fetch led by this request, if any.
+ * @param r The request.
+ * @param ctx The upstream module context.
+ */
+void ngx_weserv_coalesce_fetch_done(ngx_http_request_t *r,
+                                    ngx_weserv_upstream_ctx_t *ctx);
+
+#if NGX_THREADS
+/**
+ * Wait for an identical image transform that is already in flight within
+ * this worker process, or lead a new one.
+ * @param r The request.
+ * @param lc The location configuration.
+ * @param ctx The module context, its cache key must be set.
+ * @return NGX_OK if this request should process the image or NGX_AGAIN
+ *         if it waits for the result of another request.
+ */
+ngx_int_t ngx_weserv_coalesce_transform(ngx_http_request_t *r,
+                                        ngx_weserv_loc_conf_t *lc,
+                                        ngx_weserv_base_ctx_t *ctx);
+
+/**
+ * Pass the processed image to the requests waiting for the transform led by
+ * this request, if any.
+ * @param ctx The module context.
+ * @param handler Invoked for each waiting request on the next iteration of
+ *                the event loop.
+ */
+void ngx_weserv_coalesce_transform_done(ngx_weserv_base_ctx_t *ctx,
+                                        ngx_event_handler_pt handler);
+#endif
+
+}  // namespace weserv::nginx
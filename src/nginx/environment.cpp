@@ -1,9 +1,30 @@
 #include "environment.h"
 
+#include "status.h"
 #include "util.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <utility>
+
 namespace weserv::nginx {
 
+namespace {
+
+/**
+ * The timings reported on this thread, images are processed either within
+ * the event loop or on a thread of a thread pool.
+ */
+thread_local std::string reported_timings;
+
+/**
+ * The highest number of libvips worker threads reported on this thread.
+ */
+thread_local ngx_int_t reported_concurrency = 0;
+
+}  // namespace
+
 void NgxEnvironment::log(LogLevel level, const char *message) {
     ngx_uint_t ngx_level;
     switch (level) {
@@ -27,4 +48,39 @@ void NgxEnvironment::log(LogLevel level, const char *message) {
     ngx_weserv_log(log_, ngx_level, msg);
 }
 
+void NgxEnvironment::timings(const std::vector<api::StageTiming> &stages) {
+    std::string value;
+
+    for (const auto &stage : stages) {
+        // e.g. save;dur=12.345;desc="cpu=23.456"
+        char metric[128];
+        int len = std::snprintf(
+            metric, sizeof(metric), "%s%s;dur=%" PRId64 ".%03" PRId64
+            ";desc=\"cpu=%" PRId64 ".%03" PRId64 "\"",
+            value.empty() ? "" : ", ", stage.name.c_str(),
+            stage.wall_time / 1000, stage.wall_time % 1000,
+            stage.cpu_time / 1000, stage.cpu_time % 1000);
+        if (len > 0) {
+            value.append(metric, std::min<size_t>(len, sizeof(metric) - 1));
+        }
+    }
+
+    reported_timings = std::move(value);
+}
+
+void NgxEnvironment::processed(const api::ProcessingStats &stats) {
+    ngx_weserv_status_processed(status_zone_, stats);
+
+    reported_concurrency =
+        std::max<ngx_int_t>(reported_concurrency, stats.concurrency);
+}
+
+std::string ngx_weserv_take_timings() {
+    return std::exchange(reported_timings, std::string());
+}
+
+ngx_int_t ngx_weserv_take_concurrency() {
+    return std::exchange(reported_concurrency, 0);
+}
+
 }  // namespace weserv::nginx
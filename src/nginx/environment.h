@@ -4,6 +4,9 @@ extern "C" {
 #include <ngx_core.h>
 }
 
+#include <string>
+#include <vector>
+
 #include <weserv/env_interface.h>
 
 namespace weserv::nginx {
@@ -13,14 +16,45 @@ namespace weserv::nginx {
  */
 class NgxEnvironment : public api::ApiEnvInterface {
  public:
-    NgxEnvironment(ngx_log_t *log) : log_(log) {}
+    NgxEnvironment(ngx_log_t *log, ngx_shm_zone_t *status_zone)
+        : log_(log), status_zone_(status_zone) {}
 
     ~NgxEnvironment() override = default;
 
     void log(LogLevel level, const char *message) override;
 
+    /**
+     * Formats the timings as a `Server-Timing` header value and keeps it for
+     * the calling thread, see ngx_weserv_take_timings.
+     */
+    void timings(const std::vector<api::StageTiming> &stages) override;
+
+    /**
+     * Records the statistics within the status zone, if any, see status.h,
+     * and keeps the limit on the libvips worker threads for the calling
+     * thread, see ngx_weserv_take_concurrency.
+     */
+    void processed(const api::ProcessingStats &stats) override;
+
  private:
     ngx_log_t *log_;
+
+    ngx_shm_zone_t *status_zone_;
 };
 
+/**
+ * Take the timings that were reported on the calling thread during the last
+ * call to `ApiManager::process`, formatted as a `Server-Timing` header value.
+ * @return The timings, or an empty string if none were reported.
+ */
+std::string ngx_weserv_take_timings();
+
+/**
+ * Take the highest number of libvips worker threads that was used to process
+ * an image on the calling thread during the last call to `ApiManager::process`
+ * or `ApiManager::process_batch`.
+ * @return The number of threads, or 0 if no image was processed.
+ */
+ngx_int_t ngx_weserv_take_concurrency();
+
 }  // namespace weserv::nginx
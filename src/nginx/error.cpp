@@ -1,6 +1,7 @@
 #include "error.h"
 
 #include "header.h"
+#include "status.h"
 #include "uri_parser.h"
 #include "util.h"
 
@@ -13,6 +14,10 @@ namespace weserv::nginx {
 ngx_int_t ngx_weserv_return_error(ngx_http_request_t *r,
                                   ngx_weserv_upstream_ctx_t *upstream_ctx,
                                   Status status, ngx_chain_t *out) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+    ngx_weserv_status_error(mc->status_zone, status);
+
     ngx_uint_t http_status = status.http_code();
 
     // Redirect if the 'default' (or 'errorredirect') query parameter is given.
@@ -37,6 +42,12 @@ ngx_int_t ngx_weserv_return_error(ngx_http_request_t *r,
         }
     }
 
+    // Let the client retry shortly if the processing budget is exhausted
+    if (http_status == NGX_HTTP_SERVICE_UNAVAILABLE &&
+        set_retry_after_header(r, 1) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
     std::string error = status.to_json();
 
     off_t content_length = error.size();
@@ -1,9 +1,12 @@
 #include "handler.h"
 
 #include "alloc.h"
+#include "cache.h"
+#include "coalesce.h"
 #include "error.h"
 #include "http.h"
 #include "uri_parser.h"
+#include "stream.h"
 #include "util.h"
 
 #include <memory>
@@ -14,6 +17,68 @@ using ::weserv::api::utils::Status;
 
 namespace weserv::nginx {
 
+namespace {
+
+/**
+ * Prepare a conditional request for a source image from which an image was
+ * processed before, using the validators it was stored with.
+ * The validators key is always set, so that the validators can be stored
+ * once the image has been processed.
+ * @return NGX_OK if the request is conditional, or NGX_DECLINED if the source
+ *         image needs to be fetched unconditionally.
+ */
+ngx_int_t ngx_weserv_revalidate(ngx_http_request_t *r,
+                                ngx_weserv_loc_conf_t *lc,
+                                ngx_weserv_upstream_ctx_t *ctx,
+                                HTTPRequest *http_request) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    ngx_weserv_cache_validators_key(
+        mc->weserv->canonical_query(ngx_weserv_image_args(r)), lc->api_conf,
+        http_request->url(), ctx->validators_key);
+
+    // A srcset consists of several images, which are not stored as a whole
+    ngx_str_t srcset;
+    if (ngx_http_arg(r, (u_char *)"srcset", 6, &srcset) == NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    ngx_str_t etag, last_modified;
+    if (ngx_weserv_cache_get_validators(lc->cache_zone, ctx->validators_key,
+                                        r->pool, &etag, &last_modified,
+                                        ctx->cache_key) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    // The processed image is held in memory, since it could be evicted from
+    // the cache zone before the upstream server has responded
+    NgxMemoryTarget target(&ctx->extension, &ctx->output);
+    if (ngx_weserv_cache_get(lc->cache_zone, ctx->cache_key, &target) !=
+        NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (etag.len > 0) {
+        http_request->set_header("If-None-Match", etag);
+    }
+
+    if (last_modified.len > 0) {
+        http_request->set_header("If-Modified-Since", last_modified);
+    }
+
+    // Overwritten by the validators of the `304 Not Modified` response, if
+    // any, see validators_changed
+    ctx->etag = etag;
+    ctx->last_modified = last_modified;
+
+    ctx->revalidating = 1;
+
+    return NGX_OK;
+}
+
+}  // namespace
+
 ngx_int_t ngx_weserv_request_handler(ngx_http_request_t *r) {
     auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
         ngx_http_get_module_loc_conf(r, ngx_weserv_module));
@@ -75,10 +140,28 @@ ngx_int_t ngx_weserv_request_handler(ngx_http_request_t *r) {
         .set_max_redirects(lc->max_redirects)
         .set_header("User-Agent", lc->user_agent);
 
+    // Revalidate the image that was processed from the source image before,
+    // if any, instead of fetching the source image again
+    if (lc->cache_zone != nullptr
+#if NGX_DEBUG
+        && ctx->debug == 0
+#endif
+    ) {
+        (void)ngx_weserv_revalidate(r, lc, ctx, http_request.get());
+    }
+
     // Store the caller's request
     ctx->request = std::move(http_request);
 
-    rc = ngx_weserv_send_http_request(r, ctx);
+    // Identical fetches are coalesced, except when debugging. Conditional
+    // fetches are not, since their response is specific to this request.
+    bool coalesce = lc->coalesce && !ctx->revalidating;
+#if NGX_DEBUG
+    coalesce = coalesce && ctx->debug == 0;
+#endif
+
+    rc = coalesce ? ngx_weserv_coalesce_fetch(r, ctx)
+                  : ngx_weserv_send_http_request(r, ctx);
 
     if (rc == NGX_ERROR) {
         ngx_chain_t out;
@@ -12,6 +12,15 @@ const u_char CONTENT_DISPOSITION_LOWCASE[] = "content-disposition";
 const ngx_str_t LINK = ngx_string("Link");
 const u_char LINK_LOWCASE[] = "link";
 
+const ngx_str_t RETRY_AFTER = ngx_string("Retry-After");
+const u_char RETRY_AFTER_LOWCASE[] = "retry-after";
+
+const ngx_str_t VARY = ngx_string("Vary");
+const u_char VARY_LOWCASE[] = "vary";
+
+const ngx_str_t SERVER_TIMING = ngx_string("Server-Timing");
+const u_char SERVER_TIMING_LOWCASE[] = "server-timing";
+
 ngx_int_t set_expires_header(ngx_http_request_t *r, time_t max_age) {
     ngx_table_elt_t *e = r->headers_out.expires;
     if (e == nullptr) {
@@ -213,4 +222,74 @@ ngx_int_t set_link_header(ngx_http_request_t *r, const ngx_str_t &url) {
     return NGX_OK;
 }
 
+ngx_int_t set_retry_after_header(ngx_http_request_t *r, time_t seconds) {
+    auto *p = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, NGX_TIME_T_LEN));
+    if (p == nullptr) {
+        return NGX_ERROR;
+    }
+
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    h->key = RETRY_AFTER;
+    h->lowcase_key = const_cast<u_char *>(RETRY_AFTER_LOWCASE);
+    h->hash = ngx_hash_key(const_cast<u_char *>(RETRY_AFTER_LOWCASE),
+                           sizeof(RETRY_AFTER_LOWCASE) - 1);
+
+    h->value.data = p;
+    h->value.len = ngx_sprintf(p, "%T", seconds) - p;
+
+    return NGX_OK;
+}
+
+ngx_int_t set_vary_accept_header(ngx_http_request_t *r) {
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    h->key = VARY;
+    h->lowcase_key = const_cast<u_char *>(VARY_LOWCASE);
+    h->hash = ngx_hash_key(const_cast<u_char *>(VARY_LOWCASE),
+                           sizeof(VARY_LOWCASE) - 1);
+
+    ngx_str_set(&h->value, "Accept");
+
+    return NGX_OK;
+}
+
+ngx_int_t set_server_timing_header(ngx_http_request_t *r,
+                                   const std::string &value) {
+    if (value.empty()) {
+        return NGX_OK;
+    }
+
+    auto *p = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, value.size()));
+    if (p == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, value.data(), value.size());
+
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    h->key = SERVER_TIMING;
+    h->lowcase_key = const_cast<u_char *>(SERVER_TIMING_LOWCASE);
+    h->hash = ngx_hash_key(const_cast<u_char *>(SERVER_TIMING_LOWCASE),
+                           sizeof(SERVER_TIMING_LOWCASE) - 1);
+
+    h->value.data = p;
+    h->value.len = value.size();
+
+    return NGX_OK;
+}
+
 }  // namespace weserv::nginx
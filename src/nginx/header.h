@@ -24,4 +24,11 @@ ngx_int_t set_location_header(ngx_http_request_t *r, ngx_str_t *value);
 
 ngx_int_t set_link_header(ngx_http_request_t *r, const ngx_str_t &url);
 
+ngx_int_t set_retry_after_header(ngx_http_request_t *r, time_t seconds);
+
+ngx_int_t set_vary_accept_header(ngx_http_request_t *r);
+
+ngx_int_t set_server_timing_header(ngx_http_request_t *r,
+                                   const std::string &value);
+
 }  // namespace weserv::nginx
@@ -378,14 +378,21 @@ ngx_int_t ngx_weserv_upstream_process_status_line(ngx_http_request_t *r) {
         return NGX_OK;
     }
 
+    // The previously processed image is still valid if the source image
+    // wasn't modified since
+    ctx->not_modified =
+        ctx->revalidating && status.code == NGX_HTTP_NOT_MODIFIED;
+
     // We assume that status codes between 300-308 are redirects
-    ctx->redirecting = status.code >= 300 && status.code <= 308;
+    ctx->redirecting = !ctx->not_modified && status.code >= 300 &&
+                       status.code <= 308;
 
     // Don't parse further if:
     // - a non 200 status code is returned
     // - we're not redirecting
+    // - we're not revalidating
     // - we're not debugging responses
-    if (status.code != 200 && !ctx->redirecting
+    if (status.code != 200 && !ctx->redirecting && !ctx->not_modified
 #if NGX_DEBUG
         && ctx->debug == 0
 #endif
@@ -422,8 +429,20 @@ ngx_int_t ngx_weserv_upstream_process_status_line(ngx_http_request_t *r) {
     }
 
     // Store the parsed response status for later
-    ctx->response_status = {static_cast<int>(status.code), "",
-                            Status::ErrorCause::Upstream};
+    ctx->response_status = {
+        ctx->not_modified ? NGX_HTTP_OK : static_cast<int>(status.code), "",
+        Status::ErrorCause::Upstream};
+
+    if (ctx->revalidating && status.code == 200) {
+        // The source image was modified, release the previously processed
+        // image and the validators it was stored with, the response may not
+        // carry any
+        std::string().swap(ctx->output);
+        ctx->extension.clear();
+        ngx_str_null(&ctx->etag);
+        ngx_str_null(&ctx->last_modified);
+        ctx->revalidating = 0;
+    }
 
     if (status.http_version < NGX_HTTP_VERSION_11) {
         r->upstream->headers_in.connection_close = 1;
@@ -455,6 +474,9 @@ ngx_int_t ngx_weserv_upstream_process_header(ngx_http_request_t *r) {
         return NGX_ERROR;
     }
 
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
     ngx_http_upstream_t *u = r->upstream;
 
     for (;;) {
@@ -514,6 +536,33 @@ ngx_int_t ngx_weserv_upstream_process_header(ngx_http_request_t *r) {
                 (void)parse_url(r->pool, absolute_url, &ctx->location);
             }
 
+            // Store the validators of the source image, if it's cached
+            static ngx_str_t etag = ngx_string("ETag");
+            static ngx_str_t last_modified = ngx_string("Last-Modified");
+            auto store_validator = [&](ngx_str_t *validator) {
+                // A `304 Not Modified` response may update the validators
+                // the source image was revalidated with
+                if (ctx->not_modified &&
+                    (validator->len != value.len ||
+                     ngx_strncmp(validator->data, value.data, value.len) !=
+                         0)) {
+                    ctx->validators_changed = 1;
+                }
+
+                validator->data = ngx_pstrdup(r->pool, &value);
+                validator->len = validator->data != nullptr ? value.len : 0;
+            };
+            if (lc->cache_zone != nullptr && !ctx->redirecting) {
+                if (name.len == etag.len &&
+                    ngx_strncasecmp(name.data, etag.data, etag.len) == 0) {
+                    store_validator(&ctx->etag);
+                } else if (name.len == last_modified.len &&
+                           ngx_strncasecmp(name.data, last_modified.data,
+                                           last_modified.len) == 0) {
+                    store_validator(&ctx->last_modified);
+                }
+            }
+
             continue;
         }
 
@@ -531,17 +580,18 @@ ngx_int_t ngx_weserv_upstream_process_header(ngx_http_request_t *r) {
 
                 // Don't need to store the chunked flag
                 u->headers_in.chunked = 0;
-            } else if (u->headers_in.chunked) {
+            } else if (ctx->not_modified) {
 #else
-            if (u->headers_in.chunked) {
+            if (ctx->not_modified) {
 #endif
+                // A 304 response never has a body
+                u->headers_in.content_length_n = 0;
+                u->headers_in.chunked = 0;
+            } else if (u->headers_in.chunked) {
                 // Clear content length if response is chunked
                 u->headers_in.content_length_n = -1;
             }
 
-            auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
-                ngx_http_get_module_loc_conf(r, ngx_weserv_module));
-
             if (lc->max_size > 0 && u->headers_in.content_length_n >
                                         static_cast<off_t>(lc->max_size)) {
                 ngx_log_error(
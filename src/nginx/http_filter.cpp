@@ -40,6 +40,53 @@ ngx_int_t check_image_too_large(ngx_event_pipe_t *p) {
     return NGX_OK;
 }
 
+/**
+ * Sniff the dimensions of the image from the bytes received so far, so that
+ * an image exceeding the input pixel limit is rejected before it has been
+ * downloaded entirely.
+ */
+ngx_int_t check_image_dimensions(ngx_event_pipe_t *p, ngx_buf_t *b) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(p->input_ctx);
+    if (r == nullptr) {
+        return NGX_ERROR;
+    }
+
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
+    auto *ctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr) {
+        return NGX_ERROR;
+    }
+
+    // The body of a redirect is not an image
+    if (lc->api_conf.limit_input_pixels == 0 || ctx->redirecting) {
+        return NGX_OK;
+    }
+
+    uint64_t pixels;
+    if (ngx_weserv_sniff(&ctx->sniff, b->pos, b->last, &pixels) != NGX_OK ||
+        pixels <= lc->api_conf.limit_input_pixels) {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, p->log, 0,
+                  "upstream is sending an image of %uL pixels, which "
+                  "exceeds the pixel limit",
+                  pixels);
+
+    ctx->response_status = {
+        Status::Code::ImageTooLarge,
+        "Input image exceeds pixel limit. "
+        "Width x height should be less than " +
+            std::to_string(lc->api_conf.limit_input_pixels),
+        Status::ErrorCause::Application};
+
+    return NGX_ERROR;
+}
+
 ngx_int_t ngx_weserv_copy_filter(ngx_event_pipe_t *p, ngx_buf_t *buf) {
     ngx_buf_t *b;
     ngx_chain_t *cl;
@@ -89,6 +136,14 @@ ngx_int_t ngx_weserv_copy_filter(ngx_event_pipe_t *p, ngx_buf_t *buf) {
     }
     p->last_in = &cl->next;
 
+    if (check_image_dimensions(p, b) != NGX_OK) {
+        // Stop reading, the upstream connection is closed since it's not
+        // kept alive
+        p->upstream_done = 1;
+
+        return NGX_HTTP_REQUEST_ENTITY_TOO_LARGE;
+    }
+
     // Is the content length header available?
     if (p->length == -1) {
         if (check_image_too_large(p) != NGX_OK) {
@@ -204,13 +259,19 @@ ngx_int_t ngx_weserv_chunked_filter(ngx_event_pipe_t *p, ngx_buf_t *buf) {
                 buf->pos += (size_t)ctx->chunked.size;
                 b->last = buf->pos;
                 ctx->chunked.size = 0;
-
-                continue;
+            } else {
+                ctx->chunked.size -= buf->last - buf->pos;
+                buf->pos = buf->last;
+                b->last = buf->last;
             }
 
-            ctx->chunked.size -= buf->last - buf->pos;
-            buf->pos = buf->last;
-            b->last = buf->last;
+            if (check_image_dimensions(p, b) != NGX_OK) {
+                // Stop reading, the upstream connection is closed since
+                // it's not kept alive
+                p->upstream_done = 1;
+
+                return NGX_HTTP_REQUEST_ENTITY_TOO_LARGE;
+            }
 
             continue;
         }
@@ -1,9 +1,13 @@
 #include "module.h"
 
 #include "alloc.h"
+#include "cache.h"
+#include "coalesce.h"
 #include "environment.h"
 #include "error.h"
 #include "handler.h"
+#include "header.h"
+#include "status.h"
 #include "stream.h"
 #include "util.h"
 
@@ -20,6 +24,7 @@ namespace {
  */
 char *ngx_weserv(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 char *ngx_weserv_deny_ip(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_weserv_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 /**
  * Configuration - function declarations.
@@ -51,6 +56,21 @@ ngx_int_t ngx_weserv_postconfiguration(ngx_conf_t *cf);
  */
 ngx_int_t ngx_weserv_response_length_variable(
     ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+ngx_int_t ngx_weserv_cache_status_variable(ngx_http_request_t *r,
+                                           ngx_http_variable_value_t *v,
+                                           uintptr_t data);
+ngx_int_t ngx_weserv_canonical_args_variable(ngx_http_request_t *r,
+                                             ngx_http_variable_value_t *v,
+                                             uintptr_t data);
+ngx_int_t ngx_weserv_bytes_saved_variable(ngx_http_request_t *r,
+                                          ngx_http_variable_value_t *v,
+                                          uintptr_t data);
+ngx_int_t ngx_weserv_timings_variable(ngx_http_request_t *r,
+                                      ngx_http_variable_value_t *v,
+                                      uintptr_t data);
+ngx_int_t ngx_weserv_vips_concurrency_variable(ngx_http_request_t *r,
+                                               ngx_http_variable_value_t *v,
+                                               uintptr_t data);
 
 ngx_http_output_header_filter_pt ngx_http_next_header_filter;
 ngx_http_output_body_filter_pt ngx_http_next_body_filter;
@@ -69,6 +89,7 @@ ngx_conf_bitmask_t ngx_weserv_savers[] = {
     {ngx_string("tiff"), static_cast<ngx_uint_t>(Output::Tiff)},
     {ngx_string("gif"), static_cast<ngx_uint_t>(Output::Gif)},
     {ngx_string("json"), static_cast<ngx_uint_t>(Output::Json)},
+    {ngx_string("blurhash"), static_cast<ngx_uint_t>(Output::Blurhash)},
     {ngx_null_string, 0}  // last entry
 };
 
@@ -113,6 +134,36 @@ ngx_command_t ngx_weserv_commands[] = {
      0,
      nullptr},
 
+    {ngx_string("weserv_thread_pool"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_weserv_thread_pool,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     nullptr},
+
+    {ngx_string("weserv_cache_zone"),
+     NGX_HTTP_MAIN_CONF | NGX_CONF_2MORE,
+     ngx_weserv_cache_zone,
+     0,
+     0,
+     nullptr},
+
+    {ngx_string("weserv_cache"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_weserv_cache,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     nullptr},
+
+    {ngx_string("weserv_status"),
+     NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+     ngx_weserv_status,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     nullptr},
+
     {ngx_string("weserv_connect_timeout"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_CONF_TAKE1,
@@ -169,6 +220,30 @@ ngx_command_t ngx_weserv_commands[] = {
      offsetof(ngx_weserv_loc_conf_t, canonical_header),
      nullptr},
 
+    {ngx_string("weserv_coalesce"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, coalesce),
+     nullptr},
+
+    {ngx_string("weserv_stream"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, stream),
+     nullptr},
+
+    {ngx_string("weserv_output_buffer_size"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_conf_set_size_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, output_buffer_size),
+     nullptr},
+
     {ngx_string("weserv_savers"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_CONF_1MORE,
@@ -201,6 +276,30 @@ ngx_command_t ngx_weserv_commands[] = {
      offsetof(ngx_weserv_loc_conf_t, api_conf.limit_input_pixels),
      nullptr},
 
+    {ngx_string("weserv_cost_budget"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.cost_budget),
+     nullptr},
+
+    {ngx_string("weserv_vips_concurrency"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.vips_concurrency),
+     nullptr},
+
+    {ngx_string("weserv_timings"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.timings),
+     nullptr},
+
     {ngx_string("weserv_limit_output_pixels"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
@@ -289,6 +388,14 @@ ngx_command_t ngx_weserv_commands[] = {
      offsetof(ngx_weserv_loc_conf_t, api_conf.fail_on_error),
      nullptr},
 
+    {ngx_string("weserv_exif_thumbnail"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_HTTP_LIF_CONF | NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, api_conf.exif_thumbnail),
+     nullptr},
+
     ngx_null_command  // last entry
 };
 
@@ -298,6 +405,26 @@ ngx_http_variable_t ngx_weserv_vars[] = {
      ngx_weserv_response_length_variable, 0,
      NGX_HTTP_VAR_NOCACHEABLE, 0},
 
+    {ngx_string("weserv_cache_status"), nullptr,
+     ngx_weserv_cache_status_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
+    {ngx_string("weserv_canonical_args"), nullptr,
+     ngx_weserv_canonical_args_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
+    {ngx_string("weserv_bytes_saved"), nullptr,
+     ngx_weserv_bytes_saved_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
+    {ngx_string("weserv_timings"), nullptr,
+     ngx_weserv_timings_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
+    {ngx_string("weserv_vips_concurrency"), nullptr,
+     ngx_weserv_vips_concurrency_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+
     ngx_http_null_variable  // last entry
 };
 // clang-format on
@@ -337,6 +464,140 @@ ngx_int_t ngx_weserv_response_length_variable(ngx_http_request_t *r,
     return NGX_OK;
 }
 
+ngx_int_t ngx_weserv_cache_status_variable(ngx_http_request_t *r,
+                                           ngx_http_variable_value_t *v,
+                                           uintptr_t data) {
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr || ctx->cache_status == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    if (ctx->cache_status == NGX_WESERV_CACHE_HIT) {
+        v->len = sizeof("HIT") - 1;
+        v->data = (u_char *)"HIT";
+    } else if (ctx->cache_status == NGX_WESERV_CACHE_REVALIDATED) {
+        v->len = sizeof("REVALIDATED") - 1;
+        v->data = (u_char *)"REVALIDATED";
+    } else {
+        v->len = sizeof("MISS") - 1;
+        v->data = (u_char *)"MISS";
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+ngx_int_t ngx_weserv_canonical_args_variable(ngx_http_request_t *r,
+                                             ngx_http_variable_value_t *v,
+                                             uintptr_t data) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    std::string canonical =
+        mc->weserv->canonical_query(ngx_weserv_image_args(r));
+
+    v->len = canonical.size();
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    if (v->len == 0) {
+        v->data = (u_char *)"";
+        return NGX_OK;
+    }
+
+    v->data = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, v->len));
+    if (v->data == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(v->data, canonical.data(), v->len);
+
+    return NGX_OK;
+}
+
+ngx_int_t ngx_weserv_bytes_saved_variable(ngx_http_request_t *r,
+                                          ngx_http_variable_value_t *v,
+                                          uintptr_t data) {
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    u_char *p = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, NGX_OFF_T_LEN));
+    if (p == nullptr) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+    v->len = ngx_sprintf(p, "%O", ctx->bytes_saved) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+ngx_int_t ngx_weserv_timings_variable(ngx_http_request_t *r,
+                                      ngx_http_variable_value_t *v,
+                                      uintptr_t data) {
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr || ctx->timings.empty()) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = reinterpret_cast<u_char *>(
+        ngx_pnalloc(r->pool, ctx->timings.size()));
+    if (v->data == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(v->data, ctx->timings.data(), ctx->timings.size());
+
+    v->len = ctx->timings.size();
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+ngx_int_t ngx_weserv_vips_concurrency_variable(ngx_http_request_t *r,
+                                               ngx_http_variable_value_t *v,
+                                               uintptr_t data) {
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr || ctx->vips_concurrency == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, NGX_INT_T_LEN));
+    if (v->data == nullptr) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(v->data, "%i", ctx->vips_concurrency) - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
 /**
  * The module context contains initialization and configuration callbacks.
  */
@@ -415,6 +676,37 @@ char *ngx_weserv_deny_ip(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
     return NGX_CONF_OK;
 }
 
+char *ngx_weserv_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+#if NGX_THREADS
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(conf);
+
+    if (lc->thread_pool != NGX_CONF_UNSET_PTR) {
+        return const_cast<char *>("is duplicate");
+    }
+
+    ngx_str_t *value = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        lc->thread_pool = nullptr;
+        return NGX_CONF_OK;
+    }
+
+    lc->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (lc->thread_pool == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    return NGX_CONF_OK;
+#else
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"%V\" requires nginx to be configured with "
+                       "--with-threads",
+                       &cmd->name);
+
+    return reinterpret_cast<char *>(NGX_CONF_ERROR);
+#endif
+}
+
 /**
  * Create weserv module's main context configuration
  */
@@ -509,12 +801,22 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
     lc->max_size = NGX_CONF_UNSET_SIZE;
     lc->max_redirects = NGX_CONF_UNSET_UINT;
     lc->canonical_header = NGX_CONF_UNSET;
+    lc->coalesce = NGX_CONF_UNSET;
+    lc->stream = NGX_CONF_UNSET;
+    lc->output_buffer_size = NGX_CONF_UNSET_SIZE;
+    lc->cache_zone = reinterpret_cast<ngx_shm_zone_t *>(NGX_CONF_UNSET_PTR);
+#if NGX_THREADS
+    lc->thread_pool = reinterpret_cast<ngx_thread_pool_t *>(NGX_CONF_UNSET_PTR);
+#endif
 
     // API configuration
     lc->api_conf.savers = 0;
     lc->api_conf.process_timeout = NGX_CONF_UNSET;
     lc->api_conf.limit_input_pixels = NGX_CONF_UNSET_UINT;
     lc->api_conf.limit_output_pixels = NGX_CONF_UNSET_UINT;
+    lc->api_conf.cost_budget = NGX_CONF_UNSET_UINT;
+    lc->api_conf.vips_concurrency = NGX_CONF_UNSET;
+    lc->api_conf.timings = NGX_CONF_UNSET;
     lc->api_conf.max_pages = NGX_CONF_UNSET;
     lc->api_conf.quality = NGX_CONF_UNSET;
     lc->api_conf.avif_quality = NGX_CONF_UNSET;
@@ -526,6 +828,7 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
     lc->api_conf.webp_effort = NGX_CONF_UNSET;
     lc->api_conf.zlib_level = NGX_CONF_UNSET;
     lc->api_conf.fail_on_error = NGX_CONF_UNSET;
+    lc->api_conf.exif_thumbnail = NGX_CONF_UNSET;
 
     return lc;
 }
@@ -565,6 +868,24 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
     // Set the rel="canonical" response header by default on proxied images
     ngx_conf_merge_value(conf->canonical_header, prev->canonical_header, 1);
 
+    // Do not coalesce identical fetches and transforms by default
+    ngx_conf_merge_value(conf->coalesce, prev->coalesce, 0);
+
+    // Do not stream processed images by default
+    ngx_conf_merge_value(conf->stream, prev->stream, 0);
+
+    // Write processed images into 32 KiB buffers by default
+    ngx_conf_merge_size_value(conf->output_buffer_size,
+                              prev->output_buffer_size, 32 * 1024);
+
+    // Do not cache processed images by default
+    ngx_conf_merge_ptr_value(conf->cache_zone, prev->cache_zone, nullptr);
+
+#if NGX_THREADS
+    // Process images within the event loop by default
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, nullptr);
+#endif
+
     // All supported savers are enabled by default
     ngx_conf_merge_bitmask_value(
         conf->api_conf.savers, prev->api_conf.savers,
@@ -586,6 +907,17 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
     ngx_conf_merge_uint_value(conf->api_conf.limit_output_pixels,
                               prev->api_conf.limit_output_pixels, 71000000);
 
+    // Do not limit the processing budget by default
+    ngx_conf_merge_uint_value(conf->api_conf.cost_budget,
+                              prev->api_conf.cost_budget, 0);
+
+    // Leave the number of libvips worker threads up to libvips by default
+    ngx_conf_merge_value(conf->api_conf.vips_concurrency,
+                         prev->api_conf.vips_concurrency, 0);
+
+    // Do not measure the timings of the pipeline by default
+    ngx_conf_merge_value(conf->api_conf.timings, prev->api_conf.timings, 0);
+
     // The default quality of 80 usually produces excellent results
     ngx_conf_merge_value(conf->api_conf.quality, prev->api_conf.quality, 80);
     ngx_conf_merge_value(conf->api_conf.avif_quality,
@@ -613,6 +945,10 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
     ngx_conf_merge_value(conf->api_conf.fail_on_error,
                          prev->api_conf.fail_on_error, 0);
 
+    // Do not use embedded EXIF thumbnails by default
+    ngx_conf_merge_value(conf->api_conf.exif_thumbnail,
+                         prev->api_conf.exif_thumbnail, 0);
+
     return NGX_CONF_OK;
 }
 
@@ -632,7 +968,8 @@ ngx_int_t ngx_weserv_init_process(ngx_cycle_t *cycle) {
 
     api::ApiManagerFactory weserv_factory;
     mc->weserv = weserv_factory.create_api_manager(
-        std::unique_ptr<api::ApiEnvInterface>(new NgxEnvironment(cycle->log)));
+        std::unique_ptr<api::ApiEnvInterface>(
+            new NgxEnvironment(cycle->log, mc->status_zone)));
 
     return NGX_OK;
 }
@@ -706,34 +1043,78 @@ ngx_int_t ngx_weserv_finish_debug(ngx_http_request_t *r, ngx_chain_t *out) {
 #endif
 
 ngx_int_t ngx_weserv_image_filter_buffer(ngx_http_request_t *r,
+                                         ngx_weserv_loc_conf_t *lc,
                                          ngx_weserv_base_ctx_t *ctx,
                                          ngx_chain_t *in) {
     ngx_chain_t *cl, **ll;
 
     r->connection->buffered |= NGX_WESERV_IMAGE_BUFFERED;
 
+    off_t content_length = r->headers_out.content_length_n;
+
+    // If the length of the image is known, buffer it into a single
+    // contiguous memory area, which allows it to be loaded without copying
+    // it again (see NgxSource::memory)
+    if (ctx->in == nullptr && content_length > 0 &&
+        (lc->max_size == 0 || content_length <= (off_t)lc->max_size)) {
+        ngx_buf_t *buf = ngx_create_temp_buf(r->pool, content_length);
+        if (buf == nullptr) {
+            return NGX_ERROR;
+        }
+
+        buf->tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == nullptr) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = buf;
+        cl->next = nullptr;
+
+        ctx->in = cl;
+    }
+
     ll = &ctx->in;
+    ngx_buf_t *last = nullptr;
 
     for (cl = ctx->in; cl; cl = cl->next) {
         ll = &cl->next;
+        last = cl->buf;
     }
 
     bool buffering = true;
 
     while (in) {
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == nullptr) {
-            return NGX_ERROR;
-        }
-
         ngx_buf_t *b = in->buf;
 
         size_t size = b->last - b->pos;
 
+        ctx->bytes_in += size;
+
         if (b->flush || b->last_buf) {
             buffering = false;
         }
 
+        // Append to the previous buffer if there's enough room left
+        if (size && last != nullptr &&
+            last->tag == (ngx_buf_tag_t)&ngx_weserv_module &&
+            (size_t)(last->end - last->last) >= size) {
+            last->last = ngx_cpymem(last->last, b->pos, size);
+            last->last_buf = b->last_buf;
+
+            // Mark the buffer as consumed
+            b->pos = b->last;
+
+            in = in->next;
+            continue;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == nullptr) {
+            return NGX_ERROR;
+        }
+
         if (buffering && size) {
             ngx_buf_t *buf = ngx_create_temp_buf(r->pool, size);
             if (buf == nullptr) {
@@ -756,6 +1137,7 @@ ngx_int_t ngx_weserv_image_filter_buffer(ngx_http_request_t *r,
 
         *ll = cl;
         ll = &cl->next;
+        last = cl->buf;
         in = in->next;
     }
 
@@ -778,8 +1160,602 @@ void ngx_weserv_image_filter_free_buf(ngx_http_request_t *r,
     ctx->in = nullptr;
 }
 
+ngx_int_t ngx_weserv_image_send(ngx_http_request_t *r,
+                                ngx_weserv_base_ctx_t *ctx,
+                                ngx_weserv_upstream_ctx_t *upstream_ctx,
+                                const Status &status, ngx_chain_t *out) {
+    r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
+
+    // We release the memory as soon as the output of an image is finished
+    // and don't wait for an entire response to be sent to the client
+    ngx_weserv_image_filter_free_buf(r, ctx);
+
+    if (!status.ok()) {
+        // The image was partially streamed, so all we can do is to
+        // terminate the response
+        if (r->header_sent) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "weserv: could not finish streaming the processed "
+                          "image: %s",
+                          status.message().c_str());
+            return NGX_ERROR;
+        }
+
+        ngx_chain_t error;
+        if (ngx_weserv_return_error(r, upstream_ctx, status, &error) !=
+            NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return ngx_weserv_finish(r, &error);
+    }
+
+    if (set_server_timing_header(r, ctx->timings) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (is_base64_needed(r) && output_chain_to_base64(r, out) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_weserv_finish(r, out);
+}
+
+/**
+ * Store the validators of the source image along with the cache key of the
+ * image processed from it, so that the source image can be revalidated
+ * instead of being fetched again. This is done once the processed image is
+ * stored, or when a revalidation responded with other validators.
+ */
+void ngx_weserv_image_store_validators(
+    ngx_http_request_t *r, ngx_weserv_loc_conf_t *lc,
+    ngx_weserv_base_ctx_t *ctx, ngx_weserv_upstream_ctx_t *upstream_ctx) {
+    if (upstream_ctx == nullptr ||
+        (upstream_ctx->etag.len == 0 && upstream_ctx->last_modified.len == 0)) {
+        return;
+    }
+
+    if (ngx_weserv_cache_put_validators(
+            lc->cache_zone, upstream_ctx->validators_key, upstream_ctx->etag,
+            upstream_ctx->last_modified, ctx->cache_key) == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "weserv: could not store the validators of the source "
+                      "image in cache zone \"%V\"",
+                      &lc->cache_zone->shm.name);
+    }
+}
+
+ngx_int_t ngx_weserv_image_send_buffered(ngx_http_request_t *r,
+                                         ngx_weserv_loc_conf_t *lc,
+                                         ngx_weserv_base_ctx_t *ctx) {
+    ngx_weserv_upstream_ctx_t *upstream_ctx =
+        lc->mode == NGX_WESERV_PROXY_MODE
+            ? reinterpret_cast<ngx_weserv_upstream_ctx_t *>(ctx)
+            : nullptr;
+
+    ngx_chain_t *out = nullptr;
+
+    if (ctx->status.ok()) {
+        if (ctx->cache_status == NGX_WESERV_CACHE_MISS) {
+            ngx_int_t rc = ngx_weserv_cache_put(lc->cache_zone, ctx->cache_key,
+                                                ctx->extension, ctx->output);
+            if (rc == NGX_ERROR) {
+                ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                              "weserv: could not store the processed image in "
+                              "cache zone \"%V\"",
+                              &lc->cache_zone->shm.name);
+            } else if (rc == NGX_OK) {
+                ngx_weserv_image_store_validators(r, lc, ctx, upstream_ctx);
+            }
+        } else if (ctx->cache_status == NGX_WESERV_CACHE_REVALIDATED &&
+                   upstream_ctx->validators_changed) {
+            ngx_weserv_image_store_validators(r, lc, ctx, upstream_ctx);
+        }
+
+        NgxTarget target(r, upstream_ctx, &out);
+        target.setup(ctx->extension);
+
+        if (target.write(ctx->output.data(), ctx->output.size()) == -1 ||
+            target.end() != 0) {
+            return NGX_ERROR;
+        }
+    }
+
+    // Release the memory of the buffered output
+    std::string().swap(ctx->output);
+
+    return ngx_weserv_image_send(r, ctx, upstream_ctx, ctx->status, out);
+}
+
+/**
+ * Process the variants of a `&srcset=` request that weren't served from the
+ * cache, all from a single decode of the buffered image. The request pool
+ * isn't touched, so that this can be run within a thread.
+ */
+void ngx_weserv_image_srcset_process(ngx_weserv_main_conf_t *mc,
+                                     ngx_weserv_loc_conf_t *lc,
+                                     ngx_weserv_base_ctx_t *ctx) {
+    ngx_weserv_srcset_t *srcset = ctx->srcset.get();
+
+    std::vector<size_t> pending;
+    std::vector<std::string> queries;
+    std::vector<std::unique_ptr<api::io::TargetInterface>> targets;
+
+    for (size_t i = 0; i < srcset->queries.size(); ++i) {
+        if (srcset->cached[i]) {
+            continue;
+        }
+
+        pending.push_back(i);
+        queries.push_back(srcset->queries[i]);
+        targets.emplace_back(new NgxMemoryTarget(&srcset->extensions[i],
+                                                 &srcset->outputs[i]));
+    }
+
+    if (pending.empty()) {
+        return;
+    }
+
+    std::vector<Status> statuses = mc->weserv->process_batch(
+        queries,
+        std::unique_ptr<api::io::SourceInterface>(
+            new NgxSource(ctx->in, &ctx->bytes_saved)),
+        std::move(targets), lc->api_conf);
+    ctx->vips_concurrency = ngx_weserv_take_concurrency();
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        srcset->statuses[pending[i]] = statuses[i];
+    }
+}
+
+/**
+ * Send the variants of a `&srcset=` request as a multipart/mixed response.
+ * The headers and the output of each part are passed as separate chain links,
+ * so that the outputs are sent without copying them. Variants that could not
+ * be processed are left out.
+ */
+ngx_int_t ngx_weserv_image_send_srcset(ngx_http_request_t *r,
+                                       ngx_weserv_loc_conf_t *lc,
+                                       ngx_weserv_base_ctx_t *ctx) {
+    ngx_weserv_upstream_ctx_t *upstream_ctx =
+        lc->mode == NGX_WESERV_PROXY_MODE
+            ? reinterpret_cast<ngx_weserv_upstream_ctx_t *>(ctx)
+            : nullptr;
+
+    // The image could not be handed to the thread pool
+    if (!ctx->status.ok()) {
+        return ngx_weserv_image_send(r, ctx, upstream_ctx, ctx->status,
+                                     nullptr);
+    }
+
+    ngx_weserv_srcset_t *srcset = ctx->srcset.get();
+
+    // Push the processed variants into the cache, so that requests for a
+    // single width are served from it
+    for (size_t i = 0; lc->cache_zone != nullptr && i < srcset->queries.size();
+         ++i) {
+        if (srcset->cached[i] || !srcset->statuses[i].ok()) {
+            continue;
+        }
+
+        if (ngx_weserv_cache_put(lc->cache_zone,
+                                 &srcset->keys[i * NGX_WESERV_CACHE_KEY_LEN],
+                                 srcset->extensions[i],
+                                 srcset->outputs[i]) == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "weserv: could not store the processed image in "
+                          "cache zone \"%V\"",
+                          &lc->cache_zone->shm.name);
+        }
+    }
+
+    r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
+    ngx_weserv_image_filter_free_buf(r, ctx);
+
+    u_char boundary[NGX_INT32_LEN * 2];
+    size_t boundary_len =
+        ngx_sprintf(boundary, "%08xD%08xD", ngx_random(), ngx_random()) -
+        boundary;
+
+    ngx_chain_t *out = nullptr;
+    ngx_chain_t **ll = &out;
+    off_t content_length = 0;
+
+    auto append = [&](ngx_buf_t *b) {
+        ngx_chain_t *cl = ngx_alloc_chain_link(r->pool);
+        if (cl == nullptr) {
+            return false;
+        }
+
+        cl->buf = b;
+        cl->next = nullptr;
+
+        *ll = cl;
+        ll = &cl->next;
+
+        content_length += b->last - b->pos;
+
+        return true;
+    };
+
+    const Status *failure = nullptr;
+    for (size_t i = 0; i < srcset->queries.size(); ++i) {
+        if (!srcset->statuses[i].ok()) {
+            if (failure == nullptr) {
+                failure = &srcset->statuses[i];
+            }
+            continue;
+        }
+
+        const std::string &width = srcset->widths[i];
+        const std::string &output = srcset->outputs[i];
+        ngx_str_t mime_type = extension_to_mime_type(srcset->extensions[i]);
+
+        // The line break that precedes a boundary belongs to it, so it's
+        // prepended to the headers of all but the first part
+        size_t len = sizeof(CRLF "--") - 1 + boundary_len +
+                     sizeof(CRLF "Content-Type: ") - 1 + mime_type.len +
+                     sizeof(CRLF "Content-Length: ") - 1 + NGX_SIZE_T_LEN +
+                     sizeof(CRLF "X-Width: ") - 1 + width.size() +
+                     sizeof(CRLF CRLF) - 1;
+
+        ngx_buf_t *b = ngx_create_temp_buf(r->pool, len);
+        if (b == nullptr) {
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_sprintf(b->pos,
+                              "%s--%*s" CRLF "Content-Type: %V" CRLF
+                              "Content-Length: %uz" CRLF "X-Width: %*s" CRLF
+                              CRLF,
+                              out == nullptr ? "" : CRLF, boundary_len,
+                              boundary, &mime_type, output.size(),
+                              width.size(), width.data());
+
+        if (!append(b)) {
+            return NGX_ERROR;
+        }
+
+        if (output.empty()) {
+            continue;
+        }
+
+        // The output is held within the module context until the request
+        // is finalized, so it's referenced instead of copied
+        b = ngx_calloc_buf(r->pool);
+        if (b == nullptr) {
+            return NGX_ERROR;
+        }
+
+        b->start =
+            reinterpret_cast<u_char *>(const_cast<char *>(output.data()));
+        b->pos = b->start;
+        b->last = b->start + output.size();
+        b->end = b->last;
+        b->memory = 1;
+
+        if (!append(b)) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (out == nullptr) {
+        ngx_chain_t error;
+        if (ngx_weserv_return_error(r, upstream_ctx, *failure, &error) !=
+            NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return ngx_weserv_finish(r, &error);
+    }
+
+    ngx_buf_t *b = ngx_create_temp_buf(
+        r->pool, sizeof(CRLF "--" "--" CRLF) - 1 + boundary_len);
+    if (b == nullptr) {
+        return NGX_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->pos, CRLF "--%*s--" CRLF, boundary_len, boundary);
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    if (!append(b)) {
+        return NGX_ERROR;
+    }
+
+    ngx_str_t boundary_str = {boundary_len, boundary};
+    if (ngx_weserv_set_multipart_headers(r, upstream_ctx, boundary_str,
+                                         content_length) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_weserv_finish(r, out);
+}
+
+void ngx_weserv_image_key(ngx_http_request_t *r, ngx_weserv_loc_conf_t *lc,
+                          ngx_weserv_base_ctx_t *ctx) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    ngx_weserv_cache_key(mc->weserv->canonical_query(ngx_weserv_image_args(r)),
+                         lc->api_conf, ctx->in, ctx->cache_key);
+}
+
+ngx_int_t
+ngx_weserv_image_cache_lookup(ngx_http_request_t *r, ngx_weserv_loc_conf_t *lc,
+                              ngx_weserv_base_ctx_t *ctx,
+                              ngx_weserv_upstream_ctx_t *upstream_ctx) {
+    ngx_chain_t *out = nullptr;
+    NgxTarget target(r, upstream_ctx, &out);
+
+    ngx_int_t rc =
+        ngx_weserv_cache_get(lc->cache_zone, ctx->cache_key, &target);
+    if (rc == NGX_DECLINED) {
+        ctx->cache_status = NGX_WESERV_CACHE_MISS;
+        return NGX_DECLINED;
+    }
+
+    if (rc != NGX_OK || target.end() != 0) {
+        return NGX_ERROR;
+    }
+
+    ctx->cache_status = NGX_WESERV_CACHE_HIT;
+
+    return ngx_weserv_image_send(r, ctx, upstream_ctx, Status::OK, out);
+}
+
+#if NGX_THREADS
+void ngx_weserv_image_thread_handler(void *data, ngx_log_t *log) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(data);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "weserv image thread handler");
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    // The request pool must not be touched within this thread, so let the
+    // API write to a std::string that we pass down once we're back on the
+    // event loop
+    if (ctx->srcset != nullptr) {
+        ngx_weserv_image_srcset_process(mc, lc, ctx);
+    } else {
+        ctx->status = mc->weserv->process(
+            ngx_weserv_image_args(r),
+            std::unique_ptr<api::io::SourceInterface>(
+                new NgxSource(ctx->in, &ctx->bytes_saved)),
+            std::unique_ptr<api::io::TargetInterface>(
+                new NgxMemoryTarget(&ctx->extension, &ctx->output)),
+            lc->api_conf);
+        ctx->timings = ngx_weserv_take_timings();
+        ctx->vips_concurrency = ngx_weserv_take_concurrency();
+    }
+
+    ngx_weserv_status_queue(mc->status_zone, -1);
+}
+
+void ngx_weserv_image_thread_event_handler(ngx_event_t *ev) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(ev->data);
+    ngx_connection_t *c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "weserv image thread: \"%V?%V\"", &r->uri, &r->args);
+
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    // Pass the processed image to the identical requests waiting for it,
+    // which are resumed by this handler as well
+    ngx_weserv_coalesce_transform_done(ctx,
+                                       ngx_weserv_image_thread_event_handler);
+
+    ctx->processing = 0;
+    ctx->processed = 1;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    if (r->done) {
+        // Trigger the connection event handler if the request was already
+        // finalized, e.g. when the client closed the connection prematurely
+        c->write->handler(c->write);
+    } else {
+        // This will eventually call the body filter (with an empty chain),
+        // which picks up the processed image
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+ngx_int_t ngx_weserv_image_thread_post(ngx_http_request_t *r,
+                                       ngx_weserv_loc_conf_t *lc,
+                                       ngx_weserv_base_ctx_t *ctx) {
+    ngx_thread_task_t *task = ngx_thread_task_alloc(r->pool, 0);
+    if (task != nullptr) {
+        task->ctx = r;
+        task->handler = ngx_weserv_image_thread_handler;
+        task->event.data = r;
+        task->event.handler = ngx_weserv_image_thread_event_handler;
+    }
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    // Counted until the thread has finished, including the time spent
+    // waiting within the queue of the thread pool
+    ngx_weserv_status_queue(mc->status_zone, 1);
+
+    if (task == nullptr ||
+        ngx_thread_task_post(lc->thread_pool, task) != NGX_OK) {
+        ngx_weserv_status_queue(mc->status_zone, -1);
+
+        // Don't leave the requests waiting for this transform hanging
+        ctx->status = {NGX_ERROR, "Unable to process the image"};
+        ngx_weserv_coalesce_transform_done(
+            ctx, ngx_weserv_image_thread_event_handler);
+
+        return NGX_ERROR;
+    }
+
+    ctx->processing = 1;
+
+    // Keep the request alive (and the image buffered) until the thread
+    // has finished
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_AGAIN;
+}
+#endif
+
+/**
+ * Render each width of `&srcset=` from a single decode of the buffered image
+ * and send them as a multipart/mixed response. Cached variants are served
+ * from the cache zone, the others are processed within the thread pool (if
+ * configured) and identical srcsets are coalesced, as for a single image.
+ */
+ngx_int_t ngx_weserv_image_srcset(ngx_http_request_t *r,
+                                  ngx_weserv_loc_conf_t *lc,
+                                  ngx_weserv_base_ctx_t *ctx,
+                                  ngx_weserv_upstream_ctx_t *upstream_ctx,
+                                  const ngx_str_t &arg) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    std::string args = ngx_weserv_image_args(r);
+
+    ctx->srcset.reset(new ngx_weserv_srcset_t);
+    ngx_weserv_srcset_t *srcset = ctx->srcset.get();
+
+    // One variant for each width, e.g. `&srcset=320,640,960`
+    u_char *p = arg.data;
+    u_char *last = p + arg.len;
+    while (p < last && srcset->queries.size() < NGX_WESERV_SRCSET_MAX) {
+        u_char *end = ngx_strlchr(p, last, ',');
+        if (end == nullptr) {
+            end = last;
+        }
+
+        ngx_int_t width = ngx_atoi(p, end - p);
+        if (width > 0) {
+            srcset->widths.emplace_back(reinterpret_cast<char *>(p), end - p);
+            srcset->queries.push_back("w=" + srcset->widths.back() + "&" +
+                                      args);
+        }
+
+        p = end + 1;
+    }
+
+    size_t count = srcset->queries.size();
+    if (count == 0) {
+        r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
+        ngx_weserv_image_filter_free_buf(r, ctx);
+
+        ngx_chain_t error;
+        if (ngx_weserv_return_error(
+                r, upstream_ctx,
+                {Status::Code::InvalidUri, "Invalid srcset widths",
+                 Status::ErrorCause::Application},
+                &error) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return ngx_weserv_finish(r, &error);
+    }
+
+    srcset->cached.assign(count, false);
+    srcset->statuses.assign(count, Status::OK);
+    srcset->extensions.resize(count);
+    srcset->outputs.resize(count);
+
+    size_t pending = count;
+
+    // The cache keys are calculated before the buffered image is consumed.
+    // Cached variants are held in memory, since they could be evicted from
+    // the cache zone while the other variants are processed.
+    if (lc->cache_zone != nullptr) {
+        srcset->keys.resize(count * NGX_WESERV_CACHE_KEY_LEN);
+
+        for (size_t i = 0; i < count; ++i) {
+            u_char *key = &srcset->keys[i * NGX_WESERV_CACHE_KEY_LEN];
+            ngx_weserv_cache_key(
+                mc->weserv->canonical_query(srcset->queries[i]), lc->api_conf,
+                ctx->in, key);
+
+            NgxMemoryTarget target(&srcset->extensions[i],
+                                   &srcset->outputs[i]);
+            if (ngx_weserv_cache_get(lc->cache_zone, key, &target) ==
+                NGX_OK) {
+                srcset->cached[i] = true;
+                --pending;
+            } else {
+                std::string().swap(srcset->outputs[i]);
+            }
+        }
+    }
+
+    if (pending == 0) {
+        return ngx_weserv_image_send_srcset(r, lc, ctx);
+    }
+
+#if NGX_THREADS
+    if (lc->thread_pool != nullptr) {
+        if (lc->coalesce) {
+            // The key of a single image doesn't cover the widths
+            ngx_weserv_cache_key(mc->weserv->canonical_query(args) +
+                                     "&srcset=" + ngx_str_to_std(arg),
+                                 lc->api_conf, ctx->in, ctx->cache_key);
+
+            if (ngx_weserv_coalesce_transform(r, lc, ctx) != NGX_OK) {
+                return NGX_AGAIN;
+            }
+        }
+
+        return ngx_weserv_image_thread_post(r, lc, ctx);
+    }
+#endif
+
+    ngx_weserv_status_queue(mc->status_zone, 1);
+
+    ngx_weserv_image_srcset_process(mc, lc, ctx);
+
+    ngx_weserv_status_queue(mc->status_zone, -1);
+
+    return ngx_weserv_image_send_srcset(r, lc, ctx);
+}
+
 ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
     if (in == nullptr) {
+#if NGX_THREADS
+        auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+            ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+        if (r == r->main && ctx != nullptr) {
+            // Still busy processing the image within a thread
+            if (ctx->processing) {
+                return NGX_AGAIN;
+            }
+
+            if (ctx->processed) {
+                ctx->processed = 0;
+
+                auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+                    ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
+                if (ctx->srcset != nullptr) {
+                    return ngx_weserv_image_send_srcset(r, lc, ctx);
+                }
+
+                return ngx_weserv_image_send_buffered(r, lc, ctx);
+            }
+        }
+#endif
+
         return ngx_http_next_body_filter(r, in);
     }
 
@@ -842,6 +1818,9 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
             && !debug_output
 #endif
         ) {
+            // Pass the failure to the requests waiting for this fetch
+            ngx_weserv_coalesce_fetch_done(r, upstream_ctx);
+
             ngx_chain_t out;
             if (ngx_weserv_return_error(r, upstream_ctx,
                                         upstream_ctx->response_status,
@@ -853,7 +1832,14 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
         }
     }
 
-    switch (ngx_weserv_image_filter_buffer(r, ctx, in)) {
+#if NGX_THREADS
+    // Any further data is ignored while the image is being processed
+    if (ctx->processing) {
+        return NGX_AGAIN;
+    }
+#endif
+
+    switch (ngx_weserv_image_filter_buffer(r, lc, ctx, in)) {
         case NGX_OK:
             return NGX_OK;
         case NGX_DONE:
@@ -863,6 +1849,11 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
             return NGX_ERROR;
     }
 
+    if (upstream_ctx != nullptr) {
+        // Pass the fetched image to the requests waiting for this fetch
+        ngx_weserv_coalesce_fetch_done(r, upstream_ctx);
+    }
+
 #if NGX_DEBUG
     if (debug_output) {
         r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
@@ -871,38 +1862,100 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
     }
 #endif
 
+    // The source image was not modified since the image was processed from
+    // it, so the stored output is sent as is
+    if (upstream_ctx != nullptr && upstream_ctx->not_modified) {
+        ctx->cache_status = NGX_WESERV_CACHE_REVALIDATED;
+
+        return ngx_weserv_image_send_buffered(r, lc, ctx);
+    }
+
+    // Render all widths of a srcset from a single decode
+    ngx_str_t srcset;
+    if (ngx_http_arg(r, (u_char *)"srcset", 6, &srcset) == NGX_OK) {
+        return ngx_weserv_image_srcset(r, lc, ctx, upstream_ctx, srcset);
+    }
+
+    if (lc->cache_zone != nullptr) {
+        ngx_weserv_image_key(r, lc, ctx);
+
+        ngx_int_t rc = ngx_weserv_image_cache_lookup(r, lc, ctx, upstream_ctx);
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+#if NGX_THREADS
+    if (lc->thread_pool != nullptr) {
+        // Identical transforms are only coalesced when offloaded to a
+        // thread pool, since they're serialized within the event loop
+        // otherwise
+        if (lc->coalesce) {
+            if (lc->cache_zone == nullptr) {
+                ngx_weserv_image_key(r, lc, ctx);
+            }
+
+            if (ngx_weserv_coalesce_transform(r, lc, ctx) != NGX_OK) {
+                return NGX_AGAIN;
+            }
+        }
+
+        return ngx_weserv_image_thread_post(r, lc, ctx);
+    }
+#endif
+
     auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
         ngx_http_get_module_main_conf(r, ngx_weserv_module));
 
+    // Process into memory on a cache miss, so that the output can be stored
+    if (ctx->cache_status == NGX_WESERV_CACHE_MISS) {
+        ngx_weserv_status_queue(mc->status_zone, 1);
+
+        ctx->status = mc->weserv->process(
+            ngx_weserv_image_args(r),
+            std::unique_ptr<api::io::SourceInterface>(
+            new NgxSource(ctx->in, &ctx->bytes_saved)),
+            std::unique_ptr<api::io::TargetInterface>(
+                new NgxMemoryTarget(&ctx->extension, &ctx->output)),
+            lc->api_conf);
+        ctx->timings = ngx_weserv_take_timings();
+        ctx->vips_concurrency = ngx_weserv_take_concurrency();
+
+        ngx_weserv_status_queue(mc->status_zone, -1);
+
+        return ngx_weserv_image_send_buffered(r, lc, ctx);
+    }
+
+    // Base64-encoded images and HEAD requests are never streamed
+    bool stream = lc->stream && !is_base64_needed(r) &&
+                  r->method != NGX_HTTP_HEAD;
+
+    ngx_weserv_status_queue(mc->status_zone, 1);
+
     ngx_chain_t *out = nullptr;
     Status status = mc->weserv->process(
-        ngx_str_to_std(r->args),
-        std::unique_ptr<api::io::SourceInterface>(new NgxSource(ctx->in)),
-        std::unique_ptr<api::io::TargetInterface>(
-            new NgxTarget(r, upstream_ctx, &out)),
+        ngx_weserv_image_args(r),
+        std::unique_ptr<api::io::SourceInterface>(
+            new NgxSource(ctx->in, &ctx->bytes_saved)),
+        std::unique_ptr<api::io::TargetInterface>(new NgxStreamTarget(
+            r, upstream_ctx, ngx_http_next_header_filter,
+            ngx_http_next_body_filter, lc->output_buffer_size, stream, &out)),
         lc->api_conf);
+    ctx->timings = ngx_weserv_take_timings();
+    ctx->vips_concurrency = ngx_weserv_take_concurrency();
 
-    r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
+    ngx_weserv_status_queue(mc->status_zone, -1);
 
-    // We release the memory as soon as the output of an image is finished
-    // and don't wait for an entire response to be sent to the client
-    ngx_weserv_image_filter_free_buf(r, ctx);
-
-    if (!status.ok()) {
-        ngx_chain_t error;
-        if (ngx_weserv_return_error(r, upstream_ctx, status, &error) !=
-            NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (status.ok() && r->header_sent) {
+        r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
 
-        return ngx_weserv_finish(r, &error);
-    }
+        ngx_weserv_image_filter_free_buf(r, ctx);
 
-    if (is_base64_needed(r) && output_chain_to_base64(r, out) != NGX_OK) {
-        return NGX_ERROR;
+        // The image has been streamed already, so just flush what's left
+        return ngx_http_next_body_filter(r, nullptr);
     }
 
-    return ngx_weserv_finish(r, out);
+    return ngx_weserv_image_send(r, ctx, upstream_ctx, status, out);
 }
 
 /*
@@ -937,7 +1990,7 @@ ngx_int_t ngx_weserv_postconfiguration(ngx_conf_t *cf) {
     ngx_http_next_body_filter = ngx_http_top_body_filter;
     ngx_http_top_body_filter = ngx_weserv_image_body_filter;
 
-    return NGX_OK;
+    return ngx_weserv_status_init(cf);
 }
 
 }  // namespace
@@ -7,17 +7,46 @@ extern "C" {
 #include <weserv/api_manager.h>
 #include <weserv/config.h>
 
+#include "cache.h"
 #include "http_request.h"
+#include "sniff.h"
 
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #define NGX_WESERV_IMAGE_BUFFERED 0x08
 
+#define NGX_WESERV_SRCSET_MAX 16
+
 #define NGX_WESERV_PROXY_MODE 0
 #define NGX_WESERV_FILTER_MODE 1
 
 namespace weserv::nginx {
 
+struct ngx_weserv_flight_t;
+
+using ngx_weserv_flights_t =
+    std::unordered_map<std::string, ngx_weserv_flight_t *>;
+
+/**
+ * An in-flight upstream fetch or image transform of a worker process, which
+ * identical requests can wait for instead of duplicating it.
+ */
+struct ngx_weserv_flight_t {
+    /**
+     * The registry and key this flight is stored under.
+     */
+    ngx_weserv_flights_t *flights;
+    std::string key;
+
+    /**
+     * The requests waiting for the leading request to finish.
+     */
+    std::vector<ngx_http_request_t *> waiters;
+};
+
 /**
  * weserv Module Configuration - main context.
  */
@@ -26,6 +55,19 @@ struct ngx_weserv_main_conf_t {
      * The module-level API Manager interface.
      */
     std::shared_ptr<api::ApiManager> weserv;
+
+    /**
+     * In-flight upstream fetches and image transforms of this worker
+     * process, see coalesce.h.
+     */
+    ngx_weserv_flights_t fetches;
+    ngx_weserv_flights_t transforms;
+
+    /**
+     * Shared memory zone used to aggregate the statistics of all worker
+     * processes, or nullptr if the `weserv_status` directive isn't used.
+     */
+    ngx_shm_zone_t *status_zone;
 };
 
 /**
@@ -58,12 +100,64 @@ struct ngx_weserv_loc_conf_t {
     ngx_uint_t max_redirects;
 
     ngx_flag_t canonical_header;
+
+    ngx_flag_t coalesce;
+
+    ngx_flag_t stream;
+
+    size_t output_buffer_size;
+
+    /**
+     * Shared memory zone used to cache processed images, or nullptr to
+     * disable caching.
+     */
+    ngx_shm_zone_t *cache_zone;
+
+#if NGX_THREADS
+    /**
+     * Thread pool used to offload image processing from the event loop,
+     * or nullptr to process images within the event loop.
+     */
+    ngx_thread_pool_t *thread_pool;
+#endif
+};
+
+/**
+ * The variants of a `&srcset=` request, one for each width.
+ */
+struct ngx_weserv_srcset_t {
+    /**
+     * The widths and the query of each variant. The width is prepended to
+     * the query, so that it takes precedence over any `&w=` given.
+     */
+    std::vector<std::string> widths;
+    std::vector<std::string> queries;
+
+    /**
+     * The cache key of each variant (NGX_WESERV_CACHE_KEY_LEN bytes each),
+     * only set when caching is enabled, and whether the variant was served
+     * from the cache.
+     */
+    std::vector<u_char> keys;
+    std::vector<bool> cached;
+
+    /**
+     * The status, file extension and output buffer of each variant.
+     */
+    std::vector<api::utils::Status> statuses;
+    std::vector<std::string> extensions;
+    std::vector<std::string> outputs;
 };
 
 /**
  * Base runtime state of the weserv module.
  */
 struct ngx_weserv_base_ctx_t {
+    /**
+     * Constructor.
+     */
+    ngx_weserv_base_ctx_t() : status(NGX_OK, "") {}
+
     /**
      * Make a polymorphic type.
      */
@@ -73,6 +167,68 @@ struct ngx_weserv_base_ctx_t {
      * The incoming chain.
      */
     ngx_chain_t *in;
+
+    /**
+     * The number of bytes of the incoming chain that were loaded without
+     * copying, see NgxSource::memory.
+     */
+    off_t bytes_saved;
+
+    /**
+     * The number of bytes of the source image that were received.
+     */
+    off_t bytes_in;
+
+    /**
+     * The per-stage timings of the processed image, formatted as a
+     * `Server-Timing` header value. Only set when `weserv_timings` is enabled.
+     */
+    std::string timings;
+
+    /**
+     * The maximum number of libvips worker threads the image (or the largest
+     * of its variants) was allowed to use, see `weserv_vips_concurrency`.
+     */
+    ngx_int_t vips_concurrency;
+
+#if NGX_THREADS
+    /**
+     * Image processing offloaded to a thread pool.
+     */
+    unsigned processing : 1;
+    unsigned processed : 1;
+#endif
+
+    /**
+     * The status, file extension and output buffer of an image processed
+     * into memory, i.e. when offloaded to a thread pool or when the output
+     * needs to be cached.
+     */
+    api::utils::Status status;
+    std::string extension;
+    std::string output;
+
+    /**
+     * The variants of a `&srcset=` request, or nullptr for a single image.
+     */
+    std::unique_ptr<ngx_weserv_srcset_t> srcset;
+
+    /**
+     * The cache key and status (NGX_WESERV_CACHE_*) of the processed image.
+     * The key is only set when caching or the coalescing of image transforms
+     * is enabled, the status only when caching is enabled.
+     */
+    u_char cache_key[NGX_WESERV_CACHE_KEY_LEN];
+    ngx_uint_t cache_status;
+
+    /**
+     * The in-flight upstream fetch or image transform this request leads or
+     * waits for, and the event used to resume a waiting request.
+     */
+    ngx_weserv_flight_t *flight;
+    ngx_event_t flight_event;
+    unsigned flight_leader : 1;
+    unsigned flight_cleanup : 1;
 };
 
 /**
@@ -133,6 +289,42 @@ struct ngx_weserv_upstream_ctx_t : ngx_weserv_base_ctx_t {
      */
     api::utils::Status response_status;
 
+    /**
+     * State of sniffing the dimensions of the image while it's being
+     * received, see check_image_dimensions.
+     */
+    ngx_weserv_sniff_t sniff;
+
+    /**
+     * Validators of the source image (the `ETag` and `Last-Modified`
+     * response headers), stored along with the processed image so that it
+     * can be revalidated later on. Only set when caching is enabled.
+     */
+    ngx_str_t etag;
+    ngx_str_t last_modified;
+
+    /**
+     * The key under which the validators are stored, see
+     * ngx_weserv_cache_validators_key.
+     */
+    u_char validators_key[NGX_WESERV_CACHE_KEY_LEN];
+
+    /**
+     * Set when the source image is fetched with a conditional request, in
+     * which case the previously processed image is held within the output
+     * buffer. not_modified is set once the upstream server responded with
+     * `304 Not Modified`, i.e. the output can be sent as is.
+     */
+    unsigned revalidating : 1;
+    unsigned not_modified : 1;
+
+    /**
+     * Set when the `304 Not Modified` response carries validators other than
+     * those the source image was revalidated with, in which case these are
+     * stored again.
+     */
+    unsigned validators_changed : 1;
+
 #if NGX_DEBUG
     /**
      * Debug mode.
@@ -0,0 +1,236 @@
+#include "sniff.h"
+
+namespace weserv::nginx {
+
+namespace {
+
+/**
+ * States of walking the markers of a JPEG image.
+ */
+enum ngx_weserv_sniff_jpeg_state_e {
+    sw_marker_start = 0,
+    sw_marker,
+    sw_segment,
+    sw_skip,
+};
+
+inline uint32_t read_be16(const u_char *p) {
+    return static_cast<uint32_t>(p[0]) << 8 | p[1];
+}
+
+inline uint32_t read_le16(const u_char *p) {
+    return p[0] | static_cast<uint32_t>(p[1]) << 8;
+}
+
+inline uint32_t read_le24(const u_char *p) {
+    return p[0] | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16;
+}
+
+inline uint32_t read_le32(const u_char *p) {
+    return p[0] | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline uint32_t read_be32(const u_char *p) {
+    return static_cast<uint32_t>(p[0]) << 24 |
+           static_cast<uint32_t>(p[1]) << 16 |
+           static_cast<uint32_t>(p[2]) << 8 | p[3];
+}
+
+/**
+ * Is this a start of frame marker? DHT (0xC4), JPG (0xC8) and DAC (0xCC)
+ * share the same range.
+ */
+inline bool is_sof_marker(u_char marker) {
+    return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+           marker != 0xC8 && marker != 0xCC;
+}
+
+/**
+ * Does this marker stand on its own, i.e. without a length?
+ */
+inline bool is_standalone_marker(u_char marker) {
+    return marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8);
+}
+
+ngx_int_t ngx_weserv_sniff_jpeg(ngx_weserv_sniff_t *s, const u_char *pos,
+                                const u_char *last, uint64_t *pixels) {
+    while (pos < last) {
+        switch (s->state) {
+            case sw_marker_start:
+                if (*pos++ != 0xFF) {
+                    return NGX_DECLINED;
+                }
+
+                s->state = sw_marker;
+                break;
+
+            case sw_marker:
+                s->marker = *pos++;
+
+                // Fill bytes
+                if (s->marker == 0xFF) {
+                    break;
+                }
+
+                if (is_standalone_marker(s->marker)) {
+                    s->state = sw_marker_start;
+                    break;
+                }
+
+                // The image data (SOS) or its end (EOI) without a frame
+                if (s->marker == 0xDA || s->marker == 0xD9) {
+                    return NGX_DECLINED;
+                }
+
+                s->segment_len = 0;
+                s->state = sw_segment;
+                break;
+
+            case sw_segment: {
+                // The length and, for a start of frame, the sample
+                // precision, height and width
+                size_t need = is_sof_marker(s->marker) ? 7 : 2;
+                size_t size = ngx_min(need - s->segment_len,
+                                      static_cast<size_t>(last - pos));
+
+                ngx_memcpy(s->segment + s->segment_len, pos, size);
+                s->segment_len += size;
+                pos += size;
+
+                if (s->segment_len < need) {
+                    break;
+                }
+
+                uint32_t length = read_be16(s->segment);
+                if (length < need) {
+                    return NGX_DECLINED;
+                }
+
+                if (is_sof_marker(s->marker)) {
+                    uint32_t height = read_be16(s->segment + 3);
+                    uint32_t width = read_be16(s->segment + 5);
+
+                    // A height of zero is defined by a later DNL marker
+                    if (height == 0 || width == 0) {
+                        return NGX_DECLINED;
+                    }
+
+                    *pixels = static_cast<uint64_t>(width) * height;
+
+                    return NGX_OK;
+                }
+
+                s->skip = length - need;
+                s->state = sw_skip;
+                break;
+            }
+
+            case sw_skip: {
+                size_t size =
+                    ngx_min(s->skip, static_cast<size_t>(last - pos));
+
+                s->skip -= size;
+                pos += size;
+
+                if (s->skip == 0) {
+                    s->state = sw_marker_start;
+                }
+                break;
+            }
+
+            default:
+                return NGX_DECLINED;
+        }
+    }
+
+    return NGX_AGAIN;
+}
+
+}  // namespace
+
+ngx_int_t ngx_weserv_sniff(ngx_weserv_sniff_t *s, const u_char *pos,
+                           const u_char *last, uint64_t *pixels) {
+    if (s->done) {
+        return NGX_DECLINED;
+    }
+
+    if (s->header_len < NGX_WESERV_SNIFF_HEADER_LEN) {
+        size_t size = ngx_min(NGX_WESERV_SNIFF_HEADER_LEN - s->header_len,
+                              static_cast<size_t>(last - pos));
+
+        ngx_memcpy(s->header + s->header_len, pos, size);
+        s->header_len += size;
+        pos += size;
+
+        if (s->header_len < NGX_WESERV_SNIFF_HEADER_LEN) {
+            return NGX_AGAIN;
+        }
+
+        // The leading bytes are complete, continue with the JPEG markers
+        // that follow the SOI marker, if any
+        if (s->header[0] == 0xFF && s->header[1] == 0xD8) {
+            ngx_int_t rc = ngx_weserv_sniff_jpeg(
+                s, s->header + 2, s->header + s->header_len, pixels);
+            if (rc != NGX_AGAIN) {
+                s->done = 1;
+                return rc;
+            }
+        }
+    }
+
+    const u_char *h = s->header;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    if (h[0] == 0xFF && h[1] == 0xD8) {
+        ngx_int_t rc = ngx_weserv_sniff_jpeg(s, pos, last, pixels);
+        if (rc != NGX_AGAIN) {
+            s->done = 1;
+        }
+
+        return rc;
+    }
+
+    if (ngx_memcmp(h, "\x89PNG\r\n\x1a\n", 8) == 0 &&
+        ngx_memcmp(h + 12, "IHDR", 4) == 0) {
+        width = read_be32(h + 16);
+        height = read_be32(h + 20);
+    } else if (ngx_memcmp(h, "GIF87a", 6) == 0 ||
+               ngx_memcmp(h, "GIF89a", 6) == 0) {
+        // The logical screen, which all frames are rendered onto
+        width = read_le16(h + 6);
+        height = read_le16(h + 8);
+    } else if (ngx_memcmp(h, "RIFF", 4) == 0 &&
+               ngx_memcmp(h + 8, "WEBP", 4) == 0) {
+        if (ngx_memcmp(h + 12, "VP8X", 4) == 0) {
+            // Extended format, the canvas size minus one
+            width = read_le24(h + 24) + 1;
+            height = read_le24(h + 27) + 1;
+        } else if (ngx_memcmp(h + 12, "VP8 ", 4) == 0 &&
+                   ngx_memcmp(h + 23, "\x9d\x01\x2a", 3) == 0) {
+            // Lossy, a 14-bit width and height in the key frame header
+            width = read_le16(h + 26) & 0x3fff;
+            height = read_le16(h + 28) & 0x3fff;
+        } else if (ngx_memcmp(h + 12, "VP8L", 4) == 0 && h[20] == 0x2f) {
+            // Lossless, a 14-bit width and height minus one
+            uint32_t bits = read_le32(h + 21);
+            width = (bits & 0x3fff) + 1;
+            height = ((bits >> 14) & 0x3fff) + 1;
+        }
+    }
+
+    s->done = 1;
+
+    if (width == 0 || height == 0) {
+        return NGX_DECLINED;
+    }
+
+    *pixels = static_cast<uint64_t>(width) * height;
+
+    return NGX_OK;
+}
+
+}  // namespace weserv::nginx
@@ -0,0 +1,57 @@
+#pragma once
+
+extern "C" {
+#include <ngx_core.h>
+}
+
+#include <cstdint>
+
+/**
+ * The number of leading bytes needed to identify the image format and to
+ * read the dimensions of PNG, GIF and WebP images.
+ */
+#define NGX_WESERV_SNIFF_HEADER_LEN 30
+
+namespace weserv::nginx {
+
+/**
+ * State of sniffing the dimensions of an image while it's being received.
+ */
+struct ngx_weserv_sniff_t {
+    /**
+     * The leading bytes of the image.
+     */
+    u_char header[NGX_WESERV_SNIFF_HEADER_LEN];
+    size_t header_len;
+
+    /**
+     * JPEG images are walked marker by marker until the start of frame
+     * segment, which may be preceded by arbitrarily large segments (EXIF,
+     * ICC profiles, etc.).
+     */
+    ngx_uint_t state;
+    u_char marker;
+    u_char segment[7];
+    size_t segment_len;
+    size_t skip;
+
+    /**
+     * Set once the dimensions are known or can't be sniffed.
+     */
+    unsigned done : 1;
+};
+
+/**
+ * Feed the next bytes of an image to the sniffer.
+ * Recognizes JPEG, PNG, GIF and WebP images, other formats are declined.
+ * @param s The sniffer state, zero-initialized before the first call.
+ * @param pos Start of the received bytes.
+ * @param last End of the received bytes.
+ * @param pixels Output number of pixels (width x height) of the image.
+ * @return NGX_OK if the dimensions are known, NGX_AGAIN if more bytes are
+ *         needed or NGX_DECLINED if the dimensions can't be sniffed.
+ */
+ngx_int_t ngx_weserv_sniff(ngx_weserv_sniff_t *s, const u_char *pos,
+                           const u_char *last, uint64_t *pixels);
+
+}  // namespace weserv::nginx
@@ -0,0 +1,521 @@
+#include "status.h"
+
+#include "module.h"
+
+#include <string>
+
+using ::weserv::api::utils::Status;
+
+namespace weserv::nginx {
+
+/**
+ * The number of latency buckets of a histogram, excluding `+Inf`.
+ */
+#define NGX_WESERV_STATUS_BUCKETS 11
+
+/**
+ * The number of error codes that are counted, i.e. the application status
+ * codes (see Status::Code), upstream errors and internal errors.
+ */
+#define NGX_WESERV_STATUS_ERRORS 10
+
+namespace {
+
+/**
+ * The type labels of source and processed images, see
+ * api::utils::image_type_id and api::utils::determine_image_extension.
+ */
+const char *ngx_weserv_input_types[] = {
+    "jpeg", "png", "webp", "tiff", "gif", "svg", "pdf", "heif", "magick",
+    "unknown",
+};
+
+const char *ngx_weserv_output_types[] = {
+    "jpg", "png", "webp", "avif", "tiff", "gif", "json", "blurhash",
+};
+
+#define NGX_WESERV_STATUS_INPUT_TYPES                                          \
+    (sizeof(ngx_weserv_input_types) / sizeof(ngx_weserv_input_types[0]))
+#define NGX_WESERV_STATUS_OUTPUT_TYPES                                         \
+    (sizeof(ngx_weserv_output_types) / sizeof(ngx_weserv_output_types[0]))
+
+/**
+ * The labels of the counted errors, the first ones are indexed by
+ * Status::Code - 1.
+ */
+const char *ngx_weserv_errors[NGX_WESERV_STATUS_ERRORS] = {
+    "invalid_uri",     "invalid_image",     "image_not_readable",
+    "image_too_large", "unsupported_saver", "libvips_error",
+    "unknown",         "overloaded",        "upstream",
+    "internal",
+};
+
+/**
+ * The upper bounds of the latency buckets, in microseconds, along with their
+ * labels. These are the default buckets of the Prometheus client libraries.
+ */
+const ngx_atomic_uint_t ngx_weserv_bucket_bounds[NGX_WESERV_STATUS_BUCKETS] = {
+    5000,   10000,   25000,   50000,   100000,   250000,
+    500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+const char *ngx_weserv_bucket_labels[NGX_WESERV_STATUS_BUCKETS] = {
+    "0.005", "0.01", "0.025", "0.05", "0.1", "0.25",
+    "0.5",   "1",    "2.5",   "5",    "10",
+};
+
+}  // namespace
+
+/**
+ * A latency histogram, unlike Prometheus the buckets are not cumulative.
+ */
+struct ngx_weserv_status_histogram_t {
+    /**
+     * The number of observations within each bucket, the last bucket holds
+     * the observations that exceed the upper bound of the others.
+     */
+    ngx_atomic_t buckets[NGX_WESERV_STATUS_BUCKETS + 1];
+
+    /**
+     * The sum of all observations, in microseconds.
+     */
+    ngx_atomic_t sum;
+};
+
+/**
+ * Shared state of the status zone, aggregated across worker processes.
+ */
+struct ngx_weserv_status_sh_t {
+    /**
+     * Requests handled by the weserv module.
+     */
+    ngx_atomic_t requests;
+
+    /**
+     * Processed images, by input and output type.
+     */
+    ngx_atomic_t images[NGX_WESERV_STATUS_INPUT_TYPES]
+                       [NGX_WESERV_STATUS_OUTPUT_TYPES];
+
+    /**
+     * Errors returned to the client, see ngx_weserv_errors.
+     */
+    ngx_atomic_t errors[NGX_WESERV_STATUS_ERRORS];
+
+    /**
+     * Bytes of source images received and bytes sent to the client.
+     */
+    ngx_atomic_t bytes_in;
+    ngx_atomic_t bytes_out;
+
+    /**
+     * Time spent on fetching source images and on processing images.
+     */
+    ngx_weserv_status_histogram_t fetch;
+    ngx_weserv_status_histogram_t processing;
+
+    /**
+     * Images that are queued or being processed.
+     */
+    ngx_atomic_t queue_depth;
+
+    /**
+     * The highest number of bytes allocated by libvips within any of the
+     * worker processes.
+     */
+    ngx_atomic_t memory_highwater;
+};
+
+namespace {
+
+ngx_int_t ngx_weserv_status_init_zone(ngx_shm_zone_t *shm_zone, void *data) {
+    // Reuse the shared state on reconfiguration
+    if (data != nullptr) {
+        shm_zone->data = data;
+
+        return NGX_OK;
+    }
+
+    auto *shpool = reinterpret_cast<ngx_slab_pool_t *>(shm_zone->shm.addr);
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+
+        return NGX_OK;
+    }
+
+    auto *sh = reinterpret_cast<ngx_weserv_status_sh_t *>(
+        ngx_slab_calloc(shpool, sizeof(ngx_weserv_status_sh_t)));
+    if (sh == nullptr) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    size_t len = sizeof(" in weserv status zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = reinterpret_cast<u_char *>(ngx_slab_alloc(shpool, len));
+    if (shpool->log_ctx == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in weserv status zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+ngx_weserv_status_sh_t *ngx_weserv_status_get(ngx_shm_zone_t *shm_zone) {
+    if (shm_zone == nullptr) {
+        return nullptr;
+    }
+
+    return reinterpret_cast<ngx_weserv_status_sh_t *>(shm_zone->data);
+}
+
+ngx_uint_t ngx_weserv_status_index(const char **labels, ngx_uint_t n,
+                                   const std::string &label) {
+    for (ngx_uint_t i = 0; i < n; ++i) {
+        if (label == labels[i]) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+void ngx_weserv_status_observe(ngx_weserv_status_histogram_t *histogram,
+                               ngx_atomic_uint_t usec) {
+    ngx_uint_t i = 0;
+    while (i < NGX_WESERV_STATUS_BUCKETS &&
+           usec > ngx_weserv_bucket_bounds[i]) {
+        ++i;
+    }
+
+    (void)ngx_atomic_fetch_add(&histogram->buckets[i], 1);
+    (void)ngx_atomic_fetch_add(&histogram->sum,
+                               static_cast<ngx_atomic_int_t>(usec));
+}
+
+/**
+ * Record the statistics of a finished request.
+ */
+ngx_int_t ngx_weserv_status_log_handler(ngx_http_request_t *r) {
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
+    if (!lc->enable) {
+        return NGX_OK;
+    }
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+    ngx_weserv_status_sh_t *sh = ngx_weserv_status_get(mc->status_zone);
+
+    (void)ngx_atomic_fetch_add(&sh->requests, 1);
+
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+    if (ctx != nullptr) {
+        (void)ngx_atomic_fetch_add(
+            &sh->bytes_in, static_cast<ngx_atomic_int_t>(ctx->bytes_in));
+    }
+
+    // Same as $body_bytes_sent
+    off_t sent = r->connection->sent - static_cast<off_t>(r->header_size);
+    if (sent > 0) {
+        (void)ngx_atomic_fetch_add(&sh->bytes_out,
+                                   static_cast<ngx_atomic_int_t>(sent));
+    }
+
+    // Requests waiting for a coalesced fetch have no upstream states
+    if (r->upstream_states == nullptr || r->upstream_states->nelts == 0) {
+        return NGX_OK;
+    }
+
+    auto *states =
+        reinterpret_cast<ngx_http_upstream_state_t *>(r->upstream_states->elts);
+
+    // Each redirect is fetched by its own upstream
+    ngx_msec_t fetch_time = 0;
+    for (ngx_uint_t i = 0; i < r->upstream_states->nelts; ++i) {
+        if (states[i].response_time != static_cast<ngx_msec_t>(-1)) {
+            fetch_time += states[i].response_time;
+        }
+    }
+
+    ngx_weserv_status_observe(&sh->fetch, fetch_time * 1000);
+
+    return NGX_OK;
+}
+
+/**
+ * Append a metric with its help text and type.
+ */
+void ngx_weserv_status_header(std::string *out, const char *name,
+                              const char *help, const char *type) {
+    *out += "# HELP ";
+    *out += name;
+    *out += ' ';
+    *out += help;
+    *out += "\n# TYPE ";
+    *out += name;
+    *out += ' ';
+    *out += type;
+    *out += '\n';
+}
+
+void ngx_weserv_status_histogram(std::string *out, const char *name,
+                                 const char *help,
+                                 const ngx_weserv_status_histogram_t &h) {
+    ngx_weserv_status_header(out, name, help, "histogram");
+
+    ngx_atomic_uint_t count = 0;
+    for (ngx_uint_t i = 0; i <= NGX_WESERV_STATUS_BUCKETS; ++i) {
+        count += h.buckets[i];
+
+        *out += name;
+        *out += "_bucket{le=\"";
+        *out += i < NGX_WESERV_STATUS_BUCKETS ? ngx_weserv_bucket_labels[i]
+                                              : "+Inf";
+        *out += "\"} " + std::to_string(count) + '\n';
+    }
+
+    // The sum is kept in microseconds
+    std::string usec = std::to_string(h.sum % 1000000);
+
+    *out += name;
+    *out += "_sum " + std::to_string(h.sum / 1000000) + '.' +
+            std::string(6 - usec.size(), '0') + usec + '\n';
+    *out += name;
+    *out += "_count " + std::to_string(count) + '\n';
+}
+
+/**
+ * Render the statistics in the Prometheus text exposition format.
+ */
+std::string ngx_weserv_status_render(const ngx_weserv_status_sh_t &sh) {
+    std::string out;
+
+    ngx_weserv_status_header(&out, "weserv_requests_total",
+                             "Requests handled by the weserv module.",
+                             "counter");
+    out += "weserv_requests_total " + std::to_string(sh.requests) + '\n';
+
+    ngx_weserv_status_header(&out, "weserv_images_total",
+                             "Processed images by input and output type.",
+                             "counter");
+    for (ngx_uint_t i = 0; i < NGX_WESERV_STATUS_INPUT_TYPES; ++i) {
+        for (ngx_uint_t j = 0; j < NGX_WESERV_STATUS_OUTPUT_TYPES; ++j) {
+            // Leave out the combinations that never occurred
+            if (sh.images[i][j] == 0) {
+                continue;
+            }
+
+            out += "weserv_images_total{input=\"";
+            out += ngx_weserv_input_types[i];
+            out += "\",output=\"";
+            out += ngx_weserv_output_types[j];
+            out += "\"} " + std::to_string(sh.images[i][j]) + '\n';
+        }
+    }
+
+    ngx_weserv_status_header(&out, "weserv_errors_total",
+                             "Errors returned to the client by code.",
+                             "counter");
+    for (ngx_uint_t i = 0; i < NGX_WESERV_STATUS_ERRORS; ++i) {
+        out += "weserv_errors_total{code=\"";
+        out += ngx_weserv_errors[i];
+        out += "\"} " + std::to_string(sh.errors[i]) + '\n';
+    }
+
+    ngx_weserv_status_header(&out, "weserv_received_bytes_total",
+                             "Bytes of source images received.", "counter");
+    out += "weserv_received_bytes_total " + std::to_string(sh.bytes_in) + '\n';
+
+    ngx_weserv_status_header(&out, "weserv_sent_bytes_total",
+                             "Bytes of response bodies sent to the client.",
+                             "counter");
+    out += "weserv_sent_bytes_total " + std::to_string(sh.bytes_out) + '\n';
+
+    ngx_weserv_status_histogram(&out, "weserv_upstream_fetch_seconds",
+                                "Time spent on fetching source images.",
+                                sh.fetch);
+    ngx_weserv_status_histogram(&out, "weserv_processing_seconds",
+                                "Time spent on processing images.",
+                                sh.processing);
+
+    ngx_weserv_status_header(&out, "weserv_queue_depth",
+                             "Images that are queued or being processed.",
+                             "gauge");
+    out += "weserv_queue_depth " +
+           std::to_string(static_cast<ngx_atomic_int_t>(sh.queue_depth)) +
+           '\n';
+
+    ngx_weserv_status_header(&out, "weserv_vips_memory_highwater_bytes",
+                             "Highest number of bytes allocated by libvips "
+                             "within a worker process.",
+                             "gauge");
+    out += "weserv_vips_memory_highwater_bytes " +
+           std::to_string(sh.memory_highwater) + '\n';
+
+    return out;
+}
+
+ngx_int_t ngx_weserv_status_handler(ngx_http_request_t *r) {
+    if (!(r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    ngx_int_t rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    std::string body = ngx_weserv_status_render(
+        *ngx_weserv_status_get(mc->status_zone));
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = body.size();
+    ngx_str_set(&r->headers_out.content_type,
+                "text/plain; version=0.0.4; charset=utf-8");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = nullptr;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        return ngx_http_send_header(r);
+    }
+
+    ngx_buf_t *b = ngx_create_temp_buf(r->pool, body.size());
+    if (b == nullptr) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, body.data(), body.size());
+    b->last_buf = r == r->main ? 1 : 0;
+    b->last_in_chain = 1;
+
+    ngx_chain_t out = {b, nullptr};
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+}  // namespace
+
+char *ngx_weserv_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(conf);
+
+    // A single zone is shared by all locations, it only holds a fixed set
+    // of counters
+    ngx_str_t name = ngx_string("weserv_status");
+
+    ngx_shm_zone_t *shm_zone =
+        ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize, &ngx_weserv_module);
+    if (shm_zone == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    shm_zone->init = ngx_weserv_status_init_zone;
+
+    mc->status_zone = shm_zone;
+
+    auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+        ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+    clcf->handler = ngx_weserv_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+ngx_int_t ngx_weserv_status_init(ngx_conf_t *cf) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_conf_get_module_main_conf(cf, ngx_weserv_module));
+
+    if (mc->status_zone == nullptr) {
+        return NGX_OK;
+    }
+
+    auto *cmcf = reinterpret_cast<ngx_http_core_main_conf_t *>(
+        ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module));
+
+    auto *h = reinterpret_cast<ngx_http_handler_pt *>(
+        ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_weserv_status_log_handler;
+
+    return NGX_OK;
+}
+
+void ngx_weserv_status_processed(ngx_shm_zone_t *shm_zone,
+                                 const api::ProcessingStats &stats) {
+    ngx_weserv_status_sh_t *sh = ngx_weserv_status_get(shm_zone);
+    if (sh == nullptr) {
+        return;
+    }
+
+    ngx_uint_t input = ngx_weserv_status_index(
+        ngx_weserv_input_types, NGX_WESERV_STATUS_INPUT_TYPES,
+        stats.input_type);
+    ngx_uint_t output = ngx_weserv_status_index(
+        ngx_weserv_output_types, NGX_WESERV_STATUS_OUTPUT_TYPES,
+        stats.output_type);
+
+    if (input < NGX_WESERV_STATUS_INPUT_TYPES &&
+        output < NGX_WESERV_STATUS_OUTPUT_TYPES) {
+        (void)ngx_atomic_fetch_add(&sh->images[input][output], 1);
+    }
+
+    ngx_weserv_status_observe(&sh->processing, stats.wall_time);
+
+    // Keep the highest high-water mark of all worker processes
+    auto highwater = static_cast<ngx_atomic_uint_t>(stats.memory_highwater);
+    for (;;) {
+        ngx_atomic_uint_t current = sh->memory_highwater;
+        if (highwater <= current ||
+            ngx_atomic_cmp_set(&sh->memory_highwater, current, highwater)) {
+            break;
+        }
+    }
+}
+
+void ngx_weserv_status_error(ngx_shm_zone_t *shm_zone, const Status &status) {
+    ngx_weserv_status_sh_t *sh = ngx_weserv_status_get(shm_zone);
+    if (sh == nullptr) {
+        return;
+    }
+
+    ngx_uint_t i;
+    if (status.error_cause() == Status::ErrorCause::Application &&
+        status.code() >= 1 && status.code() <= NGX_WESERV_STATUS_ERRORS - 2) {
+        i = status.code() - 1;
+    } else if (status.error_cause() == Status::ErrorCause::Upstream) {
+        i = NGX_WESERV_STATUS_ERRORS - 2;
+    } else {
+        i = NGX_WESERV_STATUS_ERRORS - 1;
+    }
+
+    (void)ngx_atomic_fetch_add(&sh->errors[i], 1);
+}
+
+void ngx_weserv_status_queue(ngx_shm_zone_t *shm_zone,
+                             ngx_atomic_int_t delta) {
+    ngx_weserv_status_sh_t *sh = ngx_weserv_status_get(shm_zone);
+    if (sh == nullptr) {
+        return;
+    }
+
+    (void)ngx_atomic_fetch_add(&sh->queue_depth, delta);
+}
+
+}  // namespace weserv::nginx
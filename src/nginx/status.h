@@ -0,0 +1,49 @@
+#pragma once
+
+extern "C" {
+#include <ngx_http.h>
+}
+
+#include <weserv/env_interface.h>
+#include <weserv/utils/status.h>
+
+namespace weserv::nginx {
+
+/**
+ * Directive handler for the `weserv_status` directive.
+ * Syntax: weserv_status;
+ */
+char *ngx_weserv_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+/**
+ * Register the log phase handler that records the statistics of each
+ * request handled by the weserv module. Does nothing if the `weserv_status`
+ * directive isn't used.
+ */
+ngx_int_t ngx_weserv_status_init(ngx_conf_t *cf);
+
+/**
+ * Record the statistics of a processed image.
+ * @note Safe to call from the thread of a thread pool.
+ * @param shm_zone The status zone, or nullptr if disabled.
+ * @param stats The statistics reported by the API.
+ */
+void ngx_weserv_status_processed(ngx_shm_zone_t *shm_zone,
+                                 const api::ProcessingStats &stats);
+
+/**
+ * Record an error that is returned to the client.
+ * @param shm_zone The status zone, or nullptr if disabled.
+ * @param status The error status.
+ */
+void ngx_weserv_status_error(ngx_shm_zone_t *shm_zone,
+                             const api::utils::Status &status);
+
+/**
+ * Update the number of images that are queued or being processed.
+ * @param shm_zone The status zone, or nullptr if disabled.
+ * @param delta 1 when an image is queued, -1 once it's processed.
+ */
+void ngx_weserv_status_queue(ngx_shm_zone_t *shm_zone, ngx_atomic_int_t delta);
+
+}  // namespace weserv::nginx
@@ -11,6 +11,10 @@ ngx_str_t application_json = ngx_string("application/json");
 // See: https://github.com/weserv/images/issues/186
 const time_t MAX_AGE_DEFAULT = 60 * 60 * 24 * 365;
 
+// The maximum number of output buffers that can be in flight while
+// streaming, before the remainder is written to a temporary file
+const ngx_uint_t NGX_WESERV_STREAM_BUFFERS = 4;
+
 int64_t ngx_weserv_chain_read(ngx_chain_t **in, void *data, size_t length) {
     int64_t bytes_read = 0;
     ngx_chain_t *cl;
@@ -34,6 +38,109 @@ int64_t ngx_weserv_chain_read(ngx_chain_t **in, void *data, size_t length) {
     return bytes_read;
 }
 
+/**
+ * Set the headers that are shared by all successful responses.
+ * @param r The request.
+ * @param upstream_ctx The upstream module context, if available.
+ * @return NGX_OK on success or NGX_ERROR on failure.
+ */
+ngx_int_t
+ngx_weserv_set_cache_headers(ngx_http_request_t *r,
+                             ngx_weserv_upstream_ctx_t *upstream_ctx) {
+    // Only set the Link header if there's an upstream context available
+    if (upstream_ctx != nullptr &&
+        set_link_header(r, upstream_ctx->canonical) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    // The output format depends on the Accept request header
+    if (is_output_negotiated(r) && set_vary_accept_header(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    time_t max_age = MAX_AGE_DEFAULT;
+
+    ngx_str_t max_age_str;
+    if (ngx_http_arg(r, (u_char *)"maxage", 6, &max_age_str) == NGX_OK) {
+        max_age = parse_max_age(max_age_str);
+        if (max_age == static_cast<time_t>(NGX_ERROR)) {
+            max_age = MAX_AGE_DEFAULT;
+        }
+    }
+
+    // Only set Cache-Control and Expires headers on non-error responses
+    return set_expires_header(r, max_age);
+}
+
+/**
+ * Set the response headers of a processed image.
+ * @param r The request.
+ * @param upstream_ctx The upstream module context, if available.
+ * @param extension Extension of the image.
+ * @param content_length Length of the image, or -1 if unknown.
+ * @return NGX_OK on success or NGX_ERROR on failure.
+ */
+ngx_int_t ngx_weserv_set_image_headers(ngx_http_request_t *r,
+                                       ngx_weserv_upstream_ctx_t *upstream_ctx,
+                                       const std::string &extension,
+                                       off_t content_length) {
+    ngx_str_t mime_type = extension_to_mime_type(extension);
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_type = mime_type;
+    r->headers_out.content_type_len = mime_type.len;
+    r->headers_out.content_type_lowcase = nullptr;
+    r->headers_out.content_length_n = content_length;
+
+    if (r->headers_out.content_length) {
+        r->headers_out.content_length->hash = 0;
+    }
+
+    r->headers_out.content_length = nullptr;
+
+    // Only set the Content-Disposition header on images
+    if (!is_base64_needed(r) &&
+        !ngx_string_equal(mime_type, application_json) &&
+        set_content_disposition_header(r, extension) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_weserv_set_cache_headers(r, upstream_ctx);
+}
+
+ngx_int_t
+ngx_weserv_set_multipart_headers(ngx_http_request_t *r,
+                                 ngx_weserv_upstream_ctx_t *upstream_ctx,
+                                 const ngx_str_t &boundary,
+                                 off_t content_length) {
+    size_t prefix_size = sizeof("multipart/mixed; boundary=") - 1;
+    size_t content_type_size = prefix_size + boundary.len;
+
+    auto *p =
+        reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, content_type_size));
+    if (p == nullptr) {
+        return NGX_ERROR;
+    }
+
+    u_char *o = ngx_cpymem(p, "multipart/mixed; boundary=", prefix_size);
+    ngx_memcpy(o, boundary.data, boundary.len);
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_type.data = p;
+    r->headers_out.content_type.len = content_type_size;
+    r->headers_out.content_type_len = content_type_size;
+    r->headers_out.content_type_lowcase = nullptr;
+    r->headers_out.content_length_n = content_length;
+
+    if (r->headers_out.content_length) {
+        r->headers_out.content_length->hash = 0;
+    }
+
+    r->headers_out.content_length = nullptr;
+
+    return ngx_weserv_set_cache_headers(r, upstream_ctx);
+}
+
 void ngx_weserv_chain_seek(ngx_chain_t **in, int64_t offset) {
     int64_t remainder = 0;
     ngx_chain_t *cl;
@@ -90,6 +197,37 @@ int64_t NgxSource::seek(int64_t offset, int whence) {
     return read_position_;
 }
 
+const void *NgxSource::memory(size_t *length) {
+    ngx_buf_t *buf = nullptr;
+
+    for (ngx_chain_t *cl = first_in_; cl; cl = cl->next) {
+        if (cl->buf->last != cl->buf->pos) {
+            // The source is spread over multiple buffers
+            if (buf != nullptr) {
+                return nullptr;
+            }
+
+            buf = cl->buf;
+        }
+
+        if (cl->buf->last_buf) {
+            break;
+        }
+    }
+
+    if (buf == nullptr) {
+        return nullptr;
+    }
+
+    *length = buf->last - buf->pos;
+
+    if (bytes_saved_ != nullptr) {
+        *bytes_saved_ = *length;
+    }
+
+    return buf->pos;
+}
+
 void NgxTarget::setup(const std::string &extension) {
     extension_ = extension;
 }
@@ -175,55 +313,408 @@ int64_t NgxTarget::seek(int64_t offset, int whence) {
 }
 
 int NgxTarget::end() {
-    ngx_str_t mime_type = extension_to_mime_type(extension_);
+    if (ngx_weserv_set_image_headers(r_, upstream_ctx_, extension_,
+                                     content_length_) != NGX_OK) {
+        return -1;
+    }
 
-    r_->headers_out.status = NGX_HTTP_OK;
-    r_->headers_out.content_type = mime_type;
-    r_->headers_out.content_type_len = mime_type.len;
-    r_->headers_out.content_type_lowcase = nullptr;
-    r_->headers_out.content_length_n = content_length_;
+    // Mark all output buffers as unconsumed
+    for (ngx_chain_t *cl = *first_ll_; cl; cl = cl->next) {
+        cl->buf->pos = cl->buf->start;
+    }
+
+    *ll_ = nullptr;
+
+    return 0;
+}
 
-    if (r_->headers_out.content_length) {
-        r_->headers_out.content_length->hash = 0;
+void NgxStreamTarget::setup(const std::string &extension) {
+    extension_ = extension;
+
+    // libtiff needs to be able to seek and read on targets, so buffer the
+    // entire image in that case
+    if (extension == ".tiff") {
+        stream_ = false;
     }
+}
 
-    r_->headers_out.content_length = nullptr;
+ngx_buf_t *NgxStreamTarget::buffer_at(int64_t position, size_t *offset) {
+    ngx_chain_t *cl = *out_;
 
-    // Only set the Content-Disposition header on images
-    if (!is_base64_needed(r_) &&
-        !ngx_string_equal(mime_type, application_json) &&
-        set_content_disposition_header(r_, extension_) != NGX_OK) {
+    // All buffers are full, except for the last one
+    for (int64_t n = position / buffer_size_; cl && n > 0; n--) {
+        cl = cl->next;
+    }
+
+    *offset = position % buffer_size_;
+
+    return cl != nullptr ? cl->buf : nullptr;
+}
+
+ngx_int_t NgxStreamTarget::append(const u_char *data, size_t length) {
+    while (length > 0) {
+        if ((last_ == nullptr || last_->last == last_->end) &&
+            next_buffer() != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        size_t size = ngx_min((size_t)(last_->end - last_->last), length);
+
+        // A null pointer pads the output with zeros
+        if (data != nullptr) {
+            last_->last = ngx_cpymem(last_->last, data, size);
+            data += size;
+        } else {
+            ngx_memzero(last_->last, size);
+            last_->last += size;
+        }
+
+        content_length_ += size;
+        length -= size;
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t NgxStreamTarget::next_buffer() {
+    // Once spilled, the buffer is written to the temporary file and reused
+    if (temp_file_ != nullptr) {
+        return spill();
+    }
+
+    // Pass the full buffer down the filter chain, if possible
+    if (stream_ && last_ != nullptr && flush() != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    // The client can't keep up, write the remainder of the image to a
+    // temporary file instead of allocating even more buffers
+    // Reference: ngx_event_pipe_write_chain_to_temp_file
+    bool spill = stream_ && free_ == nullptr &&
+                 allocated_ >= NGX_WESERV_STREAM_BUFFERS;
+
+    if (spill) {
+        auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+            ngx_http_get_module_loc_conf(r_, ngx_http_core_module));
+
+        temp_file_ = reinterpret_cast<ngx_temp_file_t *>(
+            ngx_pcalloc(r_->pool, sizeof(ngx_temp_file_t)));
+        if (temp_file_ == nullptr) {
+            return NGX_ERROR;
+        }
+
+        temp_file_->file.fd = NGX_INVALID_FILE;
+        temp_file_->file.log = r_->connection->log;
+        temp_file_->path = clcf->client_body_temp_path;
+        temp_file_->pool = r_->pool;
+        temp_file_->log_level = NGX_LOG_WARN;
+        temp_file_->warn = const_cast<char *>(
+            "a processed image is buffered to a temporary file");
+        temp_file_->clean = 1;
+    }
+
+    ngx_chain_t *cl = ngx_chain_get_free_buf(r_->pool, &free_);
+    if (cl == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_buf_t *b = cl->buf;
+
+    if (b->start == nullptr) {
+        b->start =
+            reinterpret_cast<u_char *>(ngx_palloc(r_->pool, buffer_size_));
+        if (b->start == nullptr) {
+            return NGX_ERROR;
+        }
+
+        b->end = b->start + buffer_size_;
+        b->temporary = 1;
+        b->recycled = 1;
+        b->tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+
+        allocated_++;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    // The spill buffer never enters the filter chain
+    if (!spill) {
+        *ll_ = cl;
+        ll_ = &cl->next;
+    }
+
+    last_ = b;
+
+    return NGX_OK;
+}
+
+ngx_int_t NgxStreamTarget::spill() {
+    ngx_chain_t cl = {last_, nullptr};
+
+    if (ngx_write_chain_to_temp_file(temp_file_, &cl) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    last_->pos = last_->start;
+    last_->last = last_->start;
+
+    return NGX_OK;
+}
+
+ngx_int_t NgxStreamTarget::flush() {
+    // Leave the buffers queued if a filter ends up here again
+    if (flushing_) {
+        return NGX_OK;
+    }
+
+    if (!r_->header_sent) {
+        if (ngx_weserv_set_image_headers(r_, upstream_ctx_, extension_, -1) !=
+            NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_int_t rc = header_filter_(r_);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r_->header_only) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_chain_t *out = *out_;
+
+    *out_ = nullptr;
+    ll_ = out_;
+    last_ = nullptr;
+
+    flushing_ = true;
+    ngx_int_t rc = body_filter_(r_, out);
+    flushing_ = false;
+
+    // Recycle the buffers that have been sent
+    auto tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+    ngx_chain_update_chains(r_->pool, &free_, &busy_, &out, tag);
+
+    return rc == NGX_ERROR ? NGX_ERROR : NGX_OK;
+}
+
+int64_t NgxStreamTarget::write(const void *data, size_t length) {
+    auto *p = static_cast<const u_char *>(data);
+    size_t size = length;
+
+    // Overwrite any previously written data if we've been seeked back, which
+    // can only happen when the output is buffered
+    while (size > 0 && write_position_ < content_length_) {
+        size_t offset;
+        ngx_buf_t *b = buffer_at(write_position_, &offset);
+        if (b == nullptr) {
+            return -1;
+        }
+
+        size_t n = ngx_min((size_t)(b->last - b->start) - offset, size);
+        ngx_memcpy(b->start + offset, p, n);
+
+        p += n;
+        size -= n;
+        write_position_ += n;
+    }
+
+    // Pad with zeros if we've been seeked past the end
+    if (write_position_ > content_length_ &&
+        append(nullptr, write_position_ - content_length_) != NGX_OK) {
         return -1;
     }
 
-    // Only set the Link header if there's an upstream context available
-    if (upstream_ctx_ != nullptr &&
-        set_link_header(r_, upstream_ctx_->canonical) != NGX_OK) {
+    if (append(p, size) != NGX_OK) {
         return -1;
     }
 
-    time_t max_age = MAX_AGE_DEFAULT;
+    write_position_ += size;
 
-    ngx_str_t max_age_str;
-    if (ngx_http_arg(r_, (u_char *)"maxage", 6, &max_age_str) == NGX_OK) {
-        max_age = parse_max_age(max_age_str);
-        if (max_age == static_cast<time_t>(NGX_ERROR)) {
-            max_age = MAX_AGE_DEFAULT;
+    return length;
+}
+
+int64_t NgxStreamTarget::read(void *data, size_t length) {
+    // Flushed buffers can't be read back
+    if (stream_) {
+        return -1;
+    }
+
+    auto *p = static_cast<u_char *>(data);
+    int64_t bytes_read = 0;
+
+    while (length > 0 && write_position_ < content_length_) {
+        size_t offset;
+        ngx_buf_t *b = buffer_at(write_position_, &offset);
+        if (b == nullptr) {
+            return -1;
         }
+
+        size_t n = ngx_min((size_t)(b->last - b->start) - offset, length);
+        p = ngx_cpymem(p, b->start + offset, n);
+
+        length -= n;
+        bytes_read += n;
+        write_position_ += n;
     }
 
-    // Only set Cache-Control and Expires headers on non-error responses
-    if (set_expires_header(r_, max_age) != NGX_OK) {
+    return bytes_read;
+}
+
+int64_t NgxStreamTarget::seek(int64_t offset, int whence) {
+    int64_t new_position;
+
+    switch (whence) {
+        case SEEK_SET:
+            new_position = offset;
+            break;
+        case SEEK_CUR:
+            new_position = write_position_ + offset;
+            break;
+        case SEEK_END:
+            new_position = content_length_ + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    // Flushed buffers can't be seeked into
+    if (new_position < 0 || (stream_ && new_position != write_position_)) {
         return -1;
     }
 
-    // Mark all output buffers as unconsumed
-    for (ngx_chain_t *cl = *first_ll_; cl; cl = cl->next) {
-        cl->buf->pos = cl->buf->start;
+    write_position_ = new_position;
+
+    return new_position;
+}
+
+int NgxStreamTarget::end() {
+    // Nothing has been sent yet if the image fits within a single buffer,
+    // send it with a Content-Length instead of chunked
+    if (!stream_ || !r_->header_sent) {
+        if (ngx_weserv_set_image_headers(r_, upstream_ctx_, extension_,
+                                         content_length_) != NGX_OK) {
+            return -1;
+        }
+
+        if (last_ != nullptr) {
+            last_->last_buf = 1;
+        }
+
+        *ll_ = nullptr;
+
+        return 0;
     }
 
-    *ll_ = nullptr;
+    if (temp_file_ != nullptr) {
+        // Send the remainder of the image from the temporary file
+        if (last_->last != last_->pos && spill() != NGX_OK) {
+            return -1;
+        }
+
+        ngx_chain_t *cl = ngx_alloc_chain_link(r_->pool);
+        if (cl == nullptr) {
+            return -1;
+        }
+
+        cl->buf = ngx_calloc_buf(r_->pool);
+        if (cl->buf == nullptr) {
+            return -1;
+        }
+
+        cl->buf->in_file = 1;
+        cl->buf->file = &temp_file_->file;
+        cl->buf->file_pos = 0;
+        cl->buf->file_last = temp_file_->offset;
+        cl->next = nullptr;
+
+        *ll_ = cl;
+        ll_ = &cl->next;
+
+        last_ = cl->buf;
+    } else if (last_ == nullptr) {
+        // Terminate the response with an empty buffer if nothing is pending
+        ngx_chain_t *cl = ngx_alloc_chain_link(r_->pool);
+        if (cl == nullptr) {
+            return -1;
+        }
+
+        cl->buf = ngx_calloc_buf(r_->pool);
+        if (cl->buf == nullptr) {
+            return -1;
+        }
+
+        cl->next = nullptr;
+
+        *ll_ = cl;
+        ll_ = &cl->next;
+
+        last_ = cl->buf;
+    }
+
+    last_->last_buf = 1;
+
+    return flush() == NGX_OK ? 0 : -1;
+}
+
+void NgxMemoryTarget::setup(const std::string &extension) {
+    *extension_ = extension;
+}
+
+int64_t NgxMemoryTarget::write(const void *data, size_t length) {
+    // Pad with zeros if we've been seeked past the end
+    if (write_position_ > out_->size()) {
+        out_->resize(write_position_);
+    }
+
+    size_t overwrite = ngx_min(out_->size() - write_position_, length);
+    out_->replace(write_position_, overwrite,
+                  static_cast<const char *>(data), length);
+
+    write_position_ += length;
+
+    return length;
+}
+
+int64_t NgxMemoryTarget::read(void *data, size_t length) {
+    if (write_position_ >= out_->size()) {
+        return 0;
+    }
+
+    size_t size = out_->copy(static_cast<char *>(data), length,
+                             write_position_);
+    write_position_ += size;
+
+    return size;
+}
+
+int64_t NgxMemoryTarget::seek(int64_t offset, int whence) {
+    int64_t new_position;
+
+    switch (whence) {
+        case SEEK_SET:
+            new_position = offset;
+            break;
+        case SEEK_CUR:
+            new_position = write_position_ + offset;
+            break;
+        case SEEK_END:
+            new_position = out_->size() + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    if (new_position < 0) {
+        return -1;
+    }
+
+    write_position_ = new_position;
+
+    return new_position;
+}
 
+int NgxMemoryTarget::end() {
     return 0;
 }
 
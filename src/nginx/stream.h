@@ -6,17 +6,34 @@ extern "C" {
 
 #include "module.h"
 
+#include <string>
+
 #include <weserv/io/source_interface.h>
 #include <weserv/io/target_interface.h>
 
 namespace weserv::nginx {
 
+/**
+ * Set the response headers of a multipart/mixed response.
+ * @param r The request.
+ * @param upstream_ctx The upstream module context, if available.
+ * @param boundary The boundary that delimits the parts.
+ * @param content_length Length of the response body.
+ * @return NGX_OK on success or NGX_ERROR on failure.
+ */
+ngx_int_t
+ngx_weserv_set_multipart_headers(ngx_http_request_t *r,
+                                 ngx_weserv_upstream_ctx_t *upstream_ctx,
+                                 const ngx_str_t &boundary,
+                                 off_t content_length);
+
 /**
  * The NGINX implementation of io::SourceInterface.
  */
 class NgxSource : public api::io::SourceInterface {
  public:
-    NgxSource(ngx_chain_t *in) : in_(in), first_in_(in) {}
+    NgxSource(ngx_chain_t *in, off_t *bytes_saved = nullptr)
+        : in_(in), first_in_(in), bytes_saved_(bytes_saved) {}
 
     ~NgxSource() override = default;
 
@@ -24,10 +41,16 @@ class NgxSource : public api::io::SourceInterface {
 
     int64_t seek(int64_t offset, int whence) override;
 
+    const void *memory(size_t *length) override;
+
  private:
     ngx_chain_t *in_;
     ngx_chain_t *first_in_;
 
+    /* The number of bytes that didn't need to be copied, if requested.
+     */
+    off_t *bytes_saved_;
+
     /* The current read point.
      */
     int64_t read_position_ = 0;
@@ -71,4 +94,126 @@ class NgxTarget : public api::io::TargetInterface {
     int64_t write_position_ = 0;
 };
 
+/**
+ * An io::TargetInterface implementation that writes into fixed-size buffers
+ * allocated from the request pool, which are recycled once they've been sent.
+ * When streaming, full buffers are passed down the filter chain as soon as
+ * they're produced (using chunked transfer encoding), except for savers that
+ * need to seek back on the target (i.e. TIFF), whose output is buffered.
+ * Images that fit within a single buffer are sent with a Content-Length
+ * instead. At most NGX_WESERV_STREAM_BUFFERS buffers are in flight; if the
+ * client can't keep up, the remainder of the image is written to a temporary
+ * file, as ngx_event_pipe does.
+ */
+class NgxStreamTarget : public api::io::TargetInterface {
+ public:
+    NgxStreamTarget(ngx_http_request_t *r,
+                    ngx_weserv_upstream_ctx_t *upstream_ctx,
+                    ngx_http_output_header_filter_pt header_filter,
+                    ngx_http_output_body_filter_pt body_filter,
+                    size_t buffer_size, bool stream, ngx_chain_t **out)
+        : r_(r), upstream_ctx_(upstream_ctx), header_filter_(header_filter),
+          body_filter_(body_filter), buffer_size_(buffer_size),
+          stream_(stream), out_(out), ll_(out) {}
+
+    ~NgxStreamTarget() override = default;
+
+    void setup(const std::string &extension) override;
+
+    int64_t write(const void *data, size_t length) override;
+
+    int64_t read(void *data, size_t length) override;
+
+    int64_t seek(int64_t offset, int whence) override;
+
+    int end() override;
+
+ private:
+    ngx_http_request_t *r_;
+    ngx_weserv_upstream_ctx_t *upstream_ctx_;
+
+    ngx_http_output_header_filter_pt header_filter_;
+    ngx_http_output_body_filter_pt body_filter_;
+
+    size_t buffer_size_;
+    bool stream_;
+
+    /* The buffers that haven't been passed down the filter chain yet.
+     */
+    ngx_chain_t **out_;
+    ngx_chain_t **ll_;
+
+    /* The buffer that is currently being written to.
+     */
+    ngx_buf_t *last_ = nullptr;
+
+    /* Buffers that can be reused and buffers that are still being sent.
+     */
+    ngx_chain_t *free_ = nullptr;
+    ngx_chain_t *busy_ = nullptr;
+
+    /* The number of buffers allocated so far.
+     */
+    ngx_uint_t allocated_ = 0;
+
+    /* The temporary file that holds the remainder of the image, once the
+     * maximum number of buffers is in flight.
+     */
+    ngx_temp_file_t *temp_file_ = nullptr;
+
+    /* Whether the buffers are being passed down the filter chain, guards
+     * against re-entrant flushes.
+     */
+    bool flushing_ = false;
+
+    std::string extension_;
+    off_t content_length_ = 0;
+
+    /* The current write point.
+     */
+    int64_t write_position_ = 0;
+
+    ngx_buf_t *buffer_at(int64_t position, size_t *offset);
+
+    ngx_int_t append(const u_char *data, size_t length);
+
+    ngx_int_t next_buffer();
+
+    ngx_int_t spill();
+
+    ngx_int_t flush();
+};
+
+/**
+ * An io::TargetInterface implementation that writes to a std::string.
+ * Used when image processing is offloaded to a thread pool, since the
+ * request pool must not be accessed from within a thread, or when the
+ * output needs to be cached.
+ */
+class NgxMemoryTarget : public api::io::TargetInterface {
+ public:
+    NgxMemoryTarget(std::string *extension, std::string *out)
+        : extension_(extension), out_(out) {}
+
+    ~NgxMemoryTarget() override = default;
+
+    void setup(const std::string &extension) override;
+
+    int64_t write(const void *data, size_t length) override;
+
+    int64_t read(void *data, size_t length) override;
+
+    int64_t seek(int64_t offset, int whence) override;
+
+    int end() override;
+
+ private:
+    std::string *extension_;
+    std::string *out_;
+
+    /* The current write point.
+     */
+    size_t write_position_ = 0;
+};
+
 }  // namespace weserv::nginx
@@ -1,7 +1,53 @@
 #include "util.h"
 
+#include <algorithm>
+
 namespace weserv::nginx {
 
+namespace {
+
+/**
+ * Does a media range of the Accept header (`image/webp;q=0.8`) have the
+ * given type, with a non-zero quality value?
+ */
+bool is_media_range_accepted(u_char *start, u_char *end, const char *type,
+                             size_t type_len) {
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        ++start;
+    }
+
+    u_char *params = ngx_strlchr(start, end, ';');
+    u_char *type_end = params != nullptr ? params : end;
+    while (type_end > start && (type_end[-1] == ' ' || type_end[-1] == '\t')) {
+        --type_end;
+    }
+
+    if (static_cast<size_t>(type_end - start) != type_len ||
+        ngx_strncasecmp(start, (u_char *)type, type_len) != 0) {
+        return false;
+    }
+
+    if (params == nullptr) {
+        return true;
+    }
+
+    // A quality value of 0 means "not acceptable", i.e. `q=0` or `q=0.000`
+    u_char *q = ngx_strlcasestrn(params, end, (u_char *)"q=0", 3 - 1);
+    if (q == nullptr) {
+        return true;
+    }
+
+    for (q += 3; q < end && *q != ';'; ++q) {
+        if (*q != '.' && *q != '0' && *q != ' ' && *q != '\t') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace
+
 std::string ngx_str_to_std(const ngx_str_t &src) {
     return (src.data == nullptr || src.len <= 0)
                ? std::string()
@@ -25,6 +71,104 @@ bool is_base64_needed(ngx_http_request_t *r) {
            ngx_strncasecmp(encoding.data, (u_char *)"base64", 6) == 0;
 }
 
+bool is_output_negotiated(ngx_http_request_t *r) {
+    ngx_str_t output;
+    if (ngx_http_arg(r, (u_char *)"output", 6, &output) != NGX_OK) {
+        return false;
+    }
+
+    return output.len == 4 && ngx_strncmp(output.data, "auto", 4) == 0;
+}
+
+std::string get_accepted_formats(ngx_http_request_t *r) {
+    bool avif = false;
+    bool webp = false;
+
+    ngx_list_part_t *part = &r->headers_in.headers.part;
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(part->elts);
+
+    for (ngx_uint_t i = 0; /* void */; ++i) {
+        if (i >= part->nelts) {
+            if (part->next == nullptr) {
+                break;
+            }
+
+            part = part->next;
+            h = reinterpret_cast<ngx_table_elt_t *>(part->elts);
+            i = 0;
+        }
+
+        if (h[i].key.len != 6 ||
+            ngx_strncasecmp(h[i].key.data, (u_char *)"accept", 6) != 0) {
+            continue;
+        }
+
+        u_char *p = h[i].value.data;
+        u_char *last = p + h[i].value.len;
+
+        // Wildcards (`image/*`) are ignored, browsers send them regardless
+        // of the formats they support
+        while (p < last) {
+            u_char *end = ngx_strlchr(p, last, ',');
+            if (end == nullptr) {
+                end = last;
+            }
+
+            avif = avif || is_media_range_accepted(p, end, "image/avif", 10);
+            webp = webp || is_media_range_accepted(p, end, "image/webp", 10);
+
+            p = end + 1;
+        }
+    }
+
+    std::string formats;
+    if (avif) {
+        formats = "avif";
+    }
+    if (webp) {
+        formats += formats.empty() ? "webp" : ",webp";
+    }
+
+    return formats;
+}
+
+std::string ngx_weserv_image_args(ngx_http_request_t *r) {
+    std::string args = ngx_str_to_std(r->args);
+
+    if (!is_output_negotiated(r)) {
+        return args;
+    }
+
+    // Only the `Accept` header negotiates the output, so leave out any
+    // `&accept=` given by the client
+    std::string negotiated;
+    size_t pos = 0;
+    while (pos < args.size()) {
+        size_t end = args.find('&', pos);
+        if (end == std::string::npos) {
+            end = args.size();
+        }
+
+        size_t key_end = std::min(args.find('=', pos), end);
+        if (args.compare(pos, key_end - pos, "accept") != 0) {
+            if (!negotiated.empty()) {
+                negotiated += '&';
+            }
+            negotiated.append(args, pos, end - pos);
+        }
+
+        pos = end + 1;
+    }
+
+    std::string formats = get_accepted_formats(r);
+    if (!formats.empty()) {
+        negotiated = "accept=" + formats +
+                     (negotiated.empty() ? "" : "&" + negotiated);
+    }
+
+    return negotiated;
+}
+
 ngx_int_t output_chain_to_base64(ngx_http_request_t *r, ngx_chain_t *out) {
     size_t prefix_size = sizeof("data:") - 1;
     size_t suffix_size = sizeof(";base64,") - 1;
@@ -25,6 +25,25 @@ bool has_valid_scheme(const ngx_str_t &url);
  */
 bool is_base64_needed(ngx_http_request_t *r);
 
+/**
+ * Is the output format negotiated (`&output=auto`)?
+ */
+bool is_output_negotiated(ngx_http_request_t *r);
+
+/**
+ * Get the image formats that are explicitly accepted by the client within the
+ * Accept request header, in addition to the universally supported ones, for
+ * e.g. `avif,webp`.
+ */
+std::string get_accepted_formats(ngx_http_request_t *r);
+
+/**
+ * The image API arguments of the request, including the formats accepted by
+ * the client when the output format is negotiated (`&output=auto`). These
+ * are taken from the `Accept` header only, any `&accept=` is left out.
+ */
+std::string ngx_weserv_image_args(ngx_http_request_t *r);
+
 /**
  * Converts an entire output chain to base64.
  */
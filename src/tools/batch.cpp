@@ -0,0 +1,395 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <glob.h>
+
+using weserv::api::ApiManager;
+using weserv::api::Config;
+using weserv::api::utils::Status;
+
+namespace {
+
+/**
+ * A single image to process.
+ */
+struct Job {
+    std::string input;
+    std::string output;
+    std::string query;
+};
+
+struct BatchOptions {
+    /**
+     * Manifest with a job on each line: `input<TAB>output[<TAB>query]`.
+     */
+    std::string manifest;
+
+    /**
+     * Glob pattern of the input images, which are written to output_dir
+     * with the query given on the command line.
+     */
+    std::string pattern;
+    std::string output_dir;
+    std::string query;
+
+    /**
+     * Progress log, jobs that are completed according to this log are
+     * skipped.
+     */
+    std::string progress;
+
+    /**
+     * Number of jobs that are processed concurrently.
+     */
+    unsigned jobs = std::max(std::thread::hardware_concurrency(), 1U);
+
+    /**
+     * Maximum time to process a single image, in seconds.
+     */
+    time_t timeout = Config().process_timeout;
+};
+
+/**
+ * Let the output type default to the extension of the output file, the same
+ * as for a single image.
+ */
+std::string with_output(const std::string &query, const std::string &output) {
+    if (query.find("output=") != std::string::npos) {
+        return query;
+    }
+
+    std::string extension = "output=" + get_extension(output);
+    return query.empty() ? extension : query + "&" + extension;
+}
+
+std::string base_name(const std::string &path) {
+    const size_t idx = path.find_last_of('/');
+    return idx != std::string::npos ? path.substr(idx + 1) : path;
+}
+
+std::string replace_extension(const std::string &filename,
+                              const std::string &extension) {
+    const size_t idx = filename.find_last_of('.');
+    return (idx != std::string::npos ? filename.substr(0, idx) : filename) +
+           "." + extension;
+}
+
+uint64_t file_size(const std::string &path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+bool parse_options(int argc, const char *argv[], BatchOptions *options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg.rfind("--", 0) != 0) {
+            // Query arguments, used for each image matched by --glob
+            options->query += options->query.empty() ? arg : "&" + arg;
+            continue;
+        }
+
+        if (i + 1 == argc) {
+            std::cerr << "ERROR: Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        std::string value = argv[++i];
+
+        if (arg == "--manifest") {
+            options->manifest = value;
+        } else if (arg == "--glob") {
+            options->pattern = value;
+        } else if (arg == "--output-dir") {
+            options->output_dir = value;
+        } else if (arg == "--progress") {
+            options->progress = value;
+        } else if (arg == "--jobs") {
+            options->jobs = std::max(std::atoi(value.c_str()), 1);
+        } else if (arg == "--timeout") {
+            options->timeout = std::max(std::atoi(value.c_str()), 0);
+        } else {
+            std::cerr << "ERROR: Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options->manifest.empty() == options->pattern.empty()) {
+        std::cerr << "ERROR: Either --manifest or --glob is required"
+                  << std::endl;
+        return false;
+    }
+
+    if (!options->pattern.empty() && options->output_dir.empty()) {
+        std::cerr << "ERROR: --glob requires --output-dir" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool read_manifest(const std::string &manifest, std::vector<Job> *jobs) {
+    std::ifstream file(manifest);
+    if (!file) {
+        std::cerr << "ERROR: Unable to read manifest \"" << manifest << "\""
+                  << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (size_t n = 1; std::getline(file, line); ++n) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        Job job;
+        std::istringstream fields(line);
+        std::getline(fields, job.input, '\t');
+        std::getline(fields, job.output, '\t');
+        std::getline(fields, job.query);
+
+        if (job.input.empty() || job.output.empty()) {
+            std::cerr << "ERROR: Invalid job on line " << n << " of \""
+                      << manifest << "\"" << std::endl;
+            return false;
+        }
+
+        job.query = with_output(job.query, job.output);
+        jobs->push_back(std::move(job));
+    }
+
+    return true;
+}
+
+bool expand_glob(const BatchOptions &options, std::vector<Job> *jobs) {
+    glob_t matches;
+    int rc = glob(options.pattern.c_str(), 0, nullptr, &matches);
+    if (rc != 0 && rc != GLOB_NOMATCH) {
+        std::cerr << "ERROR: Unable to expand \"" << options.pattern << "\""
+                  << std::endl;
+        return false;
+    }
+
+    // The output type is either given, or defaults to that of the input
+    auto idx = options.query.find("output=");
+    std::string output_type =
+        idx != std::string::npos
+            ? options.query.substr(idx + 7,
+                                   options.query.find('&', idx) - idx - 7)
+            : "";
+
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        std::string input = matches.gl_pathv[i];
+        std::string output = options.output_dir + "/" + base_name(input);
+        if (!output_type.empty()) {
+            output = replace_extension(output, output_type);
+        }
+
+        jobs->push_back({input, output, with_output(options.query, input)});
+    }
+
+    globfree(&matches);
+
+    return true;
+}
+
+/**
+ * Appends the outcome of each job to the progress log, so that an
+ * interrupted batch can be resumed.
+ */
+class ProgressLog {
+ public:
+    /**
+     * Read the jobs that were completed before.
+     */
+    void load(const std::string &path) {
+        std::ifstream file(path);
+
+        std::string line;
+        while (std::getline(file, line)) {
+            // ok<TAB>input<TAB>output
+            if (line.rfind("ok\t", 0) == 0) {
+                completed_.insert(line.substr(3));
+            }
+        }
+
+        file_.open(path, std::ios::app);
+    }
+
+    bool completed(const Job &job) const {
+        return completed_.find(job.input + "\t" + job.output) !=
+               completed_.end();
+    }
+
+    void record(const Job &job, const Status &status) {
+        if (!file_.is_open()) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        file_ << (status.ok() ? "ok" : "error") << "\t" << job.input << "\t"
+              << job.output;
+        if (!status.ok()) {
+            file_ << "\t" << status.message();
+        }
+
+        // Flush each line, the batch may be interrupted at any time
+        file_ << std::endl;
+    }
+
+ private:
+    std::unordered_set<std::string> completed_;
+
+    std::mutex mutex_;
+    std::ofstream file_;
+};
+
+}  // namespace
+
+void batch_usage(const char *program) {
+    std::cout << program << " --manifest jobs.tsv [OPTIONS]" << std::endl
+              << program
+              << " --glob 'images/*.jpg' --output-dir thumbs [OPTIONS] "
+                 "[ARG1] [ARG2] [...]"
+              << std::endl
+              << std::endl
+              << "The manifest holds a job on each line, separated by tabs: "
+                 "input, output and"
+              << std::endl
+              << "(optionally) the query arguments, e.g. "
+                 "\"w=300&h=300&output=webp\"."
+              << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --jobs <n>         Number of images processed "
+                 "concurrently (default: number of CPUs)"
+              << std::endl
+              << "  --timeout <s>      Maximum time to process a single image "
+                 "(default: 10)"
+              << std::endl
+              << "  --progress <file>  Log of completed jobs, which are "
+                 "skipped when resumed"
+              << std::endl
+              << std::endl
+              << "Note that libvips uses its own worker threads for each "
+                 "image as well, see the"
+              << std::endl
+              << "VIPS_CONCURRENCY environment variable." << std::endl;
+}
+
+int run_batch(const std::shared_ptr<ApiManager> &api_manager, int argc,
+              const char *argv[]) {
+    BatchOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        batch_usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    if (!(options.manifest.empty() ? expand_glob(options, &jobs)
+                                   : read_manifest(options.manifest, &jobs))) {
+        return 1;
+    }
+
+    ProgressLog progress;
+    if (!options.progress.empty()) {
+        progress.load(options.progress);
+    }
+
+    // Resume where an earlier run left off
+    size_t total = jobs.size();
+    jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
+                              [&progress](const Job &job) {
+                                  return progress.completed(job);
+                              }),
+               jobs.end());
+    size_t skipped = total - jobs.size();
+
+    auto config = Config();
+    config.process_timeout = options.timeout;
+
+    std::cout << "Processing " << jobs.size() << " images (" << skipped
+              << " skipped) with " << options.jobs << " workers" << std::endl;
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+
+    std::mutex output_mutex;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            const Job &job = jobs[i];
+
+            Status status = api_manager->process_file(job.query, job.input,
+                                                      job.output, config);
+
+            progress.record(job, status);
+
+            if (status.ok()) {
+                bytes_in += file_size(job.input);
+                bytes_out += file_size(job.output);
+            } else {
+                ++failed;
+
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cerr << "ERROR: \"" << job.input
+                          << "\": " << status.message() << " ("
+                          << status.code() << ")" << std::endl;
+            }
+
+            size_t n = ++done;
+            if (n % 1000 == 0) {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cout << "Processed " << n << " of " << jobs.size()
+                          << " images" << std::endl;
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    size_t n_workers = std::min<size_t>(options.jobs, jobs.size());
+    workers.reserve(n_workers);
+    for (size_t i = 0; i < n_workers; ++i) {
+        workers.emplace_back(worker);
+    }
+
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    double rate = elapsed > 0 ? 1 / elapsed : 0;
+
+    const double mib = 1024.0 * 1024.0;
+
+    std::cout << std::fixed << std::setprecision(1) << "Processed "
+              << done - failed << " of " << jobs.size() << " images in "
+              << elapsed << "s (" << done * rate << " images/s), " << failed
+              << " failed, " << skipped << " skipped" << std::endl
+              << "Read " << bytes_in / mib << " MiB (" << bytes_in / mib * rate
+              << " MiB/s), wrote " << bytes_out / mib << " MiB ("
+              << bytes_out / mib * rate << " MiB/s)" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
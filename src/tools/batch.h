@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <weserv/api_manager.h>
+
+inline std::string get_extension(const std::string &base_filename) {
+    const size_t idx = base_filename.find_last_of('.');
+    return idx != std::string::npos ? base_filename.substr(idx + 1)
+                                    : base_filename;
+}
+
+/**
+ * Print the usage of the batch mode.
+ * @param program Name of the program.
+ */
+void batch_usage(const char *program);
+
+/**
+ * Process many images with a single API manager, on a bounded pool of
+ * worker threads. The jobs are either read from a manifest (`--manifest`)
+ * or expanded from a glob pattern (`--glob` and `--output-dir`).
+ * @param api_manager The API manager, shared by all workers.
+ * @param argc Number of command line arguments.
+ * @param argv The command line arguments, starting with the program name.
+ * @return The exit code of the program.
+ */
+int run_batch(const std::shared_ptr<weserv::api::ApiManager> &api_manager,
+              int argc, const char *argv[]);
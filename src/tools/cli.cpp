@@ -1,3 +1,4 @@
+#include "batch.h"
 #include "cli_environment.h"
 
 #include <weserv/api_manager.h>
@@ -7,16 +8,12 @@ using weserv::api::utils::Status;
 
 std::shared_ptr<weserv::api::ApiManager> api_manager;
 
-inline std::string get_extension(const std::string &base_filename) {
-    const size_t idx = base_filename.find_last_of('.');
-    return idx != std::string::npos ? base_filename.substr(idx + 1)
-                                    : base_filename;
-}
-
 int main(int argc, const char *argv[]) {
-    if (argc < 3) {
+    bool batch = argc > 1 && std::string(argv[1]).rfind("--", 0) == 0;
+    if (!batch && argc < 3) {
         std::cout << argv[0] << " image.jpg image2.jpg [ARG1] [ARG2] [...]"
                   << std::endl;
+        batch_usage(argv[0]);
         return 1;
     }
 
@@ -24,6 +21,10 @@ int main(int argc, const char *argv[]) {
     api_manager = weserv_factory.create_api_manager(
         std::unique_ptr<weserv::api::ApiEnvInterface>(new CliEnvironment()));
 
+    if (batch) {
+        return run_batch(api_manager, argc, argv);
+    }
+
     std::string query;
 
     if (argc > 3) {
@@ -3,6 +3,7 @@
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 
 #include <weserv/env_interface.h>
 
@@ -33,6 +34,10 @@ class CliEnvironment : public weserv::api::ApiEnvInterface {
                 break;
         }
 
+        // Workers of the batch mode may log concurrently
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+
         auto now = std::time(nullptr);
         std::cout << std::put_time(std::localtime(&now), "%Y/%m/%d %H:%M:%S")
                   << " [" << str_level << "]: " << message << std::endl;
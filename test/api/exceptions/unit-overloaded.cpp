@@ -0,0 +1,20 @@
+#include <catch2/catch.hpp>
+
+#include "../base.h"
+
+TEST_CASE("processing budget", "[overloaded]") {
+    SECTION("admit when idle") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover";
+        auto config = Config();
+        config.cost_budget = 1;
+
+        std::string out_buf;
+        Status status = process_file(test_image, &out_buf, params, config);
+
+        // An image is always admitted if nothing else is being processed
+        CHECK(status.ok());
+        CHECK(status.code() == 200);
+        CHECK(!out_buf.empty());
+    }
+}
@@ -0,0 +1,74 @@
+#include <catch2/catch.hpp>
+
+#include "../base.h"
+
+#include <fstream>
+#include <sstream>
+
+using Catch::Matchers::Contains;
+
+TEST_CASE("memory source", "[source]") {
+    class MemorySource : public SourceInterface {
+     public:
+        explicit MemorySource(const std::string &file) {
+            std::ifstream t(file, std::ios::binary);
+            std::stringstream buffer;
+            buffer << t.rdbuf();
+            buffer_ = buffer.str();
+        }
+
+        // Should not be called, since the entire source is available within
+        // memory
+        int64_t read(void * /* unsused */, size_t /* unsused */) override {
+            return -1;
+        }
+
+        int64_t seek(int64_t /* unsused */, int /* unsused */) override {
+            return -1;
+        }
+
+        const void *memory(size_t *length) override {
+            *length = buffer_.size();
+            return buffer_.data();
+        }
+
+     private:
+        std::string buffer_;
+    };
+
+    class StringTarget : public TargetInterface {
+     public:
+        explicit StringTarget(std::string *out) : out_(out) {}
+
+        void setup(const std::string & /* unsused */) override {}
+
+        int64_t write(const void *data, size_t length) override {
+            out_->append(reinterpret_cast<const char *>(data), length);
+            return length;
+        }
+
+        int64_t read(void * /* unsused */, size_t /* unsused */) override {
+            return -1;
+        }
+
+        int64_t seek(int64_t /* unsused */, int /* unsused */) override {
+            return -1;
+        }
+
+        int end() override {
+            return 0;
+        }
+
+     private:
+        std::string *out_;
+    };
+
+    std::string out;
+    Status status = process(
+        std::unique_ptr<SourceInterface>(new MemorySource(fixtures->input_jpg)),
+        std::unique_ptr<TargetInterface>(new StringTarget(&out)),
+        "output=json");
+
+    CHECK(status.ok());
+    CHECK_THAT(out, Contains(R"("format":"jpeg")"));
+}
@@ -80,3 +80,45 @@ TEST_CASE("query ignore", "[query]") {
         CHECK(image.width() == 200);
     }
 }
+
+TEST_CASE("query canonical", "[query]") {
+    SECTION("sorted") {
+        CHECK_THAT(api_manager->canonical_query("w=300&h=200"),
+                   Equals(api_manager->canonical_query("h=200&w=300")));
+    }
+
+    SECTION("synonyms") {
+        CHECK_THAT(
+            api_manager->canonical_query("w=300&h=200"),
+            Equals(api_manager->canonical_query("height=200&width=300")));
+    }
+
+    SECTION("ignore non-API keys") {
+        CHECK_THAT(api_manager->canonical_query(
+                       "url=wsrv.nl/lichtenstein.jpg&v=1&w=300&maxage=7d"),
+                   Equals(api_manager->canonical_query("w=300")));
+    }
+
+    SECTION("typed values") {
+        CHECK_THAT(api_manager->canonical_query("w=50%25&bg=red&sharp=1,2,3"),
+                   Equals("bg=ffff0000&sharp=3&sharpf=1&sharpj=2&w=50%"));
+    }
+
+    SECTION("default values") {
+        CHECK_THAT(api_manager->canonical_query(
+                       "w=300&fit=inside&a=center&flip=false&output=origin"),
+                   Equals("w=300"));
+        CHECK_THAT(api_manager->canonical_query("n=1&page=0&mod=1,1,0"),
+                   Equals(""));
+    }
+
+    SECTION("non-default values") {
+        CHECK_THAT(api_manager->canonical_query("fit=cover&output=webp&flip"),
+                   Equals("fit=2&flip=true&output=8"));
+    }
+
+    SECTION("different values") {
+        CHECK_THAT(api_manager->canonical_query("w=300"),
+                   !Equals(api_manager->canonical_query("w=301")));
+    }
+}
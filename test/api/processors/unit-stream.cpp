@@ -4,10 +4,13 @@
 
 #include <cstdio>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include <vips/vips8>
 
 using Catch::Matchers::Contains;
 using Catch::Matchers::Equals;
+using Catch::Matchers::Matches;
 using Catch::Matchers::StartsWith;
 using vips::VImage;
 
@@ -141,6 +144,18 @@ TEST_CASE("output", "[stream]") {
         CHECK_THAT(buffer, Contains(R"("height":300)"));
     }
 
+    SECTION("blurhash") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=blurhash";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        // 4x3 components: a size flag, the maximum AC value, the DC value
+        // and 11 AC values
+        CHECK_THAT(buffer, Matches(R"(\{"blurhash":"L.{27}",)"
+                                   R"("width":32,"height":32\})"));
+    }
+
     SECTION("origin") {
         auto test_image = fixtures->input_jpg;
         auto params = "w=300&h=300&fit=cover&output=origin";
@@ -153,6 +168,41 @@ TEST_CASE("output", "[stream]") {
         CHECK(image.height() == 300);
     }
 
+    SECTION("auto") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=auto";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        // Falls back to the format of the source image
+        CHECK_THAT(image.get_string("vips-loader"), Equals("jpegload_buffer"));
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 300);
+    }
+
+    SECTION("auto webp") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "webpload_source"
+                                                : "webpload_buffer") == 0 ||
+            vips_type_find("VipsOperation", true_streaming
+                                                ? "webpsave_target"
+                                                : "webpsave_buffer") == 0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=auto&accept=webp";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("webpload_buffer"));
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 300);
+    }
+
     SECTION("file") {
         auto test_image = fixtures->input_jpg;
         auto params = "w=300&h=300&fit=cover&output=jpg";
@@ -205,6 +255,23 @@ TEST_CASE("special page", "[stream]") {
         CHECK(image.width() == 16);
         CHECK(image.height() == 16);
     }
+
+    SECTION("largest pyramid level") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "tiffload_source"
+                                                : "tiffload_buffer") == 0) {
+            SUCCEED("no tiff support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_tiff_pyramid;
+        auto params = "page=-1&w=500&h=103";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 500);
+        CHECK(image.height() == 103);
+    }
 }
 
 TEST_CASE("quality and compression", "[stream]") {
@@ -534,4 +601,83 @@ TEST_CASE("metadata", "[stream]") {
 
         CHECK_THAT(buffer, Contains(R"("format":"magick")"));
     }
+
+    SECTION("exif orientation") {
+        auto test_image = fixtures->input_jpg_with_landscape_exif_6;
+        auto params = "w=320&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("width":320)"));
+        CHECK_THAT(buffer, Contains(R"("height":213)"));
+        CHECK_THAT(buffer, Contains(R"("orientation":0)"));
+    }
+
+    SECTION("smart crop") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=80&h=320&fit=cover&a=attention&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("width":80)"));
+        CHECK_THAT(buffer, Contains(R"("height":320)"));
+    }
+
+    SECTION("trim reports the untrimmed dimensions") {
+        auto test_image = fixtures->input_jpg_overlay_layer_2;
+        auto params = "trim=10&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("width":2048)"));
+        CHECK_THAT(buffer, Contains(R"("height":1536)"));
+    }
+}
+
+TEST_CASE("batch", "[stream]") {
+    std::ifstream t(fixtures->input_jpg, std::ios::binary);
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+
+    SECTION("widths") {
+        std::vector<std::string> queries = {"w=100", "w=300", "w=200&h=200",
+                                            "w=50&trim"};
+        std::vector<std::string> outputs;
+
+        auto statuses = api_manager->process_buffer(queries, buffer.str(),
+                                                     &outputs, Config());
+
+        REQUIRE(statuses.size() == 4);
+        REQUIRE(outputs.size() == 4);
+
+        std::vector<std::pair<int, int>> expected = {
+            {100, 0}, {300, 0}, {200, 200}, {50, 0}};
+        for (size_t i = 0; i < statuses.size(); ++i) {
+            REQUIRE(statuses[i].ok());
+
+            auto image = VImage::new_from_buffer(outputs[i], "");
+
+            CHECK(image.width() == expected[i].first);
+            if (expected[i].second != 0) {
+                CHECK(image.height() == expected[i].second);
+            }
+        }
+    }
+
+    SECTION("per variant status") {
+        Config config;
+        config.savers = static_cast<uintptr_t>(Output::Jpeg);
+
+        std::vector<std::string> queries = {"w=100", "w=100&output=png"};
+        std::vector<std::string> outputs;
+
+        auto statuses = api_manager->process_buffer(queries, buffer.str(),
+                                                     &outputs, config);
+
+        REQUIRE(statuses.size() == 2);
+
+        CHECK(statuses[0].ok());
+        CHECK(statuses[1].code() ==
+              static_cast<int>(Status::Code::UnsupportedSaver));
+    }
 }
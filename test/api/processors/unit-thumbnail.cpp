@@ -272,6 +272,101 @@ TEST_CASE("tiff", "[thumbnail]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
+    SECTION("subifd pyramid") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "tiffload_source"
+                                                : "tiffload_buffer") == 0 ||
+            vips_type_find("VipsOperation", "tiffsave_buffer") == 0 ||
+            vips_version(0) < 8 ||
+            (vips_version(0) == 8 && vips_version(1) < 10)) {
+            SUCCEED("no tiff subifd support, skipping test");
+            return;
+        }
+
+        auto expected_image = fixtures->expected_dir + "/tiff-pyramid.tiff";
+        auto params = "w=500&h=103";  // subifd=2
+
+        // Store the levels of the pyramid within the SubIFDs of one page
+        auto pyramid = VImage::new_from_file(
+            fixtures->input_tiff_pyramid.c_str(),
+            VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
+
+        void *buf;
+        size_t size;
+        pyramid.write_to_buffer(".tiff", &buf, &size,
+                                VImage::option()
+                                    ->set("tile", true)
+                                    ->set("pyramid", true)
+                                    ->set("subifd", true));
+        std::string test_buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        VImage image = process_buffer<VImage>(test_buffer, params);
+
+        CHECK(image.width() == 500);
+        CHECK(image.height() == 103);
+
+        CHECK_THAT(image, is_similar_image(expected_image));
+    }
+
+    SECTION("subifd pyramid level is used") {
+        if (vips_type_find("VipsOperation", true_streaming
+                                                ? "tiffload_source"
+                                                : "tiffload_buffer") == 0 ||
+            vips_type_find("VipsOperation", "tiffsave_buffer") == 0 ||
+            vips_version(0) < 8 ||
+            (vips_version(0) == 8 && vips_version(1) < 10)) {
+            SUCCEED("no tiff subifd support, skipping test");
+            return;
+        }
+
+        auto params = "w=500&h=103";  // subifd=2
+
+        // Shrink the levels by taking the maximum of each region, so that
+        // these are distinguishable from a page that is scaled down
+        auto pyramid = VImage::new_from_file(
+            fixtures->input_tiff_pyramid.c_str(),
+            VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
+
+        void *buf;
+        size_t size;
+        pyramid.write_to_buffer(
+            ".tiff", &buf, &size,
+            VImage::option()
+                ->set("tile", true)
+                ->set("pyramid", true)
+                ->set("subifd", true)
+                ->set("region_shrink", VIPS_REGION_SHRINK_MAX));
+        std::string test_buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        auto thumbnail = [&](int subifd) {
+            auto *blob = vips_blob_copy(test_buffer.data(), test_buffer.size());
+            VImage level = VImage::tiffload_buffer(
+                blob, VImage::option()->set("subifd", subifd));
+            vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+            return level.thumbnail_image(
+                500, VImage::option()
+                         ->set("height", 103)
+                         ->set("size", VIPS_SIZE_FORCE));
+        };
+
+        // The mean absolute difference between two images of equal dimensions
+        auto difference = [](const VImage &a, const VImage &b) {
+            return (a - b).abs().avg();
+        };
+
+        VImage image = process_buffer<VImage>(test_buffer, params);
+
+        CHECK(image.width() == 500);
+        CHECK(image.height() == 103);
+
+        // Scaled down from the third SubIFD, rather than from the page itself
+        CHECK(difference(image, thumbnail(2)) <
+              difference(image, thumbnail(-1)));
+    }
+
     SECTION("pyramid skip shrink-on-load") {
         if (vips_type_find("VipsOperation", true_streaming
                                                 ? "tiffload_source"
@@ -526,6 +621,102 @@ TEST_CASE("shortest edge is at least 1 pixel", "[thumbnail]") {
     }
 }
 
+TEST_CASE("exif thumbnail", "[thumbnail]") {
+    auto config = Config();
+    config.exif_thumbnail = 1;
+
+    // The JPEG thumbnail embedded within the EXIF block of an image
+    auto embedded_thumbnail = [](const VImage &image) {
+        size_t length;
+        const auto *exif = static_cast<const char *>(
+            image.get_blob(VIPS_META_EXIF_NAME, &length));
+
+        size_t offset = std::string(exif, length).find("\xFF\xD8\xFF");
+        REQUIRE(offset != std::string::npos);
+
+        auto *blob = vips_blob_copy(exif + offset, length - offset);
+        VImage thumbnail = VImage::jpegload_buffer(blob);
+        vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+        return thumbnail;
+    };
+
+    // The mean absolute difference between two images of equal dimensions
+    auto difference = [](const VImage &a, const VImage &b) {
+        return (a - b).abs().avg();
+    };
+
+    // Has a 196x147 EXIF thumbnail
+    SECTION("covers the requested size") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "w=160";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+        VImage decoded = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 160);
+        CHECK(image.height() == 120);
+
+        // Scaled down from the thumbnail, rather than from the image itself
+        VImage expected =
+            embedded_thumbnail(VImage::new_from_file(test_image.c_str()))
+                .thumbnail_image(160);
+
+        CHECK(difference(image, expected) < difference(decoded, expected));
+    }
+
+    SECTION("larger than the thumbnail") {
+        auto test_image = fixtures->input_jpg_320x240;
+        auto params = "w=240";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+        VImage decoded = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 240);
+        CHECK(image.height() == 180);
+        CHECK(difference(image, decoded) == 0.0);
+    }
+
+    // The EXIF block, including the 196x147 thumbnail, is kept when the image
+    // is cropped to 2:1
+    SECTION("aspect ratio mismatch") {
+        auto source =
+            VImage::new_from_file(fixtures->input_jpg_320x240.c_str());
+
+        void *buf;
+        size_t size;
+        source.crop(0, 40, 320, 160).write_to_buffer(".jpg", &buf, &size);
+        std::string test_buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        auto params = "w=100";
+
+        REQUIRE(embedded_thumbnail(VImage::new_from_buffer(test_buffer, ""))
+                    .width() == 196);
+
+        VImage image = process_buffer<VImage>(test_buffer, params, config);
+        VImage decoded = process_buffer<VImage>(test_buffer, params);
+
+        CHECK(image.width() == 100);
+        CHECK(image.height() == 50);
+        CHECK(difference(image, decoded) == 0.0);
+    }
+
+    // Has a 160x107 sRGB thumbnail, which can't be used for a CMYK image
+    SECTION("color space mismatch") {
+        auto test_image = fixtures->input_jpg_with_cmyk_profile;
+        auto params = "w=80";
+
+        VImage image = process_file<VImage>(test_image, params, config);
+        VImage decoded = process_file<VImage>(test_image, params);
+
+        CHECK(image.interpretation() == VIPS_INTERPRETATION_sRGB);
+        CHECK(image.width() == 80);
+        CHECK(image.height() == 53);
+        CHECK(difference(image, decoded) == 0.0);
+    }
+}
+
 TEST_CASE("pdf", "[thumbnail]") {
     if (vips_type_find("VipsOperation", true_streaming
                                             ? "pdfload_source"
@@ -53,6 +53,9 @@ TEST_CASE("status", "[status]") {
                   .http_code() == 400);
         CHECK(Status(Status::Code::Unknown, "", Status::ErrorCause::Application)
                   .http_code() == 500);
+        CHECK(Status(Status::Code::Overloaded, "",
+                     Status::ErrorCause::Application)
+                  .http_code() == 503);
     }
 
     SECTION("to JSON includes details") {
@@ -0,0 +1,373 @@
+#include <catch2/catch.hpp>
+
+#include "../../../src/api/utils/tiff.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using weserv::api::utils::read_tiff_directories;
+using weserv::api::utils::TiffDirectory;
+
+namespace {
+
+constexpr uint16_t TAG_IMAGE_WIDTH = 0x0100;
+constexpr uint16_t TAG_IMAGE_LENGTH = 0x0101;
+constexpr uint16_t TAG_SUBIFDS = 0x014A;
+
+constexpr uint16_t TYPE_SHORT = 3;
+constexpr uint16_t TYPE_LONG = 4;
+constexpr uint16_t TYPE_LONG8 = 16;
+constexpr uint16_t TYPE_IFD8 = 18;
+
+struct Entry {
+    uint16_t tag;
+    uint16_t type;
+    uint64_t count;
+
+    /**
+     * The value itself, or the offset of the values if these don't fit
+     * within the entry.
+     */
+    uint64_t value;
+};
+
+/**
+ * Builds a TIFF image that consists of its directories only.
+ */
+class TiffBuilder {
+ public:
+    TiffBuilder(bool little_endian, bool big_tiff)
+        : little_endian_(little_endian), big_tiff_(big_tiff) {
+        data_.assign(2, little_endian ? 'I' : 'M');
+        put(big_tiff ? 43 : 42, 2);
+        if (big_tiff) {
+            put(8, 2);
+            put(0, 2);
+        }
+
+        first_ifd_ = data_.size();
+        put(0, offset_size());
+    }
+
+    /**
+     * Set the offset of the first directory within the header.
+     */
+    void first(uint64_t offset) {
+        patch(first_ifd_, offset);
+    }
+
+    /**
+     * Append a directory.
+     * @return The offset of the directory.
+     */
+    uint64_t directory(const std::vector<Entry> &entries, uint64_t next = 0) {
+        uint64_t offset = data_.size();
+
+        put(entries.size(), big_tiff_ ? 8 : 2);
+        for (const auto &entry : entries) {
+            put(entry.tag, 2);
+            put(entry.type, 2);
+            put(entry.count, offset_size());
+
+            // Values are left-justified within the entry
+            size_t size = type_size(entry.type);
+            size_t start = data_.size();
+            put(entry.value, entry.count * size <= offset_size()
+                                 ? size
+                                 : offset_size());
+            data_.resize(start + offset_size(), 0);
+        }
+
+        next_[offset] = data_.size();
+        put(next, offset_size());
+
+        return offset;
+    }
+
+    /**
+     * Set the offset of the directory that follows a directory.
+     */
+    void link(uint64_t directory, uint64_t next) {
+        patch(next_.at(directory), next);
+    }
+
+    /**
+     * Append an array of values of the given type.
+     * @return The offset of the array.
+     */
+    uint64_t array(const std::vector<uint64_t> &values, uint16_t type) {
+        uint64_t offset = data_.size();
+        for (uint64_t value : values) {
+            put(value, type_size(type));
+        }
+
+        return offset;
+    }
+
+    /**
+     * Append bytes that aren't part of any directory, e.g. the pixel data.
+     */
+    void pad(size_t length) {
+        data_.resize(data_.size() + length, 0);
+    }
+
+    const std::vector<uint8_t> &data() const {
+        return data_;
+    }
+
+    bool read(std::vector<TiffDirectory> *directories) const {
+        return read_tiff_directories(data_.data(), data_.size(), directories);
+    }
+
+ private:
+    const bool little_endian_;
+    const bool big_tiff_;
+
+    std::vector<uint8_t> data_;
+
+    size_t first_ifd_ = 0;
+
+    /**
+     * The position of the next offset of each directory.
+     */
+    std::unordered_map<uint64_t, size_t> next_;
+
+    size_t offset_size() const {
+        return big_tiff_ ? 8 : 4;
+    }
+
+    static size_t type_size(uint16_t type) {
+        return type == TYPE_SHORT                         ? 2
+               : type == TYPE_LONG8 || type == TYPE_IFD8 ? 8
+                                                          : 4;
+    }
+
+    void put(uint64_t value, size_t size) {
+        size_t start = data_.size();
+        data_.resize(start + size);
+        write(start, value, size);
+    }
+
+    void patch(size_t position, uint64_t value) {
+        write(position, value, offset_size());
+    }
+
+    void write(size_t position, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            data_[position + (little_endian_ ? i : size - 1 - i)] =
+                static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+};
+
+std::vector<Entry> dimensions(uint16_t type, uint64_t width,
+                              uint64_t height) {
+    return {{TAG_IMAGE_WIDTH, type, 1, width},
+            {TAG_IMAGE_LENGTH, type, 1, height}};
+}
+
+}  // namespace
+
+TEST_CASE("tiff directories", "[tiff]") {
+    std::vector<TiffDirectory> directories;
+
+    SECTION("classic and BigTIFF in both byte orders") {
+        for (bool little_endian : {true, false}) {
+            for (bool big_tiff : {false, true}) {
+                CAPTURE(little_endian, big_tiff);
+
+                TiffBuilder tiff(little_endian, big_tiff);
+                uint64_t first =
+                    tiff.directory(dimensions(TYPE_SHORT, 640, 480));
+                tiff.first(first);
+                tiff.link(first,
+                          tiff.directory(dimensions(TYPE_LONG, 70000, 50)));
+
+                REQUIRE(tiff.read(&directories));
+                REQUIRE(directories.size() == 2);
+
+                CHECK(directories[0].width == 640);
+                CHECK(directories[0].height == 480);
+                CHECK(directories[0].subifds.empty());
+                CHECK(directories[1].width == 70000);
+                CHECK(directories[1].height == 50);
+            }
+        }
+    }
+
+    SECTION("LONG8 dimensions") {
+        for (bool little_endian : {true, false}) {
+            CAPTURE(little_endian);
+
+            TiffBuilder tiff(little_endian, true);
+            tiff.first(tiff.directory(dimensions(TYPE_LONG8, 300, 200)));
+
+            REQUIRE(tiff.read(&directories));
+            REQUIRE(directories.size() == 1);
+
+            CHECK(directories[0].width == 300);
+            CHECK(directories[0].height == 200);
+        }
+    }
+
+    SECTION("LONG8 dimension above VIPS_MAX_COORD") {
+        TiffBuilder tiff(true, true);
+        tiff.first(tiff.directory(dimensions(TYPE_LONG8, 10000001, 200)));
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("LONG8 dimension that is valid when truncated to 4 bytes") {
+        TiffBuilder tiff(false, true);
+        tiff.first(tiff.directory(
+            dimensions(TYPE_LONG8, (uint64_t{1} << 32) + 300, 200)));
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("LONG8 dimension within a classic TIFF") {
+        TiffBuilder tiff(true, false);
+        tiff.first(tiff.directory(dimensions(TYPE_LONG8, 300, 200)));
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("directory loop") {
+        TiffBuilder tiff(true, false);
+        uint64_t first = tiff.directory(dimensions(TYPE_SHORT, 640, 480));
+        tiff.first(first);
+        tiff.link(first,
+                  tiff.directory(dimensions(TYPE_SHORT, 320, 240), first));
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("directory that refers to itself") {
+        TiffBuilder tiff(false, true);
+        uint64_t first = tiff.directory(dimensions(TYPE_SHORT, 640, 480));
+        tiff.first(first);
+        tiff.link(first, first);
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("next offset out of bounds") {
+        TiffBuilder tiff(true, false);
+        uint64_t first = tiff.directory(dimensions(TYPE_SHORT, 640, 480));
+        tiff.first(first);
+        tiff.link(first, tiff.data().size() + 100);
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("truncated directory") {
+        TiffBuilder tiff(false, false);
+        tiff.first(tiff.directory(dimensions(TYPE_SHORT, 640, 480)));
+
+        std::vector<uint8_t> data = tiff.data();
+        data.resize(data.size() - 6);
+
+        CHECK(!read_tiff_directories(data.data(), data.size(), &directories));
+    }
+
+    SECTION("not a TIFF image") {
+        const uint8_t data[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F'};
+
+        CHECK(!read_tiff_directories(data, sizeof(data), &directories));
+        CHECK(!read_tiff_directories(data, 2, &directories));
+    }
+
+    SECTION("SubIFD array out of line") {
+        for (bool little_endian : {true, false}) {
+            for (bool big_tiff : {false, true}) {
+                CAPTURE(little_endian, big_tiff);
+
+                TiffBuilder tiff(little_endian, big_tiff);
+
+                uint64_t level1 =
+                    tiff.directory(dimensions(TYPE_LONG, 500, 400));
+                uint64_t level2 =
+                    tiff.directory(dimensions(TYPE_LONG, 250, 200));
+                uint64_t level3 =
+                    tiff.directory(dimensions(TYPE_SHORT, 125, 100));
+
+                // 3 offsets never fit within an entry
+                uint16_t type = big_tiff ? TYPE_IFD8 : TYPE_LONG;
+                uint64_t array = tiff.array({level1, level2, level3}, type);
+
+                auto entries = dimensions(TYPE_LONG, 1000, 800);
+                entries.push_back({TAG_SUBIFDS, type, 3, array});
+                tiff.first(tiff.directory(entries));
+
+                REQUIRE(tiff.read(&directories));
+                REQUIRE(directories.size() == 1);
+
+                CHECK(directories[0].width == 1000);
+                CHECK(directories[0].height == 800);
+                CHECK(directories[0].subifds ==
+                      std::vector<std::pair<int, int>>{
+                          {500, 400}, {250, 200}, {125, 100}});
+            }
+        }
+    }
+
+    SECTION("SubIFD array out of bounds") {
+        TiffBuilder tiff(true, false);
+
+        auto entries = dimensions(TYPE_LONG, 1000, 800);
+        entries.push_back(
+            {TAG_SUBIFDS, TYPE_LONG, 2, tiff.data().size() + 1000});
+        tiff.first(tiff.directory(entries));
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("SubIFD that refers to its page") {
+        TiffBuilder tiff(false, false);
+
+        // A single offset is stored within the entry
+        uint64_t page = tiff.data().size();
+        auto entries = dimensions(TYPE_LONG, 1000, 800);
+        entries.push_back({TAG_SUBIFDS, TYPE_LONG, 1, page});
+        tiff.first(tiff.directory(entries));
+
+        CHECK(!tiff.read(&directories));
+    }
+
+    SECTION("only the directories are read") {
+        TiffBuilder tiff(true, true);
+
+        uint64_t level = tiff.directory(dimensions(TYPE_LONG, 500, 400));
+        tiff.pad(1024 * 1024);
+
+        auto entries = dimensions(TYPE_LONG, 1000, 800);
+        entries.push_back({TAG_SUBIFDS, TYPE_IFD8, 1, level});
+        tiff.first(tiff.directory(entries));
+        tiff.pad(1024 * 1024);
+
+        const std::vector<uint8_t> &data = tiff.data();
+        size_t bytes_read = 0;
+
+        REQUIRE(read_tiff_directories(
+            [&](uint64_t offset, uint8_t *out, size_t size) {
+                if (offset > data.size() || data.size() - offset < size) {
+                    return false;
+                }
+
+                std::copy(data.begin() + offset, data.begin() + offset + size,
+                          out);
+                bytes_read += size;
+                return true;
+            },
+            &directories));
+        REQUIRE(directories.size() == 1);
+
+        CHECK(directories[0].width == 1000);
+        CHECK(directories[0].subifds ==
+              std::vector<std::pair<int, int>>{{500, 400}});
+        CHECK(bytes_read < 1024);
+    }
+}
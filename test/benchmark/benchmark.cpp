@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <weserv/api_manager.h>
+
+using weserv::api::ApiEnvInterface;
+using weserv::api::Config;
+using weserv::api::utils::Status;
+
+/**
+ * A quiet implementation of ApiEnvInterface, only errors are logged.
+ */
+class BenchmarkEnvironment : public ApiEnvInterface {
+ public:
+    void log(LogLevel level, const char *message) override {
+        if (level == LogLevel::Error) {
+            std::cerr << "[error]: " << message << std::endl;
+        }
+    }
+};
+
+/**
+ * A benchmark case, i.e. a query that is applied to a fixture.
+ */
+struct BenchmarkCase {
+    std::string name;
+    std::string fixture;
+    std::string query;
+};
+
+/**
+ * The measurements of a benchmark case.
+ */
+struct BenchmarkResult {
+    const BenchmarkCase *benchmark;
+    bool ok;
+    double mean_ms;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double throughput;
+
+    /**
+     * Peak RSS of the process that ran this case, see run_isolated.
+     */
+    long peak_rss_kb;
+};
+
+const char *const JPEG = "2569067123_aca715a2ee_o.jpg";
+const char *const PNG = "50020484-00001.png";
+const char *const GIF = "dancing-banana.gif";
+
+// clang-format off
+const std::vector<BenchmarkCase> cases = {
+    {"thumbnail",   JPEG, "w=300"},
+    {"cover_crop",  JPEG, "w=300&h=300&fit=cover"},
+    {"smartcrop",   JPEG, "w=300&h=300&fit=cover&a=attention"},
+    {"mask",        PNG,  "w=300&mask=circle"},
+    {"jpeg_output", PNG,  "w=300&output=jpg"},
+    {"webp_output", JPEG, "w=300&output=webp"},
+    {"avif_output", JPEG, "w=300&output=avif"},
+    {"animated",    GIF,  "w=100&n=-1"},
+    {"point_ops",   JPEG, "w=300&bri=10&con=20&gam=2.2&filt=negate"},
+    {"duotone",     JPEG, "w=300&filt=duotone"},
+    {"tint",        JPEG, "w=300&tint=red"},
+};
+// clang-format on
+
+inline bool read_file(const std::string &path, std::string *out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::ostringstream ss;
+    ss << file.rdbuf();
+    *out = ss.str();
+
+    return true;
+}
+
+/**
+ * Nearest-rank percentile of a sorted vector.
+ */
+inline double percentile(const std::vector<double> &sorted, double p) {
+    auto rank = static_cast<size_t>(
+        std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+BenchmarkResult run(weserv::api::ApiManager &api_manager,
+                    const BenchmarkCase &benchmark, const std::string &input,
+                    const Config &config, int warmup, int iterations) {
+    BenchmarkResult result{&benchmark, true, 0, 0, 0, 0, 0, 0};
+    std::string output;
+
+    for (int i = 0; i < warmup; ++i) {
+        Status status = api_manager.process_buffer(benchmark.query, input,
+                                                   &output, config);
+        if (!status.ok()) {
+            std::cerr << benchmark.name << ": " << status.message()
+                      << ", skipping" << std::endl;
+            result.ok = false;
+            return result;
+        }
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        Status status = api_manager.process_buffer(benchmark.query, input,
+                                                   &output, config);
+        auto end = std::chrono::steady_clock::now();
+
+        if (!status.ok()) {
+            std::cerr << benchmark.name << ": " << status.message()
+                      << ", skipping" << std::endl;
+            result.ok = false;
+            return result;
+        }
+
+        latencies.push_back(
+            std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+    auto elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+    std::sort(latencies.begin(), latencies.end());
+
+    double sum = 0;
+    for (double latency : latencies) {
+        sum += latency;
+    }
+
+    result.mean_ms = sum / static_cast<double>(latencies.size());
+    result.p50_ms = percentile(latencies, 50);
+    result.p90_ms = percentile(latencies, 90);
+    result.p99_ms = percentile(latencies, 99);
+    result.throughput = static_cast<double>(iterations) / elapsed;
+
+    return result;
+}
+
+/**
+ * Run a benchmark case within a child process, so that its peak RSS isn't
+ * affected by the cases that ran before it.
+ */
+BenchmarkResult run_isolated(const BenchmarkCase &benchmark,
+                             const std::string &input, const Config &config,
+                             int warmup, int iterations) {
+    BenchmarkResult result{&benchmark, false, 0, 0, 0, 0, 0, 0};
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::cerr << benchmark.name << ": unable to create pipe, skipping"
+                  << std::endl;
+        return result;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+
+        std::cerr << benchmark.name << ": unable to fork, skipping"
+                  << std::endl;
+        return result;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        // libvips is only initialized within the child processes, since its
+        // worker threads don't survive a fork
+        weserv::api::ApiManagerFactory weserv_factory;
+        auto api_manager = weserv_factory.create_api_manager(
+            std::unique_ptr<ApiEnvInterface>(new BenchmarkEnvironment()));
+
+        auto child_result =
+            run(*api_manager, benchmark, input, config, warmup, iterations);
+
+        ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+        _exit(written == sizeof(child_result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    // The result fits within PIPE_BUF, so it's written atomically
+    ssize_t length = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+
+    int status;
+    struct rusage usage {};
+    if (wait4(pid, &status, 0, &usage) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || length != sizeof(result)) {
+        std::cerr << benchmark.name << ": child process failed, skipping"
+                  << std::endl;
+        result.ok = false;
+        return result;
+    }
+
+    // ru_maxrss is in kilobytes on Linux
+    result.peak_rss_kb = usage.ru_maxrss;
+
+    return result;
+}
+
+void write_json(std::ostream &out, const std::vector<BenchmarkResult> &results,
+                int iterations) {
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"iterations\": " << iterations << ",\n";
+    out << "  \"cases\": [\n";
+
+    bool first = true;
+    for (const auto &result : results) {
+        if (!result.ok) {
+            continue;
+        }
+
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+
+        // One case per line, see read_baseline
+        out << "    {\"name\": \"" << result.benchmark->name << "\", "
+            << "\"fixture\": \"" << result.benchmark->fixture << "\", "
+            << "\"query\": \"" << result.benchmark->query << "\", "
+            << "\"mean_ms\": " << result.mean_ms << ", "
+            << "\"p50_ms\": " << result.p50_ms << ", "
+            << "\"p90_ms\": " << result.p90_ms << ", "
+            << "\"p99_ms\": " << result.p99_ms << ", "
+            << "\"throughput\": " << result.throughput << ", "
+            << "\"peak_rss_kb\": " << result.peak_rss_kb << "}";
+    }
+
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+/**
+ * Read the median latency of each case from a baseline that was previously
+ * written by this tool.
+ */
+std::map<std::string, double> read_baseline(const std::string &path) {
+    std::map<std::string, double> baseline;
+
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        auto name_pos = line.find("\"name\": \"");
+        auto p50_pos = line.find("\"p50_ms\": ");
+        if (name_pos == std::string::npos || p50_pos == std::string::npos) {
+            continue;
+        }
+
+        name_pos += sizeof("\"name\": \"") - 1;
+        auto name = line.substr(name_pos, line.find('"', name_pos) - name_pos);
+        baseline[name] = std::strtod(
+            line.c_str() + p50_pos + sizeof("\"p50_ms\": ") - 1, nullptr);
+    }
+
+    return baseline;
+}
+
+/**
+ * Compare the results against a baseline.
+ * @return The number of cases whose median latency regressed by more than
+ *         the given threshold.
+ */
+int compare(const std::vector<BenchmarkResult> &results,
+            const std::map<std::string, double> &baseline, double threshold) {
+    int regressions = 0;
+
+    std::cerr << std::fixed << std::setprecision(3);
+    for (const auto &result : results) {
+        auto it = baseline.find(result.benchmark->name);
+        if (!result.ok || it == baseline.end() || it->second <= 0) {
+            continue;
+        }
+
+        double change = result.p50_ms / it->second - 1.0;
+        bool regressed = change > threshold;
+        if (regressed) {
+            ++regressions;
+        }
+
+        std::cerr << (regressed ? "REGRESSION " : "ok         ")
+                  << std::left << std::setw(16) << result.benchmark->name
+                  << std::right << it->second << "ms -> " << result.p50_ms
+                  << "ms (" << std::showpos << change * 100.0
+                  << std::noshowpos << "%)" << std::endl;
+    }
+
+    return regressions;
+}
+
+int main(int argc, const char *argv[]) {
+    std::string fixtures_dir = "test/api/fixtures";
+    std::string output_file;
+    std::string baseline_file;
+    int warmup = 2;
+    int iterations = 20;
+    double threshold = 0.10;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--fixtures" && has_value) {
+            fixtures_dir = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            output_file = argv[++i];
+        } else if (arg == "--baseline" && has_value) {
+            baseline_file = argv[++i];
+        } else if (arg == "--warmup" && has_value) {
+            warmup = std::max(std::atoi(argv[++i]), 0);
+        } else if (arg == "--iterations" && has_value) {
+            iterations = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--threshold" && has_value) {
+            threshold = std::strtod(argv[++i], nullptr);
+        } else {
+            std::cout << argv[0]
+                      << " [--fixtures <dir>] [--iterations <n>]"
+                         " [--warmup <n>] [--output <file.json>]"
+                         " [--baseline <file.json>] [--threshold <ratio>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    auto config = Config();
+
+    // Don't let the timeout interfere with slow cases
+    config.process_timeout = 0;
+
+    std::vector<BenchmarkResult> results;
+    for (const auto &benchmark : cases) {
+        std::string input;
+        if (!read_file(fixtures_dir + "/" + benchmark.fixture, &input)) {
+            std::cerr << "ERROR: Unable to read fixture \"" << fixtures_dir
+                      << "/" << benchmark.fixture << "\"" << std::endl;
+            return 1;
+        }
+
+        results.push_back(
+            run_isolated(benchmark, input, config, warmup, iterations));
+    }
+
+    if (output_file.empty()) {
+        write_json(std::cout, results, iterations);
+    } else {
+        std::ofstream out(output_file);
+        write_json(out, results, iterations);
+    }
+
+    if (!baseline_file.empty()) {
+        auto baseline = read_baseline(baseline_file);
+        if (baseline.empty()) {
+            std::cerr << "ERROR: Unable to read baseline \"" << baseline_file
+                      << "\"" << std::endl;
+            return 1;
+        }
+
+        if (compare(results, baseline, threshold) > 0) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
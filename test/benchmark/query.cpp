@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "enums.h"
+#include "parsers/query.h"
+
+#include <weserv/enums.h>
+
+using weserv::api::enums::Canvas;
+using weserv::api::enums::Output;
+using weserv::api::enums::Position;
+using weserv::api::parsers::Color;
+using weserv::api::parsers::Coordinate;
+using weserv::api::parsers::Query;
+
+// clang-format off
+const std::vector<std::string> queries = {
+    "w=300",
+    "w=300&h=300&fit=cover&a=attention",
+    "w=300&mask=circle&mbg=red&output=png",
+    "width=200&height=200&precrop&cx=10&cy=10&cw=100&ch=100&sharp=1,2,3",
+    "w=100&n=-1&delay=100,200,300&loop=0&output=webp&q=75&il",
+};
+// clang-format on
+
+/**
+ * Look up the keys that are read while processing a typical image, roughly in
+ * the order and frequency of the processors.
+ */
+inline int lookup(Query &query) {
+    int sum = query.get<int>("n", 1) + query.get<int>("page", 0);
+
+    query.update("page_height", 100);
+    query.update("angle", 0);
+
+    sum += query.get<Coordinate>("w", Coordinate::INVALID).to_pixels(1000);
+    sum += query.get<Coordinate>("h", Coordinate::INVALID).to_pixels(1000);
+    sum += static_cast<int>(query.get<float>("dpr", -1.0F));
+    sum += query.get<bool>("precrop", false) ? 1 : 0;
+
+    sum += static_cast<int>(query.get<Output>("output", Output::Origin));
+    sum += query.exists("cx") || query.exists("cy") || query.exists("cw") ||
+           query.exists("ch");
+    sum += static_cast<int>(query.get<Canvas>("fit", Canvas::Max));
+    sum += query.get<int>("trim", 0) + query.get<int>("page_height");
+    sum += query.get<int>("angle", 0);
+    sum += query.get<bool>("flip", false) + query.get<bool>("flop", false);
+    sum += static_cast<int>(query.get<Position>("a", Position::Center));
+    sum += query.get<Color>("bg", Color::DEFAULT).is_transparent() ? 1 : 0;
+    sum += static_cast<int>(query.get<float>("gam", 0.0F));
+    sum += static_cast<int>(query.get<float>("sharp", 0.0F));
+    sum += query.get_if<int>(
+        "q", [](int q) { return q >= 1 && q <= 100; }, 80);
+    sum += query.get<bool>("il", false) + query.get<int>("loop", -1);
+
+    return sum;
+}
+
+int main(int argc, const char *argv[]) {
+    int iterations = 1000000;
+    if (argc > 1) {
+        iterations = std::max(std::atoi(argv[1]), 1);
+    }
+
+    // Prevent the loops from being optimized away
+    volatile size_t sink = 0;
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto &query_string : queries) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            Query query(query_string);
+            sink = sink + query.exists("w");
+        }
+        auto parsed = std::chrono::steady_clock::now();
+
+        Query query(query_string);
+        for (int i = 0; i < iterations; ++i) {
+            sink = sink + lookup(query);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        auto parse_ns =
+            std::chrono::duration<double, std::nano>(parsed - start).count();
+        auto lookup_ns =
+            std::chrono::duration<double, std::nano>(end - parsed).count();
+
+        std::cout << std::left << std::setw(72) << query_string << std::right
+                  << " parse: " << std::setw(8) << parse_ns / iterations
+                  << "ns, lookups: " << std::setw(8) << lookup_ns / iterations
+                  << "ns" << std::endl;
+    }
+
+    return 0;
+}
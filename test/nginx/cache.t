@@ -0,0 +1,184 @@
+#!/usr/bin/env perl
+
+use Test::Nginx::Socket;
+use Test::Nginx::Util qw($ServerPort $ServerAddr);
+
+# Each request is checked 4 times, TEST 5 sends 3 requests
+plan tests => repeat_each() * (blocks() * 8 + 4);
+
+$ENV{TEST_NGINX_HTML_DIR} ||= html_dir();
+$ENV{TEST_NGINX_URI} = "http://$ServerAddr:$ServerPort";
+
+our $HttpConfig = qq{
+    error_log logs/error.log debug;
+
+    weserv_cache_zone images:1m;
+};
+
+our $TestGif = unhex(qq{
+0x0000:  47 49 46 38 39 61 01 00  01 00 80 01 00 00 00 00  |GIF89a.. ........|
+0x0010:  ff ff ff 21 f9 04 01 00  00 01 00 2c 00 00 00 00  |...!.... ...,....|
+0x0020:  01 00 01 00 00 02 02 4c  01 00 3b                 |.......L ..;|
+});
+
+# The same image with a different palette
+(our $TestGifModified = $TestGif) =~ s/\xff\xff\xff/\x00\x00\xff/;
+
+sub unhex {
+    my ($input) = @_;
+    my $buffer = '';
+
+    for my $l ($input =~ m/:  +((?:[0-9a-f]{2,4} +)+) /gms) {
+        for my $v ($l =~ m/[0-9a-f]{2}/g) {
+            $buffer .= chr(hex($v));
+        }
+    }
+
+    return $buffer;
+}
+
+no_shuffle();
+no_long_string();
+#no_diff();
+
+run_tests();
+
+__DATA__
+=== TEST 1: cache hit
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_cache images;
+        alias $TEST_NGINX_HTML_DIR;
+        add_header X-Cache-Status $weserv_cache_status always;
+    }
+--- request eval
+["GET /images/test.gif?output=png", "GET /images/test.gif?output=png"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers eval
+["X-Cache-Status: MISS", "X-Cache-Status: HIT"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 2: cache hit with normalized query parameters
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_cache images;
+        alias $TEST_NGINX_HTML_DIR;
+        add_header X-Cache-Status $weserv_cache_status always;
+    }
+--- request eval
+["GET /images/test.gif?w=1&h=1&output=gif", "GET /images/test.gif?output=gif&height=1&width=1"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers eval
+["X-Cache-Status: MISS", "X-Cache-Status: HIT"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 3: revalidate the source image
+--- http_config eval: $::HttpConfig
+--- config
+    location /static {
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /images {
+        weserv proxy;
+        weserv_cache images;
+        add_header X-Cache-Status $weserv_cache_status always;
+    }
+--- request eval
+["GET /images?url=$ENV{TEST_NGINX_URI}/static/test.gif&output=png", "GET /images?url=$ENV{TEST_NGINX_URI}/static/test.gif&output=png"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers eval
+["X-Cache-Status: MISS", "X-Cache-Status: REVALIDATED"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 4: separate entries with and without EXIF thumbnails
+--- http_config eval: $::HttpConfig
+--- config
+    location /thumbnail {
+        weserv filter;
+        weserv_cache images;
+        weserv_exif_thumbnail on;
+        alias $TEST_NGINX_HTML_DIR;
+        add_header X-Cache-Status $weserv_cache_status always;
+    }
+
+    location /images {
+        weserv filter;
+        weserv_cache images;
+        alias $TEST_NGINX_HTML_DIR;
+        add_header X-Cache-Status $weserv_cache_status always;
+    }
+--- request eval
+["GET /thumbnail/test.gif?output=png", "GET /images/test.gif?output=png"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers eval
+["X-Cache-Status: MISS", "X-Cache-Status: MISS"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 5: modified source image without validators
+--- http_config eval: $::HttpConfig
+--- config
+    # Conditional requests are answered by the modified image, without a
+    # Last-Modified header if If-Modified-Since was sent
+    location /origin/ {
+        if ($http_if_modified_since) {
+            rewrite ^/origin/(.*)$ /stripped/$1 last;
+        }
+        if ($http_if_none_match) {
+            rewrite ^/origin/(.*)$ /modified/$1 last;
+        }
+        alias $TEST_NGINX_HTML_DIR/original/;
+    }
+
+    location /modified/ {
+        alias $TEST_NGINX_HTML_DIR/modified/;
+    }
+
+    location /stripped/ {
+        proxy_pass $TEST_NGINX_URI/modified/;
+        proxy_set_header If-None-Match "";
+        proxy_set_header If-Modified-Since "";
+        proxy_hide_header Last-Modified;
+    }
+
+    location /images {
+        weserv proxy;
+        weserv_cache images;
+        add_header X-Cache-Status $weserv_cache_status always;
+    }
+--- request eval
+["GET /images?url=$ENV{TEST_NGINX_URI}/origin/test.gif&output=png", "GET /images?url=$ENV{TEST_NGINX_URI}/origin/test.gif&output=png", "GET /images?url=$ENV{TEST_NGINX_URI}/origin/test.gif&output=png"]
+--- user_files eval
+">>> original/test.gif
+$::TestGif
+>>> modified/test.gif
+$::TestGifModified"
+--- response_headers eval
+["X-Cache-Status: MISS", "X-Cache-Status: MISS", "X-Cache-Status: REVALIDATED"]
+--- no_error_log
+[error]
+[warn]
@@ -100,3 +100,184 @@ $::TestGif"
 --- no_error_log
 [error]
 [warn]
+
+
+=== TEST 4: GIF output within a thread pool
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_thread_pool default;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Content-Disposition: inline; filename=image.gif
+--- response_body_filters eval
+\&::gif_size
+--- response_body: 1 1
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 5: base64 output within a thread pool
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_thread_pool default;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif?encoding=base64
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+!Content-Disposition
+--- response_body_like: ^data:image/gif;base64,.*$
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 6: image loaded without copying
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        alias $TEST_NGINX_HTML_DIR;
+        add_header X-Bytes-Saved $weserv_bytes_saved;
+    }
+--- request
+    GET /images/test.gif?output=json
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+X-Bytes-Saved: 43
+--- response_body_like: ^.*"format":"gif","width":1,"height":1,.*$
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 7: streamed output
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_stream on;
+        weserv_output_buffer_size 16;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Transfer-Encoding: chunked
+--- response_body_filters eval
+\&::gif_size
+--- response_body: 1 1
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 8: timings
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_timings on;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers_like
+Server-Timing: load;dur=[\d.]+;desc="cpu=[\d.-]+", .*save;dur=[\d.]+;desc="cpu=[\d.-]+"
+--- response_body_filters eval
+\&::gif_size
+--- response_body: 1 1
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 9: libvips concurrency scaled with the image dimensions
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_vips_concurrency 4;
+        alias $TEST_NGINX_HTML_DIR;
+        add_header X-Vips-Concurrency $weserv_vips_concurrency;
+    }
+--- request
+    GET /images/test.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+X-Vips-Concurrency: 1
+--- response_body_filters eval
+\&::gif_size
+--- response_body: 1 1
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 10: streamed output that fits within a single buffer
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        weserv_stream on;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+!Transfer-Encoding
+--- response_body_filters eval
+\&::gif_size
+--- response_body: 1 1
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 11: negotiated output ignores the accept argument
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif?output=auto&accept=webp
+--- more_headers
+Accept: image/png
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers_like
+Content-Type: ^image/(?!webp)
+--- response_body_unlike: ^RIFF
+--- no_error_log
+[error]
+[warn]
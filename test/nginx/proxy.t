@@ -10,6 +10,9 @@ $ENV{TEST_NGINX_HTML_DIR} ||= html_dir();
 $ENV{TEST_NGINX_URI} = "http://$ServerAddr:$ServerPort";
 $ENV{TEST_NGINX_SVG} = '<svg viewBox="0 0 1 1"></svg>';
 
+# A GIF header of 32x32 pixels, padded so that its dimensions can be sniffed
+our $LargeGif = "GIF89a\x20\x00\x20\x00" . ("\x00" x 32);
+
 our $HttpConfig = qq{
     error_log logs/error.log debug;
 };
@@ -192,3 +195,53 @@ $::TestSvgGzip"
 --- no_error_log
 [error]
 [warn]
+
+
+=== TEST 7: coalesced fetch
+--- http_config eval: $::HttpConfig
+--- config
+    location /static {
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /images {
+        weserv proxy;
+        weserv_coalesce on;
+    }
+--- user_files eval
+">>> test.svg
+$ENV{TEST_NGINX_SVG}"
+--- request eval
+['GET /static/test.svg', "GET /images?url=$ENV{TEST_NGINX_URI}/static/test.svg&output=json"]
+--- response_headers eval
+['Content-Type: image/svg+xml', 'Content-Type: application/json']
+--- response_body_like eval
+['^<svg', '^.*"format":"svg","width":1,"height":1,.*$']
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 8: reject an image that exceeds the pixel limit while downloading
+--- http_config eval: $::HttpConfig
+--- config
+    location /static {
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /images {
+        weserv proxy;
+        weserv_limit_input_pixels 100;
+    }
+--- user_files eval
+">>> large.gif
+$::LargeGif"
+--- request eval
+"GET /images?url=$ENV{TEST_NGINX_URI}/static/large.gif"
+--- response_headers
+Content-Type: application/json
+--- response_body_like: ^.*"code":404,"message":"Input image exceeds pixel limit.*$
+--- error_code: 404
+--- no_error_log
+[error]
+[warn]
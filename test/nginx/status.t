@@ -0,0 +1,99 @@
+#!/usr/bin/env perl
+
+use Test::Nginx::Socket;
+use Test::Nginx::Util qw($ServerPort $ServerAddr);
+
+plan tests => repeat_each() * (blocks() * 8);
+
+$ENV{TEST_NGINX_HTML_DIR} ||= html_dir();
+$ENV{TEST_NGINX_URI} = "http://$ServerAddr:$ServerPort";
+
+our $HttpConfig = qq{
+    error_log logs/error.log debug;
+};
+
+our $TestGif = unhex(qq{
+0x0000:  47 49 46 38 39 61 01 00  01 00 80 01 00 00 00 00  |GIF89a.. ........|
+0x0010:  ff ff ff 21 f9 04 01 00  00 01 00 2c 00 00 00 00  |...!.... ...,....|
+0x0020:  01 00 01 00 00 02 02 4c  01 00 3b                 |.......L ..;|
+});
+
+sub unhex {
+    my ($input) = @_;
+    my $buffer = '';
+
+    for my $l ($input =~ m/:  +((?:[0-9a-f]{2,4} +)+) /gms) {
+        for my $v ($l =~ m/[0-9a-f]{2}/g) {
+            $buffer .= chr(hex($v));
+        }
+    }
+
+    return $buffer;
+}
+
+no_shuffle();
+no_long_string();
+#no_diff();
+
+run_tests();
+
+__DATA__
+=== TEST 1: processed images by input and output type
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv filter;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /status {
+        weserv_status;
+    }
+--- request eval
+["GET /images/test.gif?output=png", "GET /status"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_body_like eval
+[qr/^\x89PNG/, qr/^weserv_images_total\{input="gif",output="png"\} 1$/m]
+--- error_code eval
+[200, 200]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 2: errors by code
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv proxy;
+    }
+
+    location /status {
+        weserv_status;
+    }
+--- request eval
+["GET /images?url=http:\\\\foobar", "GET /status"]
+--- response_body_like eval
+[qr/"code":400/, qr/^weserv_errors_total\{code="invalid_uri"\} 1$/m]
+--- error_code eval
+[400, 200]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 3: exposition format
+--- http_config eval: $::HttpConfig
+--- config
+    location /status {
+        weserv_status;
+    }
+--- request eval
+["GET /status", "HEAD /status"]
+--- response_headers eval
+["Content-Type: text/plain; version=0.0.4; charset=utf-8", "Content-Type: text/plain; version=0.0.4; charset=utf-8"]
+--- no_error_log
+[error]
+[warn]